@@ -3,21 +3,45 @@
 //
 
 #include "Map.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "Memory.h"
 #include "../lox/Enumerable.h"
+#include "../lox2/utils/hash.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ * Dense map: entries are appended in insertion order and a separate index
+ * table of entry positions, open addressed with linear probing, finds them
+ * by hash. Iterating is a linear walk over the entries.
+ *
+ * The entries live in blocks of 4, 8, 16, ... that are never moved, so
+ * the address map_get_slot returns stays valid while the map grows (the
+ * interpreter's upvalues point into environments this way). A removed
+ * entry stays in its block as a hole and its index slot becomes
+ * INDEX_DELETED so probes run through it.
+ */
+#define MAP_FIRST_BLOCK 4
+#define INDEX_EMPTY 0u
+#define INDEX_DELETED UINT32_MAX
 
 struct map_entry {
     const void * key;
     void * value;
-    struct map_entry * next;
+    size_t hash;
+    bool live;
 };
 struct map {
-    struct map_entry **buckets;
-    size_t num_buckets;
-    size_t size;
+    struct map_entry ** blocks;
+    size_t blocks_count;
+    size_t count;             // entries appended, holes included
+    size_t size;              // live entries
+    uint32_t * index;         // entry position + 1, or INDEX_EMPTY/INDEX_DELETED
+    size_t index_capacity;    // power of two, at least twice count
     hash_fn_t hash;
     cmp_fn_t cmp;
     map_clean_fn_t clean;
@@ -27,17 +51,12 @@ struct map {
 struct map_enumerator {
     enumerable_vtable_t vtable;
     struct map * map;
-    size_t bucket_index;
-    struct map_entry * entry;
+    map_iterator_t iterator;
+    const struct map_entry * entry;
 };
 
-static size_t hash_string(const void * key) {
-    const unsigned char * str = key;
-    size_t hash = 5381;
-    int c;
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
-    return hash;
+static size_t hash_key_string(const void * key) {
+    return hash_string(key);
 }
 static bool cmp_string(const void * key1, const void * key2) {
     return strcmp(key1, key2) == 0;
@@ -56,26 +75,69 @@ static void * copy_string(const void * key) {
 }
 
 map_config_t map_default_config(void) {
-    return (map_config_t){ .hash = hash_string, .cmp = cmp_string,
+    return (map_config_t){ .hash = hash_key_string, .cmp = cmp_string,
                             .kcopy = copy_string, .vcopy = copy_string,
                             .clean = clean_string };
 }
 
+// Entry n lives in block k where FIRST * (2^k - 1) <= n < FIRST * (2^(k+1) - 1)
+static size_t block_of(const size_t n) {
+    const unsigned long long q = n / MAP_FIRST_BLOCK + 1;
+#ifdef _MSC_VER
+    unsigned long k;
+    _BitScanReverse64(&k, q);
+    return k;
+#else
+    return sizeof(q) * 8 - 1 - __builtin_clzll(q);
+#endif
+}
+static struct map_entry * entry_at(const map_t * map, const size_t n) {
+    const size_t k = block_of(n);
+    return &map->blocks[k][n - MAP_FIRST_BLOCK * ((1ull << k) - 1)];
+}
+// Position of key's entry, or SIZE_MAX
+static size_t find_entry(const map_t * map, const void * key, const size_t hash) {
+    const size_t mask = map->index_capacity - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const uint32_t slot = map->index[i];
+        if (slot == INDEX_EMPTY) return SIZE_MAX;
+        if (slot == INDEX_DELETED) continue;
+        const struct map_entry * entry = entry_at(map, slot - 1);
+        if (entry->hash == hash && map->cmp(entry->key, key)) return slot - 1;
+    }
+}
+static void index_insert(const map_t * map, const size_t position, const size_t hash) {
+    const size_t mask = map->index_capacity - 1;
+    size_t i = hash & mask;
+    while (map->index[i] != INDEX_EMPTY) i = (i + 1) & mask;
+    map->index[i] = (uint32_t)(position + 1);
+}
+// Rebuilds the index at the given capacity, dropping deleted slots
+static void index_resize(map_t * map, const size_t capacity) {
+    map->index = memory_allocate(capacity * sizeof(uint32_t));
+    memset(map->index, 0, capacity * sizeof(uint32_t));
+    map->index_capacity = capacity;
+    for (size_t n = 0; n < map->count; n++) {
+        const struct map_entry * entry = entry_at(map, n);
+        if (entry->live) index_insert(map, n, entry->hash);
+    }
+}
+
 // API
 map_t *map_create(const size_t num_buckets, const map_config_t config) {
-    //map_t *map = malloc(sizeof(map_t));
     map_t *map = memory_allocate(sizeof(map_t));
     if (!map) return NULL;
-    //map->buckets = calloc(num_buckets, sizeof(struct map_entry*));
-    map->buckets = memory_allocate(num_buckets * sizeof(struct map_entry*));
-    memset(map->buckets, 0, num_buckets * sizeof(struct map_entry*));
-    if (!map->buckets) {
-        //free(map);
-        return NULL;
-    }
-    map->num_buckets = num_buckets;
+    map->blocks = NULL;
+    map->blocks_count = 0;
+    map->count = 0;
     map->size = 0;
-    map->hash = config.hash ? config.hash : hash_string;
+    size_t capacity = 8;
+    while (capacity < num_buckets * 2) capacity *= 2;
+    map->index = memory_allocate(capacity * sizeof(uint32_t));
+    if (!map->index) return NULL;
+    memset(map->index, 0, capacity * sizeof(uint32_t));
+    map->index_capacity = capacity;
+    map->hash = config.hash ? config.hash : hash_key_string;
     map->cmp = config.cmp ? config.cmp : cmp_string;
     map->clean = config.clean ? config.clean : clean_string;
     map->kcopy = config.kcopy ? config.kcopy : copy_string;
@@ -86,69 +148,66 @@ map_t *map_create(const size_t num_buckets, const map_config_t config) {
 
 void map_destroy(map_t * map) {
     if (!map) return;
-    for (size_t i = 0; i < map->num_buckets; i++) {
-        const struct map_entry * entry = map->buckets[i];
-        while (entry) {
-            const struct map_entry *next = entry->next;
-            map->clean(entry->key, entry->value);
-            //free(entry);
-            entry = next;
-        }
+    for (size_t n = 0; n < map->count; n++) {
+        const struct map_entry * entry = entry_at(map, n);
+        if (entry->live) map->clean(entry->key, entry->value);
     }
-    //free(map->buckets);
-    //free(map);
+    // blocks and index belong to the memory region
 }
 
 bool map_put(map_t * map, const void * key, void * value) {
-    const size_t index = map->hash(key) % map->num_buckets;
-    struct map_entry * entry = map->buckets[index];
-    while (entry) {
-        if (map->cmp(entry->key, key)) {
-            entry->value = value;
-            return true;
-        }
-        entry = entry->next;
+    const size_t hash = map->hash(key);
+    const size_t found = find_entry(map, key, hash);
+    if (found != SIZE_MAX) {
+        entry_at(map, found)->value = value;
+        return true;
     }
-    // Not found: add new entry
-    //entry = malloc(sizeof(struct map_entry));
-    entry = memory_allocate(sizeof(struct map_entry));
-    if (!entry) return false;
+    // Not found: append a new entry, keeping the index at most half full
+    if ((map->count + 1) * 2 > map->index_capacity) index_resize(map, map->index_capacity * 2);
+    const size_t n = map->count;
+    const size_t k = block_of(n);
+    if (k == map->blocks_count) {
+        // only the table of block pointers moves, the entries stay put
+        map->blocks = memory_reallocate(map->blocks, k * sizeof(struct map_entry *),
+            (k + 1) * sizeof(struct map_entry *));
+        map->blocks[k] = memory_allocate((MAP_FIRST_BLOCK << k) * sizeof(struct map_entry));
+        if (!map->blocks[k]) return false;
+        map->blocks_count++;
+    }
+    struct map_entry * entry = entry_at(map, n);
     entry->key = map->kcopy(key);
     entry->value = map->vcopy(value);
-    entry->next = map->buckets[index];
-    map->buckets[index] = entry;
+    entry->hash = hash;
+    entry->live = true;
+    index_insert(map, n, hash);
+    map->count++;
     map->size++;
     return true;
 }
 
 void * map_get(const map_t * map, const void * key) {
-    const size_t index = map->hash(key) % map->num_buckets;
-    const struct map_entry * entry = map->buckets[index];
-    while (entry) {
-        if (map->cmp(entry->key, key))
-            return entry->value;
-        entry = entry->next;
-    }
-    return NULL;
+    const size_t found = find_entry(map, key, map->hash(key));
+    return found == SIZE_MAX ? NULL : entry_at(map, found)->value;
+}
+
+void ** map_get_slot(const map_t * map, const void * key) {
+    const size_t found = find_entry(map, key, map->hash(key));
+    return found == SIZE_MAX ? NULL : &entry_at(map, found)->value;
 }
 
 bool map_remove(map_t * map, const void * key) {
-    const size_t index = map->hash(key) % map->num_buckets;
-    struct map_entry * entry = map->buckets[index];
-    struct map_entry * prev = NULL;
-    while (entry) {
-        if (map->cmp(entry->key, key)) {
-            if (prev)
-                prev->next = entry->next;
-            else
-                map->buckets[index] = entry->next;
+    const size_t hash = map->hash(key);
+    const size_t mask = map->index_capacity - 1;
+    for (size_t i = hash & mask; map->index[i] != INDEX_EMPTY; i = (i + 1) & mask) {
+        if (map->index[i] == INDEX_DELETED) continue;
+        struct map_entry * entry = entry_at(map, map->index[i] - 1);
+        if (entry->hash == hash && map->cmp(entry->key, key)) {
             map->clean(entry->key, entry->value);
-            //free(entry);
+            entry->live = false;
+            map->index[i] = INDEX_DELETED;
             map->size--;
             return true;
         }
-        prev = entry;
-        entry = entry->next;
     }
     return false;
 }
@@ -157,15 +216,7 @@ size_t map_size(const map_t * map) {
     return map->size;
 }
 bool map_contains(const map_t * map, const void * key) {
-    const size_t index = map->hash(key) % map->num_buckets;
-    const struct map_entry *entry = map->buckets[index];
-    while (entry) {
-        if (map->cmp(entry->key, key)) {
-            return true;
-        }
-        entry = entry->next;
-    }
-    return false;
+    return find_entry(map, key, map->hash(key)) != SIZE_MAX;
 }
 
 
@@ -176,35 +227,34 @@ void * map_entry_value(const map_entry_t * entry) {
     return entry->value;
 }
 
+map_iterator_t map_iterator(const map_t * map) {
+    return (map_iterator_t){ .map = map, .position = 0 };
+}
+const map_entry_t * map_iterator_next(map_iterator_t * it) {
+    const map_t * map = it->map;
+    if (!map) return NULL;
+    while (it->position < map->count) {
+        const struct map_entry * entry = entry_at(map, it->position++);
+        if (entry->live) return entry;
+    }
+    return NULL;
+}
+
 
 // Enumerable interface implementations
 static void map_enum_reset(void * self) {
     map_enumerator_t * e = self;
-    e->bucket_index = 0;
+    e->iterator = map_iterator(e->map);
     e->entry = NULL;
 }
 static bool map_enum_next(void * self) {
     map_enumerator_t * e = self;
-    map_t * map = e->map;
-    if (!map) return false;
-
-    if (e->entry && e->entry->next) {
-        e->entry = e->entry->next;
-        return true;
-    }
-    while (e->bucket_index < map->num_buckets) {
-        struct map_entry * entry = map->buckets[e->bucket_index++];
-        if (entry) {
-            e->entry = entry;
-            return true;
-        }
-    }
-    e->entry = NULL;
-    return false;
+    e->entry = map_iterator_next(&e->iterator);
+    return e->entry != NULL;
 }
 static void * map_enum_current(const void * self) {
     const map_enumerator_t * e = self;
-    return e->entry;
+    return (void *)e->entry;
 }
 static void map_enum_destroy(void * self) {
     (void)self; // not implemented due to not using malloc to allocate
@@ -219,8 +269,6 @@ map_enumerator_t * map_get_enumerator(map_t * map) {
         .destroy = map_enum_destroy,
     };
     e->map = map;
-    e->bucket_index = 0;
-    e->entry = NULL;
     e->vtable.reset(e);
     return e;
 }
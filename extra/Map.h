@@ -2,7 +2,7 @@
 // Created by adrian on 2025-10-05.
 //
 /**
- * Generic hash-map implementation.
+ * Generic hash-map implementation, iterated in insertion order.
  *
  * Keys and values are stored as void pointers. For string keys, provide
  * appropriate hash and compare functions (e.g., hash_string, cmp_string),
@@ -31,6 +31,15 @@ typedef struct map map_t;
 typedef struct map_entry map_entry_t;
 typedef struct map_enumerator map_enumerator_t;
 
+// Allocation free iteration in insertion order:
+//   map_iterator_t it = map_iterator(map);
+//   const map_entry_t * entry;
+//   while ((entry = map_iterator_next(&it))) { ... }
+typedef struct {
+    const map_t * map;
+    size_t position;
+} map_iterator_t;
+
 typedef void (*map_clean_fn_t)(const void * key, const void * value);
 
 typedef struct {
@@ -47,6 +56,8 @@ void map_destroy(map_t *map);
 
 bool map_put(map_t * map, const void * key, void * value);
 void * map_get(const map_t * map, const void * key);
+// Address of the stored value, stable until the key is removed
+void ** map_get_slot(const map_t * map, const void * key);
 bool map_remove(map_t * map, const void * key);
 size_t map_size(const map_t * map);
 bool map_contains(const map_t * map, const void * key);
@@ -54,6 +65,9 @@ bool map_contains(const map_t * map, const void * key);
 const void * map_entry_key(const map_entry_t * entry);
 void * map_entry_value(const map_entry_t * entry);
 
+map_iterator_t map_iterator(const map_t * map);
+const map_entry_t * map_iterator_next(map_iterator_t * it);
+
 map_enumerator_t * map_get_enumerator(map_t * map);
 bool map_enumerator_next(map_enumerator_t * it);
 void * map_enumerator_current(map_enumerator_t * it);
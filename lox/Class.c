@@ -50,9 +50,9 @@ static object_t * class_call(const void * self, interpreter_t * p_interpreter, o
         function_call(initializer, p_interpreter, pp_arguments);
     } else {
         // no initializer found, use generic by binding all methods to instance
-        map_enumerator_t * it = map_get_enumerator(p_class->functions);
-        while (map_enumerator_next(it)) {
-            const map_entry_t * entry = map_enumerator_current(it);
+        map_iterator_t it = map_iterator(p_class->functions);
+        const map_entry_t * entry;
+        while ((entry = map_iterator_next(&it))) {
             // this is probably wrong, creates new object function with the same function instance
             object_t * field = new_object(OBJECT_FUNCTION, map_entry_value(entry));
             map_put(p_instance->fields, map_entry_key(entry), field);
@@ -78,4 +78,10 @@ void environment_assign_at(const int distance, const token_t * p_name, object_t
     environment_t * p_ancestor = environment_ancestor(distance, p_env);
     if (!p_ancestor) return;
     map_put(p_ancestor->values, p_name->lexeme, p_value);
-}
\ No newline at end of file
+}
+object_t ** environment_slot(const char * name, const environment_t * p_env) {
+    object_t ** p_slot = (object_t **)map_get_slot(p_env->values, name);
+    if (p_slot) return p_slot;
+    map_put(p_env->values, name, NULL);
+    return (object_t **)map_get_slot(p_env->values, name);
+}
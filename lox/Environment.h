@@ -19,4 +19,6 @@ void environment_define(const char * p_name, object_t * p_value, const environme
 environment_t * environment_ancestor(int distance, environment_t * p_env);
 object_t * environment_get_at(int distance, const char * name, environment_t * p_env);
 void environment_assign_at(int distance, const token_t * p_name, object_t * p_value, environment_t * p_env);
+// Defines the name if missing, the returned slot lives as long as the environment
+object_t ** environment_slot(const char * name, const environment_t * p_env);
 #endif //LOX_ENVIRONMENT_H
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "Token.h"
 
 #include "Object.h"
+#include "Upvalue.h"
 
 // Forward declarations
 typedef struct expr expr_t;
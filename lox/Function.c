@@ -13,15 +13,17 @@
 
 struct function {
     stmt_function_t * p_declaration;
-    environment_t * closure;
+    upvalue_t ** upvalues; // one per upvalue_desc_t of the declaration
     callable_vtable_t * vtable;
 };
 static int arity(void * self) {
     return 0;
 }
 static object_t * call(const void * self, interpreter_t * p_interpreter, object_t ** pp_arguments) {
-    const function_t * p_function = get_object_value(self);
-    environment_t * p_env = new_environment(p_function->closure);
+    function_t * p_function = get_object_value(self);
+    // variables of enclosing functions go through the upvalues, so a call
+    // only needs the globals above it
+    environment_t * p_env = new_environment(get_interpreter_globals(p_interpreter));
     for (size_t i = 0; i < *p_function->p_declaration->params_count; i++) {
         environment_define(p_function->p_declaration->params[i]->lexeme,
             pp_arguments[i], p_env);
@@ -29,17 +31,18 @@ static object_t * call(const void * self, interpreter_t * p_interpreter, object_
     //    environment_t * p_parent_env = get_interpreter_environment(p_interpreter);
 
     environment_t * previous = get_interpreter_environment(p_interpreter);
+    function_t * previous_closure = get_interpreter_closure(p_interpreter);
     set_interpreter_environment(p_interpreter, p_env);
+    set_interpreter_closure(p_interpreter, p_function);
     object_t * p_ret = NULL;
     for (size_t i = 0; i < *p_function->p_declaration->count; i++) {
         p_ret = execute(p_function->p_declaration->body[i], p_interpreter);
-        if (p_ret) {
-            set_interpreter_environment(p_interpreter, previous);
-            return p_ret;
-        }
+        if (p_ret) break;
     }
+    interpreter_close_upvalues(p_interpreter, p_env);
+    set_interpreter_closure(p_interpreter, previous_closure);
     set_interpreter_environment(p_interpreter, previous);
-    return NULL;
+    return p_ret;
 }
 static callable_vtable_t function_vtable = {
     .arity = arity,
@@ -48,17 +51,19 @@ static callable_vtable_t function_vtable = {
 callable_vtable_t * get_function_vtable(void) {
     return &function_vtable;
 }
-function_t * new_function(stmt_function_t * p_declaration, environment_t * closure) {
+function_t * new_function(stmt_function_t * p_declaration, upvalue_t ** pp_upvalues) {
     function_t * p_new = memory_allocate(sizeof(function_t));
     p_new->p_declaration = p_declaration;
-    // should clone the environment as the funciton closure
-    p_new->closure = closure;
+    p_new->upvalues = pp_upvalues;
     p_new->vtable = &function_vtable;
     return p_new;
 }
 size_t function_arity(const function_t * p_function) {
     return *p_function->p_declaration->params_count;
 }
+upvalue_t * function_get_upvalue(const function_t * p_function, const int index) {
+    return p_function->upvalues[index];
+}
 stmt_function_t * get_function_declaration(const function_t * p_function) {
     return p_function->p_declaration;
 }
@@ -12,7 +12,8 @@
 
 typedef struct function function_t;
 
-function_t * new_function(stmt_function_t * p_declaration, environment_t * closure);
+function_t * new_function(stmt_function_t * p_declaration, upvalue_t ** pp_upvalues);
+upvalue_t * function_get_upvalue(const function_t * p_function, int index);
 stmt_function_t * get_function_declaration(const function_t * p_function);
 object_t * function_call(const function_t * p_function, interpreter_t * p_interpreter,
     object_t ** pp_arguments);
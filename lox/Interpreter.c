@@ -21,6 +21,9 @@ struct interpreter {
     environment_t * globals;
     environment_t * environment;
     map_t * locals; // <expr_t*, int>
+    map_t * upvalues; // <expr_t*, int> index into the closure's upvalues
+    function_t * closure; // function being executed, NULL at top level
+    upvalue_t * open_upvalues; // still pointing into a live environment
     expr_visitor_t expr_visitor;
     stmt_visitor_t stmt_visitor;
     bool had_runtime_error;
@@ -81,6 +84,11 @@ interpreter_t * new_interpreter(void) {
     p_interpreter->locals = map_create(8,
         (map_config_t){hash_expr, cmp_expr, copy_expr, copy_expr, clean_expr
     });
+    p_interpreter->upvalues = map_create(8,
+        (map_config_t){hash_expr, cmp_expr, copy_expr, copy_expr, clean_expr
+    });
+    p_interpreter->closure = NULL;
+    p_interpreter->open_upvalues = NULL;
     p_interpreter->expr_visitor.visit_assign        = visit_assign_expr;
     p_interpreter->expr_visitor.visit_binary        = visit_binary_expr;
     p_interpreter->expr_visitor.visit_call          = visit_call_expr;
@@ -131,6 +139,34 @@ void set_interpreter_environment(interpreter_t * p_interpreter, environment_t *
 void interpreter_resolve(const expr_t * p_expr, const int depth, const interpreter_t * p_interpreter) {
     map_put(p_interpreter->locals, p_expr, (void*)(intptr_t)depth);
 }
+void interpreter_resolve_upvalue(const expr_t * p_expr, const int index,
+                                    const interpreter_t * p_interpreter) {
+    map_put(p_interpreter->upvalues, p_expr, (void*)(intptr_t)index);
+}
+environment_t * get_interpreter_globals(const interpreter_t * p_interpreter) {
+    return p_interpreter->globals;
+}
+function_t * get_interpreter_closure(const interpreter_t * p_interpreter) {
+    return p_interpreter->closure;
+}
+void set_interpreter_closure(interpreter_t * p_interpreter, function_t * p_closure) {
+    p_interpreter->closure = p_closure;
+}
+void interpreter_close_upvalues(interpreter_t * p_interpreter, const environment_t * p_env) {
+    upvalue_t ** pp_upvalue = &p_interpreter->open_upvalues;
+    while (*pp_upvalue) {
+        upvalue_t * p_upvalue = *pp_upvalue;
+        if (p_upvalue->environment != p_env) {
+            pp_upvalue = &p_upvalue->next;
+            continue;
+        }
+        p_upvalue->closed = *p_upvalue->location;
+        p_upvalue->location = &p_upvalue->closed;
+        p_upvalue->environment = NULL;
+        *pp_upvalue = p_upvalue->next;
+        p_upvalue->next = NULL;
+    }
+}
 
 // Private helper functions
 static void check_runtime_error(interpreter_t * p_interpreter) {
@@ -179,7 +215,28 @@ bool is_truthy(const object_t * p_obj) {
         default: return false;
     }
 }
+static upvalue_t * capture_upvalue(interpreter_t * p_interpreter, environment_t * p_env,
+                                    const char * name) {
+    object_t ** p_slot = environment_slot(name, p_env);
+    for (upvalue_t * p_upvalue = p_interpreter->open_upvalues; p_upvalue; p_upvalue = p_upvalue->next) {
+        if (p_upvalue->location == p_slot) return p_upvalue;
+    }
+    upvalue_t * p_upvalue = memory_allocate(sizeof(upvalue_t));
+    p_upvalue->location = p_slot;
+    p_upvalue->closed = NULL;
+    p_upvalue->environment = p_env;
+    p_upvalue->next = p_interpreter->open_upvalues;
+    p_interpreter->open_upvalues = p_upvalue;
+    return p_upvalue;
+}
+static upvalue_t * resolved_upvalue(const expr_t * p_expr, const interpreter_t * p_interpreter) {
+    if (!map_contains(p_interpreter->upvalues, p_expr)) return NULL;
+    const int index = (int)(intptr_t)map_get(p_interpreter->upvalues, p_expr);
+    return function_get_upvalue(p_interpreter->closure, index);
+}
 object_t * lookup_variable(token_t * p_name, const expr_t * p_expr, const interpreter_t * p_interpreter) {
+    const upvalue_t * p_upvalue = resolved_upvalue(p_expr, p_interpreter);
+    if (p_upvalue) return *p_upvalue->location;
     const int distance = (int)map_get(p_interpreter->locals, p_expr);
     if (map_contains(p_interpreter->locals, p_expr) && distance >= 0) {
         return environment_get_at(distance, p_name->lexeme, p_interpreter->environment);
@@ -193,7 +250,10 @@ static void * visit_assign_expr(const expr_t * p_expr, void * p_ctx) {
     interpreter_t * p_interpreter = p_ctx;
     object_t * p_value  = evaluate(expr.value, p_interpreter);
     check_runtime_error(p_ctx);
-    if (map_contains(p_interpreter->locals, expr.target)) {
+    const upvalue_t * p_upvalue = resolved_upvalue(expr.target, p_interpreter);
+    if (p_upvalue) {
+        *p_upvalue->location = p_value;
+    } else if (map_contains(p_interpreter->locals, expr.target)) {
         const int distance = (int)map_get(p_interpreter->locals, expr.target);
         if (distance >= 0) {
             environment_assign_at(distance, expr.target->as.variable_expr.name,
@@ -397,6 +457,8 @@ static void * visit_block_stmt(const stmt_t * p_stmt, void * p_ctx) {
             p_interpreter->environment = previous;
         check_runtime_error(p_ctx);
     }
+    interpreter_close_upvalues(p_interpreter, environment);
+    p_interpreter->environment = previous;
     return NULL;
 }
 static void * visit_class_stmt(const stmt_t * p_stmt, void * p_ctx) {
@@ -406,7 +468,7 @@ static void * visit_class_stmt(const stmt_t * p_stmt, void * p_ctx) {
     class_t * p_class = new_class(stmt.name->lexeme);
     interpreter_t * p_interpreter = p_ctx;
     environment_t * previous = p_interpreter->environment;
-    environment_t * class_env = new_environment(NULL);
+    environment_t * class_env = new_environment(previous);
     p_interpreter->environment = class_env;
     for (size_t i = 0; i < stmt.methods_count; i++) {
         execute(stmt.methods[i], p_ctx);
@@ -436,12 +498,24 @@ static void * visit_function_stmt(const stmt_t * p_stmt, void * p_ctx) {
     stmt->count         = p_stmt->as.function_stmt.count;
     stmt->params        = p_stmt->as.function_stmt.params;
     stmt->params_count  = p_stmt->as.function_stmt.params_count;
+    stmt->upvalues      = p_stmt->as.function_stmt.upvalues;
+    stmt->upvalues_count = p_stmt->as.function_stmt.upvalues_count;
 
-
-    function_t * p_function = new_function(stmt, ((interpreter_t*)p_ctx)->environment);
+    // capture only what the resolver found, the environment itself is not kept
+    interpreter_t * p_interpreter = p_ctx;
+    environment_t * p_env = p_interpreter->environment;
+    environment_define(stmt->name->lexeme, NULL, p_env); // recursion captures its own slot
+    upvalue_t ** pp_upvalues = memory_allocate(stmt->upvalues_count * sizeof(upvalue_t*));
+    for (size_t i = 0; i < stmt->upvalues_count; i++) {
+        const upvalue_desc_t desc = stmt->upvalues[i];
+        pp_upvalues[i] = desc.is_local
+            ? capture_upvalue(p_interpreter, environment_ancestor(desc.index, p_env), desc.name)
+            : function_get_upvalue(p_interpreter->closure, desc.index);
+    }
+    function_t * p_function = new_function(stmt, pp_upvalues);
 
     object_t * p_object = new_object(OBJECT_FUNCTION, p_function);
-    environment_define(stmt->name->lexeme, p_object, ((interpreter_t*)p_ctx)->environment);
+    environment_define(stmt->name->lexeme, p_object, p_env);
     return NULL;
 }
 static void * visit_if_stmt(const stmt_t * p_stmt, void * p_ctx) {
@@ -12,6 +12,7 @@
 
 // Interpreter implements the Visitors for Expressions and Statements
 typedef struct interpreter interpreter_t;
+typedef struct function function_t;
 
 // API
 interpreter_t * new_interpreter     (void);
@@ -24,4 +25,9 @@ void * execute                      (const stmt_t * p_stmt,
 environment_t * get_interpreter_environment(const interpreter_t * p_interpreter);
 void set_interpreter_environment(interpreter_t * p_interpreter, environment_t * p_env);
 void interpreter_resolve(const expr_t * p_expr, int depth, const interpreter_t * p_interpreter);
+void interpreter_resolve_upvalue(const expr_t * p_expr, int index, const interpreter_t * p_interpreter);
+environment_t * get_interpreter_globals(const interpreter_t * p_interpreter);
+function_t * get_interpreter_closure(const interpreter_t * p_interpreter);
+void set_interpreter_closure(interpreter_t * p_interpreter, function_t * p_closure);
+void interpreter_close_upvalues(interpreter_t * p_interpreter, const environment_t * p_env);
 #endif //LOX_INTERPRETER_H
\ No newline at end of file
@@ -23,9 +23,16 @@ enum function_type {
     FUNCTION_TYPE_METHOD,
 };
 
+// A function being resolved, scopes from scope_base up belong to it
+typedef struct {
+    stmt_function_t * p_function;
+    size_t scope_base;
+} function_scope_t;
+
 struct resolver {
     interpreter_t * p_interpreter;
     stack_t * scopes;
+    stack_t * functions; // Stack<function_scope_t*>
     enum function_type current_function;
     expr_visitor_t expr_visitor;
     stmt_visitor_t stmt_visitor;
@@ -96,6 +103,7 @@ resolver_t * new_resolver(interpreter_t * p_interpreter) {
 
     p_resolver->p_interpreter = p_interpreter;
     p_resolver->scopes = stack_create(8);
+    p_resolver->functions = stack_create(8);
     p_resolver->current_function = FUNCTION_TYPE_NONE;
 
     return p_resolver;
@@ -151,27 +159,72 @@ static void define(const token_t * p_name, const  resolver_t * p_resolver) {
     map_t * scope = stack_peek(p_resolver->scopes);
     map_put(scope, p_name->lexeme, (void*)true);
 }
-static void resolve_function(const stmt_function_t stmt, enum function_type type,
+static void resolve_function(stmt_function_t * p_stmt, enum function_type type,
                                 resolver_t * p_resolver) {
     const enum function_type enclosing_function = p_resolver->current_function;
     p_resolver->current_function = type;
+    function_scope_t * p_scope = memory_allocate(sizeof(function_scope_t));
+    p_scope->p_function = p_stmt;
+    p_scope->scope_base = stack_size(p_resolver->scopes);
+    stack_push(p_resolver->functions, p_scope);
     begin_scope(p_resolver);
-    for (size_t i = 0; i < *stmt.params_count; i++) {
-        declare(stmt.params[i], p_resolver);
-        define(stmt.params[i], p_resolver);
+    for (size_t i = 0; i < *p_stmt->params_count; i++) {
+        declare(p_stmt->params[i], p_resolver);
+        define(p_stmt->params[i], p_resolver);
     }
-    for (size_t i = 0; i < *stmt.count; i++) {
-        resolve_stmt(stmt.body[i], p_resolver);
+    for (size_t i = 0; i < *p_stmt->count; i++) {
+        resolve_stmt(p_stmt->body[i], p_resolver);
     }
     end_scope(p_resolver);
+    stack_pop(p_resolver->functions);
     p_resolver->current_function = enclosing_function;
 }
+static int add_upvalue(stmt_function_t * p_function, const char * name,
+                        const bool is_local, const int index) {
+    for (size_t i = 0; i < p_function->upvalues_count; i++) {
+        const upvalue_desc_t * p_desc = &p_function->upvalues[i];
+        if (p_desc->is_local == is_local && p_desc->index == index
+                && strcmp(p_desc->name, name) == 0)
+            return (int)i;
+    }
+    upvalue_desc_t * p_upvalues = memory_allocate(
+        (p_function->upvalues_count + 1) * sizeof(upvalue_desc_t));
+    if (p_function->upvalues_count)
+        memcpy(p_upvalues, p_function->upvalues,
+            p_function->upvalues_count * sizeof(upvalue_desc_t));
+    p_upvalues[p_function->upvalues_count] = (upvalue_desc_t){name, is_local, index};
+    p_function->upvalues = p_upvalues;
+    return (int)p_function->upvalues_count++;
+}
+// Threads a variable declared in scope_index through every function between
+// it and the function at 'level', returns the upvalue index in that function
+static int resolve_upvalue(const resolver_t * p_resolver, const size_t level,
+                            const char * name, const size_t scope_index) {
+    const function_scope_t * p_scope = p_resolver->functions->data[level];
+    if (level == 0 || scope_index >=
+            ((function_scope_t*)p_resolver->functions->data[level - 1])->scope_base) {
+        // declared in the environment chain the function is created in
+        const int depth = (int)(p_scope->scope_base - 1 - scope_index);
+        return add_upvalue(p_scope->p_function, name, true, depth);
+    }
+    const int index = resolve_upvalue(p_resolver, level - 1, name, scope_index);
+    return add_upvalue(p_scope->p_function, name, false, index);
+}
 static void resolve_local( const expr_t * p_expr, const token_t * p_token, const resolver_t * p_resolver) {
     for (int i = (int)stack_size(p_resolver->scopes) - 1; i >= 0; i--) {
         const map_t * scope = (map_t*)p_resolver->scopes->data[i];
         if (map_contains(scope, p_token->lexeme)) {
-            const int distance = (int)stack_size(p_resolver->scopes) - 1 - i;
-            interpreter_resolve(p_expr, distance, p_resolver->p_interpreter);
+            const function_scope_t * p_function = stack_is_empty(p_resolver->functions)
+                ? NULL : stack_peek(p_resolver->functions);
+            if (!p_function || (size_t)i >= p_function->scope_base) {
+                const int distance = (int)stack_size(p_resolver->scopes) - 1 - i;
+                interpreter_resolve(p_expr, distance, p_resolver->p_interpreter);
+                return;
+            }
+            // belongs to an enclosing function, reached through the closure
+            const int index = resolve_upvalue(p_resolver,
+                stack_size(p_resolver->functions) - 1, p_token->lexeme, (size_t)i);
+            interpreter_resolve_upvalue(p_expr, index, p_resolver->p_interpreter);
             return;
         }
     }
@@ -260,10 +313,12 @@ static void * visit_class_stmt(const stmt_t * p_stmt, void * p_ctx) {
     const stmt_class_t stmt = p_stmt->as.class_stmt;
     declare(stmt.name, p_ctx);
     define(stmt.name, p_ctx);
+    begin_scope(p_ctx); // the class environment methods are created in
     for (size_t i = 0; i < stmt.methods_count; i++) {
         const enum function_type declaration = FUNCTION_TYPE_METHOD;
-        resolve_function(stmt.methods[i]->as.function_stmt, declaration, p_ctx);
+        resolve_function(&stmt.methods[i]->as.function_stmt, declaration, p_ctx);
     }
+    end_scope(p_ctx);
     return NULL;
 }
 static void * visit_expression_stmt    (const stmt_t * p_stmt, void * p_ctx) {
@@ -272,10 +327,11 @@ static void * visit_expression_stmt    (const stmt_t * p_stmt, void * p_ctx) {
     return NULL;
 }
 static void * visit_function_stmt(const stmt_t * p_stmt, void * p_ctx) {
-    const stmt_function_t stmt = p_stmt->as.function_stmt;
-    declare(stmt.name, p_ctx);
-    define(stmt.name, p_ctx);
-    resolve_function(stmt, FUNCTION_TYPE_FUNCTION, p_ctx);
+    // the resolver records the function's upvalues in its declaration
+    stmt_function_t * p_function = (stmt_function_t *)&p_stmt->as.function_stmt;
+    declare(p_function->name, p_ctx);
+    define(p_function->name, p_ctx);
+    resolve_function(p_function, FUNCTION_TYPE_FUNCTION, p_ctx);
     return NULL;
 }
 static void * visit_if_stmt(const stmt_t * p_stmt, void * p_ctx) {
@@ -9,6 +9,7 @@
 #include "Token.h"
 
 #include "Object.h"
+#include "Upvalue.h"
 
 // Forward declarations
 typedef struct stmt stmt_t;
@@ -51,6 +52,8 @@ typedef struct {
 	size_t * params_count;
 	stmt_t ** body;
 	size_t * count;
+	upvalue_desc_t * upvalues;
+	size_t upvalues_count;
 	
 } stmt_function_t;
 
@@ -0,0 +1,31 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#ifndef LOX_UPVALUE_H
+#define LOX_UPVALUE_H
+
+#include <stdbool.h>
+
+#include "Environment.h"
+#include "Object.h"
+
+// Resolver output, one per variable a function uses from an enclosing function.
+typedef struct {
+    const char * name;
+    bool is_local;  // captured straight from the environment the function is declared in
+    int index;      // is_local ? environment depth from the declaration : enclosing closure's upvalue
+} upvalue_desc_t;
+
+// Runtime cell shared by every closure capturing the same variable. While open
+// it points into the environment declaring the variable, once that environment
+// ends the value moves into 'closed' and the environment is no longer needed.
+typedef struct upvalue upvalue_t;
+struct upvalue {
+    object_t ** location;
+    object_t * closed;
+    const environment_t * environment;
+    upvalue_t * next; // open upvalue list
+};
+
+#endif //LOX_UPVALUE_H
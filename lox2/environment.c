@@ -4,6 +4,9 @@
 
 #include "environment.h"
 #include "../tests/map/map2.h"
+#include "utils/hash.h"
+#include "gc.h"
+#include "utils/slab.h"
 #include <stdlib.h>
 
 #undef NULL
@@ -20,54 +23,52 @@
  * have stable lifetime (interned or strdup'd). If map_destroy frees keys and you
  * didn't strdup, adapt config to not free keys.
  */
-static void * copy_value(void const * val) {
-    value_t * copy = malloc(sizeof(value_t));
-    memcpy(copy, val, sizeof(value_t));
-    return copy;
-}
-static void free_value(void * val) {
-    free(val);
-}
 static void * str_copy(void const * ptr) {
     size_t const len = strlen(ptr);
-    char * copy = malloc(len + 1);
+    char * copy = slab_alloc(len + 1);
     memcpy(copy, ptr, len);
     copy[len] = '\0';
     return copy;
 }
+static void str_free(void * ptr) {
+    slab_free(ptr, strlen(ptr) + 1);
+}
+// Drops from environment slots are batched, see obj_dec_ref_deferred
+static void value_release(void * p_value) {
+    value_t * p_val = p_value;
+    if (value_type(*p_val) == VAL_OBJ) obj_dec_ref_deferred(value_as_object(*p_val));
+    *p_val = value_nil();
+}
 static bool str_equal(void const * a, void const * b) {
     if (!a || !b) return false;
     return strcmp(a, b) == 0;
 }
 static size_t str_hash(void const * key) {
-    if (!key) return 0;
-    unsigned char const * s = key;
-    size_t hash = 5381;
-    int c;
-    while ((c = *s++))
-        hash = ((hash << 5) + hash) + c;
-    return hash;
+    return hash_string(key);
+}
+// The map takes over the value's reference, releasing the one it replaces
+static void store(map_t * values, char const * name, size_t const hash, value_t const * value) {
+    bool inserted;
+    value_t * p_slot = map_emplace_hashed(values, name, hash, &inserted);
+    if (!inserted) value_release(p_slot);
+    *p_slot = *value;
+    gc_value_barrier(value);
 }
 environment_t * environment_create(environment_t * enclosing) {
-    //<char*,value_t*> map
+    //<char*,value_t> map, values stored inline in the table
     map_config_t const cfg = {
         .key_copy = str_copy,
         .key_equals = str_equal,
         .key_hash = str_hash,
-        .key_free = free,
+        .key_free = str_free,
         .key_size = sizeof(char*),
         .value_size = sizeof(value_t),
-        .value_copy = copy_value,
-        .value_free = free_value
+        .value_free = value_release,
     };
     /* choose initial bucket count conservatively */
-    map_t * m = map_create(16, &cfg);
+    map_t * m = map_create(8, &cfg);
     if (!m) return NULL;
-    environment_t * env = malloc(sizeof(environment_t));
-    if (!env) {
-        map_destroy(m);
-        return NULL;
-    }
+    environment_t * env = slab_alloc(sizeof(environment_t));
     env->values = m;
     env->enclosing = enclosing;
     return env;
@@ -76,48 +77,46 @@ environment_t * environment_create(environment_t * enclosing) {
 void environment_destroy(environment_t * env) {
     if (!env) return;
     if (env->values) map_destroy(env->values);
-    free(env);
+    slab_free(env, sizeof(environment_t));
 }
 
-void environment_define(environment_t * env, char const * name, value_t * value) {
+void environment_define(environment_t * env, char const * name, size_t const hash,
+    value_t * value) {
     if (!env) return;
-    /* put overwrites any previous value in this environment */
-    map_put(env->values, name, value);
+    /* overwrites any previous value in this environment, in place */
+    store(env->values, name, hash, value);
 }
 
-value_t * environment_get(environment_t const * env, char const * name) {
+value_t * environment_get(environment_t const * env, char const * name, size_t const hash) {
     environment_t const * curr = env;
     while (curr) {
-        if (map_contains(curr->values, name)) {
-            value_t * ret;
-            map_get(curr->values, name, (void**)&ret);
-            return ret;
-        }
+        value_t * ret = map_find_hashed(curr->values, name, hash);
+        if (ret) return ret;
         curr = curr->enclosing;
     }
     return NULL;
 }
 
-value_t * environment_get_at(environment_t * env, int const distance, char const * name) {
+value_t * environment_get_at(environment_t * env, int const distance, char const * name,
+    size_t const hash) {
     environment_t * curr = env;
     for (int i = 0; i < distance; ++i) {
         if (!curr) return NULL;
         curr = curr->enclosing;
     }
     if (!curr) return NULL;
-    if (map_contains(curr->values, name)) {
-        value_t * ret;
-        map_get(curr->values, name, (void**)&ret);
-        return ret;
-    }
-    return NULL;
+    return map_find_hashed(curr->values, name, hash);
 }
 
-bool environment_assign(environment_t const * env, char const * name, value_t * value) {
+bool environment_assign(environment_t const * env, char const * name, size_t const hash,
+    value_t * value) {
     environment_t const * curr = env;
     while (curr) {
-        if (map_contains(curr->values, name)) {
-            map_put(curr->values, name, value);
+        value_t * p_slot = map_slot_hashed(curr->values, name, hash);
+        if (p_slot) {
+            value_release(p_slot);
+            *p_slot = *value;
+            gc_value_barrier(value);
             return true;
         }
         curr = curr->enclosing;
@@ -126,20 +125,16 @@ bool environment_assign(environment_t const * env, char const * name, value_t *
 }
 
 bool environment_assign_at(environment_t * env, int const distance,
-    char const * name, value_t * value) {
+    char const * name, size_t const hash, value_t * value) {
     environment_t * curr = env;
     for (int i = 0; i < distance; ++i) {
         if (!curr) return false;
         curr = curr->enclosing;
     }
     if (!curr) return false;
-    if (map_contains(curr->values, name)) {
-        map_put(curr->values, name, value);
-        return true;
-    }
     /* If the binding isn't present at that depth, you can still choose to
      * set it (create new) or treat as error. Here we create/overwrite.
      */
-    map_put(curr->values, name, value);
+    store(curr->values, name, hash, value);
     return true;
 }
\ No newline at end of file
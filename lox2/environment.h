@@ -26,22 +26,29 @@ environment_t * environment_create(environment_t * enclosing);
 /* Destroy an environment (does not destroy enclosing). Frees the map. */
 void environment_destroy(environment_t * env);
 
+/* Every name takes its hash_string() hash along, identifier tokens carry it
+ * from the scanner so names are never rehashed per lookup. */
+
+/* Values stored by define/assign are owned by the environment from then on:
+ * the reference the caller held moves in, an overwritten value is released
+ * and so is every value when the environment is destroyed. */
+
 /* Define a name in this environment (creates/overwrites in this environment) */
-void environment_define(environment_t *env,  char const * name, value_t * value);
+void environment_define(environment_t *env,  char const * name, size_t hash, value_t * value);
 
 /* Get a name in the current environment chain. Returns NULL if not found. */
-value_t * environment_get(environment_t const * env,  char const * name);
+value_t * environment_get(environment_t const * env,  char const * name, size_t hash);
 
 /* Get a name at a lexical distance (0 = current env, 1 = immediate enclosing, ...).
  * Returns NULL if not found at that depth. */
-value_t * environment_get_at(environment_t * env, int distance,  char const * name);
+value_t * environment_get_at(environment_t * env, int distance,  char const * name, size_t hash);
 
 /* Assign to an existing name in the chain. Returns true on success, false if not found. */
-bool environment_assign(environment_t const * env,  char const * name, value_t * value);
+bool environment_assign(environment_t const * env,  char const * name, size_t hash, value_t * value);
 
 /* Assign at a lexical distance (0 = current env, ...). Returns true on success. */
 bool environment_assign_at(environment_t * env, int distance,
-     char const * name, value_t * value);
+     char const * name, size_t hash, value_t * value);
 
 
 #endif //LOX_ENVIRONMENT_H
\ No newline at end of file
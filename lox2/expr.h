@@ -44,6 +44,7 @@ typedef enum {
 typedef struct {
 	 expr_t * target;
 	 expr_t * value;
+	 bool borrowed;
 } expr_assign_t;
 
 typedef struct {
@@ -101,6 +102,10 @@ typedef struct {
 typedef struct {
 	 token_t * name;
 	 int depth;
+	 int slot;
+	 int global;
+	 bool borrowed;
+	 bool moved;
 } expr_variable_t;
 
 struct expr {
@@ -0,0 +1,903 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#include "gc.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+#ifdef LOX_GC
+
+#define GC_ALIGNMENT 16
+#define GC_MARK_BATCH 64        // objects a helper visits between budget updates
+#define GC_PARALLEL_MIN 256     // heap and budget, in objects, worth waking the helpers for
+#define GC_STEAL_MAX 256        // most objects taken from another marker at once
+
+typedef struct {
+    gc_roots_fn fn;
+    void * context;
+} root_set_t;
+
+// Growable array of object pointers
+typedef struct {
+    object_t ** data;
+    size_t count;
+    size_t capacity;
+} object_list_t;
+
+typedef enum {
+    GC_IDLE,
+    GC_MARK,
+    GC_SWEEP
+} gc_phase_t;
+
+// What gc_mark_object does with a reference
+typedef enum {
+    GC_MODE_MARK,      // shades an old object
+    GC_MODE_PROMOTE,   // minor collection: moves a young object out of the nursery
+    GC_MODE_RELOCATE   // compaction: points it at the object's new copy
+} gc_mode_t;
+
+// Block of compacted objects, aligned to its size so an object finds its page
+typedef struct gc_page {
+    struct gc_page * next;
+    size_t used;   // bump offset
+    size_t live;   // bytes of objects not freed yet
+} gc_page_t;
+
+#define GC_PAGE_HEADER ((sizeof(gc_page_t) + GC_ALIGNMENT - 1) & ~(size_t)(GC_ALIGNMENT - 1))
+
+/*
+ * Gray objects, marked but with children not yet visited, kept per marking
+ * thread (the mutator's first). The owner works from its local stack
+ * without locking; while helpers are marking it moves the bottom half to
+ * the shared stack whenever that is empty, and a marker out of work takes
+ * half of someone's shared stack, so the locks are rarely contended.
+ */
+typedef struct {
+    mtx_t lock;                 // shared, and only while helpers are marking
+    object_list_t local;
+    object_list_t shared;
+    atomic_size_t visible;      // shared.count, for markers looking for work
+    char padding[64];
+} marker_t;
+
+static marker_t g_markers[GC_MAX_THREADS + 1];
+static thread_local marker_t * t_marker = NULL;  // NULL on the mutator
+
+typedef enum {
+    JOB_MARK,
+    JOB_SWEEP
+} job_t;
+
+// Helper threads, started on first use and parked between jobs
+static struct {
+    once_flag once;
+    mtx_t lock;
+    cnd_t wake;              // a job was posted
+    cnd_t done;              // the last helper finished it
+    size_t started;
+    size_t generation;       // bumped per job
+    job_t job;
+    size_t participants;     // helpers 1..participants take part
+    size_t running;          // helpers not done with the job yet
+    // marking
+    atomic_bool parallel;    // the gray stacks are shared
+    atomic_size_t active;    // markers with work or looking for it
+    atomic_size_t budget;    // left for this step
+    atomic_bool stop;        // out of budget
+    // background sweep: the detached list in, survivors and dead strings out
+    object_t * sweep_list;
+    bool sweep_epoch;
+    object_t * survivors;
+    object_t * survivors_tail;
+    object_t * dead_strings;
+    size_t freed_objects;
+    size_t freed_bytes;
+    size_t freed_malloc_bytes;
+} g_pool = { .once = ONCE_FLAG_INIT };
+
+static struct {
+    // old generation. An old object is black or gray when its marked flag
+    // equals epoch, which flips at the start of every cycle so everything
+    // turns white at once without a pass over the heap.
+    object_t * objects;      // all old objects, except those waiting to be swept
+    object_t * unswept;      // detached for the sweep phase
+    size_t objects_count;
+    size_t bytes_allocated;
+    size_t next_gc;
+    size_t collections;
+    gc_phase_t phase;
+    bool epoch;
+    size_t step_work;
+    size_t threads;          // helper threads marking and sweeping
+    bool sweeping;           // a helper is sweeping unswept's old contents
+    size_t parallel_marks;
+    size_t background_sweeps;
+    // young generation
+    char * nursery;
+    char * top;
+    bool nursery_full;       // an allocation did not fit since the last minor collection
+    size_t young_count;
+    object_list_t young_strings;  // interned, for the weak table
+    object_list_t remembered;     // old objects that may point into the nursery
+    object_list_t promoted;       // copied by the running minor collection, not yet scanned
+    size_t minor_collections;
+    gc_mode_t mode;
+    // compaction. Malloc keeps what the sweep frees for reuse, so the heap
+    // it holds is estimated as the most the old generation had in malloc
+    // blocks since it was last compacted.
+    gc_page_t * pages;
+    size_t pages_count;
+    size_t malloc_bytes;     // old objects outside pages
+    size_t malloc_peak;
+    double compact_threshold;
+    bool compact_due;
+    size_t compactions;
+    object_list_t evacuated; // old copies of the objects being moved
+    root_set_t roots[GC_MAX_ROOT_SETS];
+    size_t roots_count;
+    // pauses, one per safe point that did collector work
+    size_t pauses;
+    uint64_t pause_total_ns;
+    uint64_t pause_max_ns;
+} g_gc = { .next_gc = GC_MIN_HEAP, .step_work = GC_STEP_WORK, .threads = GC_THREADS };
+
+static void list_push(object_list_t * list, object_t * o) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->data = realloc(list->data, list->capacity * sizeof(object_t*));
+        if (!list->data) exit(EXIT_FAILURE);
+    }
+    list->data[list->count++] = o;
+}
+
+void gc_add_roots(gc_roots_fn const fn, void * context) {
+    if (g_gc.roots_count == GC_MAX_ROOT_SETS) {
+        fprintf(stderr, "Too many GC root sets\n");
+        exit(EXIT_FAILURE);
+    }
+    g_gc.roots[g_gc.roots_count++] = (root_set_t){ fn, context };
+}
+
+void gc_remove_roots(gc_roots_fn const fn, void * context) {
+    for (size_t i = 0; i < g_gc.roots_count; i++) {
+        if (g_gc.roots[i].fn != fn || g_gc.roots[i].context != context) continue;
+        g_gc.roots[i] = g_gc.roots[--g_gc.roots_count];
+        return;
+    }
+}
+
+void gc_set_step_work(size_t const objects) {
+    g_gc.step_work = objects ? objects : SIZE_MAX;
+}
+
+void gc_set_threads(size_t const helpers) {
+    g_gc.threads = helpers < GC_MAX_THREADS ? helpers : GC_MAX_THREADS;
+}
+
+static size_t align_size(size_t const size) {
+    return (size + GC_ALIGNMENT - 1) & ~(size_t)(GC_ALIGNMENT - 1);
+}
+
+bool gc_is_young(object_t const * o) {
+    return (char const *)o >= g_gc.nursery && (char const *)o < g_gc.top;
+}
+
+void * gc_allocate(size_t const size) {
+    size_t const aligned = align_size(size);
+    if (aligned <= GC_NURSERY_MAX_OBJECT) {
+        if (!g_gc.nursery) {
+            g_gc.nursery = malloc(GC_NURSERY_SIZE);
+            if (!g_gc.nursery) exit(EXIT_FAILURE);
+            g_gc.top = g_gc.nursery;
+        }
+        if ((size_t)(g_gc.nursery + GC_NURSERY_SIZE - g_gc.top) >= aligned) {
+            void * p = g_gc.top;
+            g_gc.top += aligned;
+            return p;
+        }
+        // no collection outside safe points, the next one runs a minor one
+        g_gc.nursery_full = true;
+    }
+    void * p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "Out of memory allocating an object\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+void gc_discard(void * p, size_t const size) {
+    if (!gc_is_young(p)) {
+        free(p);
+        return;
+    }
+    // only the most recent block can be taken back, others die at the next minor collection
+    if ((char *)p + align_size(size) == g_gc.top) g_gc.top = p;
+}
+
+static bool is_marked(object_t * o) {
+    return atomic_load_explicit(&o->marked, memory_order_relaxed) == g_gc.epoch;
+}
+static void set_mark(object_t * o, bool const mark) {
+    atomic_store_explicit(&o->marked, mark, memory_order_relaxed);
+}
+
+static void lock_marker(marker_t * m) {
+    if (atomic_load_explicit(&g_pool.parallel, memory_order_relaxed)) mtx_lock(&m->lock);
+}
+static void unlock_marker(marker_t * m) {
+    if (atomic_load_explicit(&g_pool.parallel, memory_order_relaxed)) mtx_unlock(&m->lock);
+}
+
+static void push_gray(marker_t * m, object_t * o) {
+    list_push(&m->local, o);
+}
+
+// Moves the bottom half of from's objects, GC_STEAL_MAX at most, onto to
+static void move_half(object_list_t * from, object_list_t * to) {
+    size_t count = (from->count + 1) / 2;
+    if (count > GC_STEAL_MAX) count = GC_STEAL_MAX;
+    for (size_t i = 0; i < count; i++) list_push(to, from->data[i]);
+    memmove(from->data, from->data + count, (from->count - count) * sizeof(object_t*));
+    from->count -= count;
+}
+
+// Offers work to idle markers once the last offer was taken
+static void share_gray(marker_t * m) {
+    if (m->local.count < 2 || atomic_load_explicit(&m->visible, memory_order_relaxed)) return;
+    lock_marker(m);
+    move_half(&m->local, &m->shared);
+    atomic_store_explicit(&m->visible, m->shared.count, memory_order_relaxed);
+    unlock_marker(m);
+}
+
+// Half of victim's shared objects onto self's local stack, false if it had none
+static bool take_shared(marker_t * self, marker_t * victim) {
+    if (!atomic_load_explicit(&victim->visible, memory_order_relaxed)) return false;
+    lock_marker(victim);
+    move_half(&victim->shared, &self->local);
+    atomic_store_explicit(&victim->visible, victim->shared.count, memory_order_relaxed);
+    unlock_marker(victim);
+    return self->local.count > 0;
+}
+
+// The next object for self to visit: its own, else one stolen from another marker
+static object_t * pop_gray(marker_t * self) {
+    if (!self->local.count) {
+        size_t const start = (size_t)(self - g_markers);
+        for (size_t i = 0; i <= GC_MAX_THREADS; i++) {
+            if (take_shared(self, &g_markers[(start + i) % (GC_MAX_THREADS + 1)])) break;
+        }
+        if (!self->local.count) return NULL;
+    }
+    return self->local.data[--self->local.count];
+}
+
+// After a parallel step, so the next one can find the helpers' leftovers
+static void share_all_gray(void) {
+    for (size_t i = 0; i <= GC_MAX_THREADS; i++) {
+        marker_t * m = &g_markers[i];
+        while (m->local.count) list_push(&m->shared, m->local.data[--m->local.count]);
+        atomic_store_explicit(&m->visible, m->shared.count, memory_order_relaxed);
+    }
+}
+
+static size_t gray_count(void) {
+    size_t count = 0;
+    for (size_t i = 0; i <= GC_MAX_THREADS; i++) count += g_markers[i].local.count + g_markers[i].shared.count;
+    return count;
+}
+
+// Old white object to gray. Markers race for it, the exchange picks one.
+static void shade(object_t * o) {
+    if (is_marked(o)) return;
+    if (atomic_exchange_explicit(&o->marked, g_gc.epoch, memory_order_relaxed) == g_gc.epoch) return;
+    if (g_gc.phase == GC_MARK) push_gray(t_marker ? t_marker : &g_markers[0], o);
+}
+
+/*
+ * A new old object takes the current epoch: white once the next cycle
+ * flips it, black for the cycle running now. While marking it is gray
+ * instead, its fields may already hold white objects.
+ */
+static void track_old(object_t * o) {
+    size_t const size = object_size(o);
+    set_mark(o, g_gc.phase == GC_MARK ? !g_gc.epoch : g_gc.epoch);
+    o->remembered = false;
+    o->forwarded = false;
+    o->paged = false;
+    o->next = g_gc.objects;
+    g_gc.objects = o;
+    g_gc.objects_count++;
+    g_gc.bytes_allocated += size;
+    g_gc.malloc_bytes += size;
+    if (g_gc.malloc_bytes > g_gc.malloc_peak) g_gc.malloc_peak = g_gc.malloc_bytes;
+    if (g_gc.phase == GC_MARK) shade(o);
+}
+
+void gc_track(object_t * o) {
+    if (!gc_is_young(o)) {
+        track_old(o);
+        return;
+    }
+    o->remembered = false;
+    o->forwarded = false;
+    o->paged = false;
+    o->next = NULL;
+    g_gc.young_count++;
+    if (o->type == OBJ_STRING) list_push(&g_gc.young_strings, o);
+}
+
+void gc_write_barrier(object_t * owner, object_t * target) {
+    if (!owner || !target) return;
+    if (gc_is_young(target)) {
+        if (gc_is_young(owner) || owner->remembered) return;
+        owner->remembered = true;
+        list_push(&g_gc.remembered, owner);
+        return;
+    }
+    // Dijkstra: no black object may point at a white one while marking
+    if (g_gc.phase == GC_MARK) shade(target);
+}
+
+void gc_value_barrier(value_t const * p_value) {
+    if (g_gc.phase != GC_MARK || value_type(*p_value) != VAL_OBJ) return;
+    object_t * o = value_as_object(*p_value);
+    // young objects are found by the minor collection that ends marking
+    if (o && !gc_is_young(o)) shade(o);
+}
+
+void gc_found(object_t * o) {
+    if (g_gc.phase == GC_IDLE || gc_is_young(o)) return;
+    // while sweeping, a white object is one the sweep has yet to free
+    if (g_gc.phase == GC_SWEEP) set_mark(o, g_gc.epoch);
+    else shade(o);
+}
+
+// Copies a young object into the old generation, once, leaving a forwarding pointer
+static object_t * promote(object_t * o) {
+    if (o->forwarded) return o->next;
+    size_t const size = object_size(o);
+    object_t * copy = malloc(size);
+    if (!copy) {
+        fprintf(stderr, "Out of memory promoting an object\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, o, size);
+    track_old(copy);
+    o->forwarded = true;
+    o->next = copy;
+    list_push(&g_gc.promoted, copy);
+    return copy;
+}
+
+void gc_mark_object(object_t ** p_object) {
+    object_t * o = *p_object;
+    if (!o) return;
+    switch (g_gc.mode) {
+        case GC_MODE_PROMOTE:
+            // old objects are left to the old generation's own marking
+            if (gc_is_young(o)) *p_object = promote(o);
+            break;
+        case GC_MODE_RELOCATE:
+            if (o->forwarded) *p_object = o->next;
+            break;
+        case GC_MODE_MARK:
+        default:
+            if (!gc_is_young(o)) shade(o);
+            break;
+    }
+}
+
+void gc_mark_value(value_t * p_value) {
+    if (value_type(*p_value) != VAL_OBJ) return;
+    object_t * o = value_as_object(*p_value);
+    gc_mark_object(&o);
+    if (o != value_as_object(*p_value)) *p_value = value_object(o);
+}
+
+// Marks, promotes or relocates what o references, see gc_mode_t
+static void visit_children(object_t * o) {
+    switch (o->type) {
+        case OBJ_ROPE: {
+            obj_rope_t * r = (obj_rope_t*)o;
+            gc_mark_object(&r->left);
+            gc_mark_object(&r->right);
+            gc_mark_object((object_t**)&r->flat);
+            break;
+        }
+        case OBJ_STRING:
+        default:
+            break;
+    }
+}
+
+static void mark_roots(void) {
+    for (size_t i = 0; i < g_gc.roots_count; i++) g_gc.roots[i].fn(g_gc.roots[i].context);
+}
+
+void gc_collect_minor(void) {
+    g_gc.mode = GC_MODE_PROMOTE;
+    for (size_t i = 0; i < g_gc.remembered.count; i++) {
+        g_gc.remembered.data[i]->remembered = false;
+        visit_children(g_gc.remembered.data[i]);
+    }
+    g_gc.remembered.count = 0;
+    mark_roots();
+    while (g_gc.promoted.count) visit_children(g_gc.promoted.data[--g_gc.promoted.count]);
+    g_gc.mode = GC_MODE_MARK;
+    // the nursery is still intact, so the dead and moved strings can be looked up
+    for (size_t i = 0; i < g_gc.young_strings.count; i++) {
+        obj_string_t * s = (obj_string_t*)g_gc.young_strings.data[i];
+        obj_string_relocate(s, s->header.forwarded ? (obj_string_t*)s->header.next : NULL);
+    }
+    g_gc.young_strings.count = 0;
+    g_gc.top = g_gc.nursery;
+    g_gc.nursery_full = false;
+    g_gc.young_count = 0;
+    g_gc.minor_collections++;
+}
+
+// Begins a cycle: everything turns white, the roots gray
+static void start_cycle(void) {
+    // with the nursery empty every object is old
+    gc_collect_minor();
+    g_gc.epoch = !g_gc.epoch;
+    g_gc.phase = GC_MARK;
+    mark_roots();
+}
+
+// Charges visited objects to the step's budget, stopping every marker once it runs out
+static void charge(size_t const visited) {
+    if (visited && atomic_fetch_sub(&g_pool.budget, visited) <= visited)
+        atomic_store(&g_pool.stop, true);
+}
+
+// Out of work: true once every marker is, false after finding more
+static bool mark_idle(void) {
+    atomic_fetch_sub(&g_pool.active, 1);
+    for (;;) {
+        for (size_t i = 0; i <= GC_MAX_THREADS; i++) {
+            if (!atomic_load_explicit(&g_markers[i].visible, memory_order_relaxed)) continue;
+            atomic_fetch_add(&g_pool.active, 1);
+            return false;
+        }
+        // gray objects are only made by active markers, so none can appear now
+        if (!atomic_load(&g_pool.active) || atomic_load(&g_pool.stop)) return true;
+        thrd_yield();
+    }
+}
+
+// Visits gray objects, this marker's own first, until there are none or the budget is spent
+static void mark_loop(marker_t * self) {
+    size_t const batch = atomic_load(&g_pool.parallel) ? GC_MARK_BATCH : 1;
+    size_t visited = 0;
+    while (!atomic_load_explicit(&g_pool.stop, memory_order_relaxed)) {
+        object_t * o = pop_gray(self);
+        if (!o) {
+            if (mark_idle()) break;
+            continue;
+        }
+        visit_children(o);
+        if (batch > 1) share_gray(self);
+        if (++visited == batch) {
+            charge(visited);
+            visited = 0;
+        }
+    }
+    charge(visited);
+}
+
+/*
+ * Sorts the detached list on a helper thread while the mutator runs on.
+ * Dead strings are handed back instead of freed, only the mutator touches
+ * the intern table; a lookup may still resurrect one (gc_found), so the
+ * mutator checks its mark again before freeing it. Other dead objects are
+ * unreachable, not even in the remembered set, which the minor collection
+ * that ended marking emptied, and go back to malloc right away.
+ */
+static void sweep_background(void) {
+    object_t * o = g_pool.sweep_list;
+    object_t * survivors = NULL, * survivors_tail = NULL, * dead_strings = NULL;
+    size_t freed_objects = 0, freed_bytes = 0, freed_malloc_bytes = 0;
+    while (o) {
+        object_t * next = o->next;
+        if (atomic_load_explicit(&o->marked, memory_order_relaxed) == g_pool.sweep_epoch) {
+            if (!survivors_tail) survivors_tail = o;
+            o->next = survivors;
+            survivors = o;
+        } else if (o->type == OBJ_STRING) {
+            o->next = dead_strings;
+            dead_strings = o;
+        } else {
+            size_t const size = object_size(o);
+            freed_objects++;
+            freed_bytes += size;
+            if (!o->paged) freed_malloc_bytes += size;
+            free_object(o);
+        }
+        o = next;
+    }
+    g_pool.sweep_list = NULL;
+    g_pool.survivors = survivors;
+    g_pool.survivors_tail = survivors_tail;
+    g_pool.dead_strings = dead_strings;
+    g_pool.freed_objects = freed_objects;
+    g_pool.freed_bytes = freed_bytes;
+    g_pool.freed_malloc_bytes = freed_malloc_bytes;
+}
+
+static int helper_main(void * arg) {
+    size_t const index = (size_t)(uintptr_t)arg;
+    t_marker = &g_markers[index];
+    size_t seen = 0;
+    for (;;) {
+        mtx_lock(&g_pool.lock);
+        while (g_pool.generation == seen) cnd_wait(&g_pool.wake, &g_pool.lock);
+        seen = g_pool.generation;
+        job_t const job = g_pool.job;
+        bool const takes_part = index <= g_pool.participants;
+        mtx_unlock(&g_pool.lock);
+
+        if (takes_part && job == JOB_MARK) mark_loop(t_marker);
+        if (takes_part && job == JOB_SWEEP) sweep_background();
+
+        mtx_lock(&g_pool.lock);
+        if (--g_pool.running == 0) cnd_signal(&g_pool.done);
+        mtx_unlock(&g_pool.lock);
+    }
+    return 0;
+}
+
+static void init_pool(void) {
+    if (mtx_init(&g_pool.lock, mtx_plain) != thrd_success || cnd_init(&g_pool.wake) != thrd_success ||
+        cnd_init(&g_pool.done) != thrd_success) exit(EXIT_FAILURE);
+    for (size_t i = 0; i <= GC_MAX_THREADS; i++) {
+        if (mtx_init(&g_markers[i].lock, mtx_plain) != thrd_success) exit(EXIT_FAILURE);
+    }
+}
+
+// Hands a job to helpers 1..participants, starting threads as needed
+static void post_job(job_t const job, size_t const participants) {
+    call_once(&g_pool.once, init_pool);
+    mtx_lock(&g_pool.lock);
+    while (g_pool.started < participants) {
+        thrd_t thread;
+        if (thrd_create(&thread, helper_main, (void*)(uintptr_t)(g_pool.started + 1)) != thrd_success) {
+            fprintf(stderr, "Could not start a GC helper thread\n");
+            exit(EXIT_FAILURE);
+        }
+        thrd_detach(thread);
+        g_pool.started++;
+    }
+    g_pool.job = job;
+    g_pool.participants = participants;
+    g_pool.running = g_pool.started;
+    g_pool.generation++;
+    cnd_broadcast(&g_pool.wake);
+    mtx_unlock(&g_pool.lock);
+}
+
+static bool job_done(bool const wait) {
+    mtx_lock(&g_pool.lock);
+    while (wait && g_pool.running) cnd_wait(&g_pool.done, &g_pool.lock);
+    bool const done = g_pool.running == 0;
+    mtx_unlock(&g_pool.lock);
+    return done;
+}
+
+/*
+ * Marks up to budget objects, returns what is left of it. On a heap big
+ * enough to be worth it the helpers join in, each working from its
+ * own gray stacks and stealing from the others; whatever is still gray
+ * when the budget runs out stays on those stacks for the next step.
+ */
+static size_t drain(size_t const budget) {
+    bool const worth_it = budget >= GC_PARALLEL_MIN && g_gc.objects_count >= GC_PARALLEL_MIN && gray_count();
+    size_t const helpers = worth_it ? g_gc.threads : 0;
+    atomic_store(&g_pool.budget, budget);
+    atomic_store(&g_pool.stop, false);
+    atomic_store(&g_pool.active, helpers + 1);
+    if (helpers) {
+        atomic_store(&g_pool.parallel, true);
+        post_job(JOB_MARK, helpers);
+        g_gc.parallel_marks++;
+    }
+    mark_loop(&g_markers[0]);
+    if (helpers) {
+        job_done(true);
+        atomic_store(&g_pool.parallel, false);
+        share_all_gray();
+    }
+    return atomic_load(&g_pool.stop) ? 0 : atomic_load(&g_pool.budget);
+}
+
+// Up to budget gray objects, returns what is left of the budget
+static size_t mark_step(size_t budget) {
+    for (;;) {
+        budget = drain(budget);
+        if (gray_count()) return 0;
+        /*
+         * Out of gray objects. Young objects are not marked, so one may still
+         * hold the only reference to a white object: promote the survivors,
+         * which grays them, and keep going until that finds nothing new.
+         */
+        gc_collect_minor();
+        if (!gray_count()) break;
+        if (!budget) return 0;
+    }
+    g_gc.unswept = g_gc.objects;
+    g_gc.objects = NULL;
+    g_gc.phase = GC_SWEEP;
+    if (g_gc.threads) {
+        g_pool.sweep_list = g_gc.unswept;
+        g_pool.sweep_epoch = g_gc.epoch;
+        g_gc.unswept = NULL;
+        g_gc.sweeping = true;
+        g_gc.background_sweeps++;
+        post_job(JOB_SWEEP, 1);
+    }
+    return budget;
+}
+
+// Takes over what the background sweep left: its survivors, and dead strings to free here
+static void finish_background_sweep(void) {
+    if (g_pool.survivors) {
+        g_pool.survivors_tail->next = g_gc.objects;
+        g_gc.objects = g_pool.survivors;
+    }
+    g_gc.unswept = g_pool.dead_strings;
+    g_gc.objects_count -= g_pool.freed_objects;
+    g_gc.bytes_allocated -= g_pool.freed_bytes;
+    g_gc.malloc_bytes -= g_pool.freed_malloc_bytes;
+    g_pool.survivors = g_pool.survivors_tail = g_pool.dead_strings = NULL;
+    g_gc.sweeping = false;
+}
+
+static gc_page_t * page_of(object_t const * o) {
+    return (gc_page_t*)((uintptr_t)o & ~(uintptr_t)(GC_PAGE_SIZE - 1));
+}
+
+void gc_free(object_t * o) {
+    if (!o->paged) {
+        free(o);
+        return;
+    }
+    // the page goes once all of it is free, see release_empty_pages
+    page_of(o)->live -= align_size(object_size(o));
+}
+
+static void release_empty_pages(void) {
+    gc_page_t ** p_page = &g_gc.pages;
+    while (*p_page) {
+        gc_page_t * page = *p_page;
+        if (page->live) {
+            p_page = &page->next;
+            continue;
+        }
+        *p_page = page->next;
+        free(page);
+        g_gc.pages_count--;
+    }
+}
+
+static size_t heap_footprint(void) {
+    return g_gc.pages_count * GC_PAGE_SIZE + g_gc.malloc_peak;
+}
+
+// Share of the heap held that is not live objects, from 0 (dense) towards 1
+static double fragmentation(void) {
+    size_t const footprint = heap_footprint();
+    if (!footprint || g_gc.bytes_allocated >= footprint) return 0;
+    return 1.0 - (double)g_gc.bytes_allocated / (double)footprint;
+}
+
+// Bump allocates in the newest page, opening another when it is full
+static object_t * page_allocate(size_t const size) {
+    size_t const aligned = align_size(size);
+    gc_page_t * page = g_gc.pages;
+    if (!page || page->used + aligned > GC_PAGE_SIZE) {
+        page = aligned_alloc(GC_PAGE_SIZE, GC_PAGE_SIZE);
+        if (!page) {
+            fprintf(stderr, "Out of memory allocating a heap page\n");
+            exit(EXIT_FAILURE);
+        }
+        page->next = g_gc.pages;
+        page->used = GC_PAGE_HEADER;
+        page->live = 0;
+        g_gc.pages = page;
+        g_gc.pages_count++;
+    }
+    object_t * o = (object_t*)((char*)page + page->used);
+    page->used += aligned;
+    page->live += aligned;
+    return o;
+}
+
+/*
+ * Moves every old object that fits a page into fresh, densely filled
+ * pages, in list order, and frees the blocks they came from. Like a
+ * promotion it leaves a forwarding pointer in the old copy, then the
+ * roots, the fields of every object and the intern table are pointed at
+ * the new copies. The nursery is emptied first, as young objects are not
+ * scanned. Stop the world, a pause proportional to the old generation.
+ */
+static void compact(void) {
+    gc_collect_minor();
+    gc_page_t * from_pages = g_gc.pages;
+    g_gc.pages = NULL;
+    g_gc.pages_count = 0;
+    g_gc.malloc_bytes = 0;
+    object_t * o = g_gc.objects;
+    g_gc.objects = NULL;
+    while (o) {
+        object_t * next = o->next;
+        size_t const size = object_size(o);
+        object_t * copy = o;
+        if (size <= GC_PAGE_MAX_OBJECT) {
+            copy = page_allocate(size);
+            memcpy(copy, o, size);
+            copy->paged = true;
+            o->forwarded = true;
+            o->next = copy;
+            list_push(&g_gc.evacuated, o);
+        } else {
+            g_gc.malloc_bytes += size;
+        }
+        copy->next = g_gc.objects;
+        g_gc.objects = copy;
+        o = next;
+    }
+
+    g_gc.mode = GC_MODE_RELOCATE;
+    mark_roots();
+    for (object_t * p = g_gc.objects; p; p = p->next) visit_children(p);
+    for (size_t i = 0; i < g_gc.remembered.count; i++) gc_mark_object(&g_gc.remembered.data[i]);
+    g_gc.mode = GC_MODE_MARK;
+    // the old copies are intact until here, so the table can still find them
+    for (size_t i = 0; i < g_gc.evacuated.count; i++) {
+        object_t * from = g_gc.evacuated.data[i];
+        if (from->type == OBJ_STRING) obj_string_relocate((obj_string_t*)from, (obj_string_t*)from->next);
+        if (!from->paged) free(from);
+    }
+    g_gc.evacuated.count = 0;
+    while (from_pages) {
+        gc_page_t * next = from_pages->next;
+        free(from_pages);
+        from_pages = next;
+    }
+    g_gc.malloc_peak = g_gc.malloc_bytes;
+    g_gc.compact_due = false;
+    g_gc.compactions++;
+}
+
+static void remove_remembered(object_t const * o) {
+    for (size_t i = 0; i < g_gc.remembered.count; i++) {
+        if (g_gc.remembered.data[i] != o) continue;
+        g_gc.remembered.data[i] = g_gc.remembered.data[--g_gc.remembered.count];
+        return;
+    }
+}
+
+static size_t sweep_step(size_t budget) {
+    if (g_gc.sweeping) {
+        // an unbounded step waits for the helper, a bounded one comes back later
+        if (!job_done(budget == SIZE_MAX)) return 0;
+        finish_background_sweep();
+    }
+    while (g_gc.unswept && budget) {
+        object_t * o = g_gc.unswept;
+        g_gc.unswept = o->next;
+        budget--;
+        if (is_marked(o)) {
+            o->next = g_gc.objects;
+            g_gc.objects = o;
+            continue;
+        }
+        if (o->remembered) remove_remembered(o);
+        size_t const size = object_size(o);
+        g_gc.objects_count--;
+        g_gc.bytes_allocated -= size;
+        if (!o->paged) g_gc.malloc_bytes -= size;
+        free_object(o);
+    }
+    if (g_gc.unswept) return 0;
+    g_gc.phase = GC_IDLE;
+    g_gc.collections++;
+    g_gc.next_gc = g_gc.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    if (g_gc.next_gc < GC_MIN_HEAP) g_gc.next_gc = GC_MIN_HEAP;
+    release_empty_pages();
+    // a safe point compacts, not gc_collect, whose callers may hold object pointers
+    size_t const footprint = heap_footprint();
+    g_gc.compact_due = g_gc.compact_threshold > 0 && fragmentation() > g_gc.compact_threshold &&
+        footprint - g_gc.bytes_allocated > GC_COMPACT_MIN_WASTE;
+    return budget;
+}
+
+// One slice of the running cycle
+static void step(size_t budget) {
+    if (g_gc.phase == GC_MARK) budget = mark_step(budget);
+    if (g_gc.phase == GC_SWEEP && budget) sweep_step(budget);
+}
+
+void gc_start(void) {
+    if (g_gc.phase == GC_IDLE) start_cycle();
+}
+
+void gc_collect(void) {
+    while (g_gc.phase != GC_IDLE) step(SIZE_MAX);
+    start_cycle();
+    while (g_gc.phase != GC_IDLE) step(SIZE_MAX);
+}
+
+void gc_compact(void) {
+    gc_collect();
+    compact();
+}
+
+void gc_set_compaction(double const threshold) {
+    g_gc.compact_threshold = threshold;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void gc_safepoint(void) {
+    bool const minor_due = g_gc.nursery_full ||
+        (size_t)(g_gc.top - g_gc.nursery) > GC_NURSERY_SIZE / 2;
+    if (g_gc.phase == GC_IDLE && !minor_due && !g_gc.compact_due &&
+        g_gc.bytes_allocated <= g_gc.next_gc) return;
+
+    uint64_t const start = now_ns();
+    if (g_gc.phase != GC_IDLE) {
+        if (minor_due) gc_collect_minor();
+        step(g_gc.step_work);
+    } else if (g_gc.compact_due) {
+        compact();
+    } else if (g_gc.bytes_allocated > g_gc.next_gc) {
+        start_cycle();
+        if (g_gc.step_work == SIZE_MAX) step(SIZE_MAX);
+    } else {
+        gc_collect_minor();
+    }
+    uint64_t const pause = now_ns() - start;
+    g_gc.pauses++;
+    g_gc.pause_total_ns += pause;
+    if (pause > g_gc.pause_max_ns) g_gc.pause_max_ns = pause;
+}
+
+gc_stats_t gc_stats(void) {
+    return (gc_stats_t){
+        .bytes_allocated = g_gc.bytes_allocated,
+        .next_gc = g_gc.next_gc,
+        .objects = g_gc.objects_count + g_gc.young_count,
+        .young_objects = g_gc.young_count,
+        .nursery_used = (size_t)(g_gc.top - g_gc.nursery),
+        .collections = g_gc.collections,
+        .minor_collections = g_gc.minor_collections,
+        .collecting = g_gc.phase != GC_IDLE,
+        .marking = g_gc.phase == GC_MARK,
+        .pauses = g_gc.pauses,
+        .pause_total_ns = g_gc.pause_total_ns,
+        .pause_max_ns = g_gc.pause_max_ns,
+        .threads = g_gc.threads,
+        .sweeping = g_gc.sweeping,
+        .parallel_marks = g_gc.parallel_marks,
+        .background_sweeps = g_gc.background_sweeps,
+        .heap_footprint = heap_footprint(),
+        .fragmentation = fragmentation(),
+        .pages = g_gc.pages_count,
+        .compactions = g_gc.compactions,
+    };
+}
+
+#endif // LOX_GC
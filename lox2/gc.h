@@ -0,0 +1,174 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#ifndef LOX_GC_H
+#define LOX_GC_H
+#include <stddef.h>
+#include <stdint.h>
+#include "object.h"
+#include "value.h"
+
+/*
+ * Precise generational collector, built with the LOX_GC CMake option in
+ * place of reference counting (obj_inc_ref/obj_dec_ref become no-ops).
+ *
+ * Young objects are bump allocated in a fixed nursery. A minor collection
+ * copies the survivors out of it, promoting them straight into the old
+ * generation, and resets the bump pointer, so its cost follows what is
+ * live, not what was allocated. Old objects that were given a pointer to
+ * a young one (gc_write_barrier) are in the remembered set and scanned as
+ * extra roots. Objects too large for the nursery, or allocated while it
+ * is full, start out old.
+ *
+ * The old generation is one intrusive list (object_t.next), collected by
+ * incremental tri-color mark-sweep. A cycle starts with a minor collection
+ * and a scan of the roots, then every safe point does one step of at most
+ * gc_set_step_work objects, marking through a gray stack and then sweeping,
+ * so a pause is bounded by the step size and the root set, not the heap.
+ * The mutator runs between steps, and a Dijkstra barrier keeps a black
+ * object or an already scanned root from pointing at a white object:
+ * gc_value_barrier on every value store into an environment, global or
+ * stack slot, gc_write_barrier on object fields. Marking ends with a minor
+ * collection, as young objects are not marked but may hold the only
+ * reference to an old one. The intern table is weak throughout: a dead
+ * string leaves it when swept, a promoted one is re-pointed at its copy,
+ * and one found by a lookup mid cycle is kept (gc_found).
+ *
+ * Up to gc_set_threads helper threads share the work. A marking step with
+ * enough gray objects wakes them and every thread drains its own gray
+ * stack, stealing half of another's when it runs dry; the mark flag is
+ * set with an atomic exchange, so each object is visited once. The
+ * mutator waits for the step to end, as it does single threaded. Once
+ * marking is done, one helper sweeps the detached list in the background
+ * while the mutator runs and allocates on: it frees dead objects straight
+ * back to malloc and hands dead strings back, to be dropped from the
+ * intern table and freed at safe points. With no helpers everything runs
+ * on the mutator thread.
+ *
+ * Freed blocks go back to malloc, which keeps them for reuse, so a heap
+ * that once held far more than it does now stays that big and scattered.
+ * gc_stats estimates that as a fragmentation: the share of the heap held
+ * (pages plus the most the old generation had in malloc blocks since it
+ * was last compacted) that is not live. A compaction, gc_compact or at a
+ * safe point after a cycle that left more than gc_set_compaction's
+ * threshold, copies every old object up to GC_PAGE_MAX_OBJECT into fresh
+ * pages, packed, and updates the roots, object fields and intern table
+ * through forwarding pointers. Dead objects in pages leave holes until
+ * the whole page is free or the next compaction.
+ *
+ * Collections only start at safe points, gc_safepoint(), which the
+ * interpreter reaches between statements. There every live value sits in
+ * a root (globals, the local stack, environments), so the C code in
+ * between never has to root its temporaries. Roots are marked by address
+ * because a minor collection moves what they point to.
+ *
+ * A safe point runs a minor collection once the nursery is half used or
+ * has overflowed, and starts a cycle once the old generation has grown to
+ * GC_HEAP_GROW_FACTOR times what survived the last one. Each safe point
+ * that does collector work is timed, see gc_stats.
+ */
+
+#define GC_HEAP_GROW_FACTOR 2
+#ifndef GC_MIN_HEAP
+#define GC_MIN_HEAP (1024 * 1024)  // -DGC_MIN_HEAP=1 collects at every safe point
+#endif
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE (256 * 1024)
+#endif
+#define GC_NURSERY_MAX_OBJECT 1024  // larger objects are allocated old
+#ifndef GC_STEP_WORK
+#define GC_STEP_WORK 1024  // objects marked or swept per incremental step
+#endif
+#define GC_PAGE_SIZE (256 * 1024)
+#define GC_PAGE_MAX_OBJECT (GC_PAGE_SIZE / 8)  // larger objects are never moved
+#define GC_COMPACT_MIN_WASTE (4 * GC_PAGE_SIZE)  // less is not worth a compaction
+#ifndef GC_THREADS
+#define GC_THREADS 3  // helper threads, besides the mutator
+#endif
+#define GC_MAX_THREADS 16
+#define GC_MAX_ROOT_SETS 8
+
+// Marks a set of roots with gc_mark_value/gc_mark_object
+typedef void (*gc_roots_fn)(void * context);
+
+typedef struct {
+    size_t bytes_allocated;  // old generation, live plus not yet collected
+    size_t next_gc;          // a safe point runs a full collection above this
+    size_t objects;          // both generations
+    size_t young_objects;
+    size_t nursery_used;
+    size_t collections;      // completed cycles
+    size_t minor_collections;
+    bool collecting;         // a cycle is in progress
+    bool marking;            // and still marking
+    size_t pauses;           // safe points that did collector work
+    uint64_t pause_total_ns;
+    uint64_t pause_max_ns;
+    size_t threads;          // helpers, see gc_set_threads
+    bool sweeping;           // a helper is sweeping in the background
+    size_t parallel_marks;   // marking steps that used the helpers
+    size_t background_sweeps;
+    size_t heap_footprint;   // bytes held for old objects, see above
+    double fragmentation;    // 1 - bytes_allocated / heap_footprint
+    size_t pages;            // of compacted objects
+    size_t compactions;
+} gc_stats_t;
+
+#ifdef LOX_GC
+void gc_add_roots(gc_roots_fn fn, void * context);
+void gc_remove_roots(gc_roots_fn fn, void * context);
+// Both may update the reference to where the object now lives
+void gc_mark_object(object_t ** p_object);
+void gc_mark_value(value_t * p_value);
+// Memory for a new object, from the nursery when it fits
+void * gc_allocate(size_t size);
+// Gives back a gc_allocate block that never became an object
+void gc_discard(void * p, size_t size);
+// Puts a new object under the collector
+void gc_track(object_t * o);
+// To be called after storing target into a field of owner
+void gc_write_barrier(object_t * owner, object_t * target);
+// To be called after storing a value into a root (variable, stack slot)
+void gc_value_barrier(value_t const * p_value);
+// Called when the intern table hands out an existing object
+void gc_found(object_t * o);
+bool gc_is_young(object_t const * o);
+// Frees a dead old object, for free_object
+void gc_free(object_t * o);
+// Objects per incremental step, 0 finishes a cycle in one pause
+void gc_set_step_work(size_t objects);
+// Helper threads for marking and sweeping, 0 collects on the mutator alone
+void gc_set_threads(size_t helpers);
+void gc_collect_minor(void);
+// Begins an incremental cycle, which safe points then advance
+void gc_start(void);
+// A whole cycle now, finishing any in progress first
+void gc_collect(void);
+// A whole cycle, then a compaction. Moves objects: reload pointers from roots.
+void gc_compact(void);
+// Safe points compact once a cycle leaves the heap more fragmented than
+// this, 0 (the default) never does
+void gc_set_compaction(double threshold);
+void gc_safepoint(void);
+gc_stats_t gc_stats(void);
+#else
+static inline void gc_add_roots(gc_roots_fn fn, void * context) {
+    (void)fn; (void)context;
+}
+static inline void gc_remove_roots(gc_roots_fn fn, void * context) {
+    (void)fn; (void)context;
+}
+static inline void gc_mark_value(value_t * p_value) {
+    (void)p_value;
+}
+static inline void gc_value_barrier(value_t const * p_value) {
+    (void)p_value;
+}
+// counted builds settle deferred drops here instead, see obj_rc_flush
+static inline void gc_safepoint(void) {
+    obj_rc_flush();
+}
+#endif
+
+#endif //LOX_GC_H
@@ -9,12 +9,41 @@
 #include "environment.h"
 #include "value.h"
 #include "object.h"
+#include "gc.h"
 #include "stmt.h"
 #include "expr.h"
+#include "utils/hash.h"
 
 static void execute(interpreter_t * p_i, stmt_t const * p_s);
 static value_t evaluate(interpreter_t * i, expr_t const * e);
-static value_t * lookup(interpreter_t const * p_i, token_t const * p_t, expr_t const * p_e);
+static value_t * lookup(interpreter_t * p_i, token_t const * p_t, expr_t const * p_e);
+static value_t * stack_slot(interpreter_t * p_i, int slot);
+static value_t * global_slot(interpreter_t const * p_i, int slot, token_t const * p_name);
+static void open_slots(interpreter_t * p_i, stmt_block_t const * p_block);
+static void close_slots(interpreter_t * p_i, stmt_block_t const * p_block);
+
+static bool is_string(value_t const v) {
+    return value_type(v) == VAL_OBJ && obj_is_string(value_as_object(v));
+}
+
+/*
+ * evaluate hands out a value the caller owns and drops, unless the resolver's
+ * ownership pass marked the expression borrowed: then it is the variable's
+ * own value, neither counted when read nor dropped after use.
+ */
+static bool is_borrowed(expr_t const * p_e) {
+    return (p_e->type == EXPR_VARIABLE && p_e->as.variable_expr.borrowed) ||
+        (p_e->type == EXPR_ASSIGN && p_e->as.assign_expr.borrowed);
+}
+static void drop(expr_t const * p_e, value_t * p_val) {
+    if (!is_borrowed(p_e)) value_free(p_val);
+}
+// Moves an owned value into a variable, releasing the one it had
+static void store(value_t * p_slot, value_t const * p_val) {
+    value_free(p_slot);
+    *p_slot = *p_val;
+    gc_value_barrier(p_val);
+}
 
 // int embedded in void * for map usage
 // static void * copy_int(void const * value) {
@@ -44,28 +73,89 @@ static value_t * lookup(interpreter_t const * p_i, token_t const * p_t, expr_t c
 //     return copy;
 // }
 
+// Everything a statement boundary can reach, see gc.h
+static void mark_roots(void * context) {
+    interpreter_t const * p_i = context;
+    for (size_t i = 0; i < p_i->globals_count; i++) gc_mark_value(&p_i->globals[i]);
+    for (size_t i = 0; i < p_i->stack_top; i++) gc_mark_value(&p_i->stack[i]);
+    for (environment_t const * p_env = p_i->environment; p_env; p_env = p_env->enclosing) {
+        value_t * p_value;
+        for (size_t i = 0; (p_value = map_next(p_env->values, &i));) gc_mark_value(p_value);
+    }
+}
+
 void interpret(interpreter_t * p_interpreter, list_t * p_statements) {
     if (!p_interpreter || !p_statements) return;
-    if (!p_interpreter->globals) {
-        p_interpreter->globals = environment_create(NULL);
-    }
+    gc_add_roots(mark_roots, p_interpreter);
     for (size_t i = 0; i < p_statements->count; i++) {
         execute(p_interpreter, p_statements->data[i]);
         // TODO error handling
+        gc_safepoint();
     }
+    gc_remove_roots(mark_roots, p_interpreter);
+}
+
+static void * str_copy(void const * ptr) {
+    size_t const len = strlen(ptr);
+    char * copy = malloc(len + 1);
+    if (!copy) exit(EXIT_FAILURE);
+    memcpy(copy, ptr, len + 1);
+    return copy;
+}
+/*
+ * Returns the index of a global, giving new names the next free one. Called
+ * by the resolver with the hash its token got at scan time, so the globals
+ * array already fits every index at runtime.
+ */
+int interpreter_global_slot(interpreter_t * p_interpreter, char const * p_name, size_t const hash) {
+    int const * p_found = global_names_find_hashed(&p_interpreter->global_names, p_name, hash);
+    if (p_found) return *p_found;
+
+    int const slot = (int)p_interpreter->globals_count++;
+    if (p_interpreter->globals_count > p_interpreter->globals_capacity) {
+        size_t const capacity = p_interpreter->globals_capacity ? p_interpreter->globals_capacity * 2 : 16;
+        value_t * p_values = realloc(p_interpreter->globals, capacity * sizeof(value_t));
+        bool * p_defined = realloc(p_interpreter->globals_defined, capacity * sizeof(bool));
+        if (!p_values || !p_defined) exit(EXIT_FAILURE);
+        memset(p_values + p_interpreter->globals_capacity, 0,
+            (capacity - p_interpreter->globals_capacity) * sizeof(value_t));
+        memset(p_defined + p_interpreter->globals_capacity, 0,
+            (capacity - p_interpreter->globals_capacity) * sizeof(bool));
+        p_interpreter->globals = p_values;
+        p_interpreter->globals_defined = p_defined;
+        p_interpreter->globals_capacity = capacity;
+    }
+    // the table owns its names, the resolver's only live as long as the AST
+    *global_names_emplace_hashed(&p_interpreter->global_names, str_copy(p_name), hash, NULL) = slot;
+    return slot;
 }
 
 static void execute(interpreter_t * p_i, stmt_t const * p_s) {
     switch (p_s->type) {
         case STMT_BLOCK: {
             stmt_block_t const stmt = p_s->as.block_stmt;
+            open_slots(p_i, &stmt);
+            if (!stmt.needs_environment) {
+                // resolver found no captured declarations, run in the enclosing environment
+                for (size_t i = 0; i < stmt.count; i++) {
+                    execute(p_i, stmt.statements[i]);
+                    // TODO handle runtime error
+                    gc_safepoint();
+                }
+                close_slots(p_i, &stmt);
+                break;
+            }
             environment_t * p_prev = p_i->environment;
             environment_t * p_env = environment_create(p_prev);
             p_i->environment = p_env;
             for (size_t i = 0; i < stmt.count; i++) {
                 execute(p_i, stmt.statements[i]);
                 // TODO handle runtime error
+                gc_safepoint();
             }
+            p_i->environment = p_prev;
+            environment_destroy(p_env);
+            close_slots(p_i, &stmt);
             break;
         }
         case STMT_FUNCTION:
@@ -73,26 +163,30 @@ static void execute(interpreter_t * p_i, stmt_t const * p_s) {
             break;
         case STMT_EXPRESSION: {
             stmt_expression_t const stmt = p_s->as.expression_stmt;
-            evaluate(p_i, stmt.expression);
+            value_t val = evaluate(p_i, stmt.expression);
+            drop(stmt.expression, &val);
             break;
         }
         case STMT_IF:
         case STMT_PRINT: {
             stmt_print_t const stmt = p_s->as.print_stmt;
-            value_t const val = evaluate(p_i, stmt.expression);
-            switch (val.type) {
+            value_t val = evaluate(p_i, stmt.expression);
+            switch (value_type(val)) {
                 case VAL_NUMBER:
-                    printf("%f\n", val.as.number);
+                    printf("%f\n", value_as_number(val));
                     break;
                 case VAL_BOOL:
-                    printf("%s\n", val.as.boolean ? "true" : "false");
+                    printf("%s\n", value_as_bool(val) ? "true" : "false");
                     break;
                 case VAL_NIL:
                     printf("nil\n");
                     break;
                 case VAL_OBJ:
+                    if (is_string(val))
+                        printf("%s\n", obj_as_string(value_as_object(val))->chars);
                     break;
             }
+            drop(stmt.expression, &val);
             break;
         }
         case STMT_RETURN: break;
@@ -101,11 +195,17 @@ static void execute(interpreter_t * p_i, stmt_t const * p_s) {
             value_t val = value_nil();
             if (stmt.initializer) val = evaluate(p_i, stmt.initializer);
             // TODO handle runtime error
-            if (p_i->environment) {
-                environment_define(p_i->environment, stmt.name->lexeme, &val);
+            // a slot may still hold a value from an earlier scope or definition
+            if (stmt.slot >= 0) {
+                store(stack_slot(p_i, stmt.slot), &val);
+                break;
             }
-            // globals
-            environment_define(p_i->globals, stmt.name->lexeme, &val);
+            if (stmt.global >= 0) {
+                store(&p_i->globals[stmt.global], &val);
+                p_i->globals_defined[stmt.global] = true;
+                break;
+            }
+            environment_define(p_i->environment, stmt.name->lexeme, stmt.name->hash, &val);
             break;
         }
         case STMT_WHILE:
@@ -122,20 +222,51 @@ static value_t evaluate(interpreter_t * p_i, expr_t const * p_e) {
             if (expr.value) val = evaluate(p_i, expr.value);
             // TODO handle runtime error
             if (expr.target->type == EXPR_VARIABLE &&
+                expr.target->as.variable_expr.slot >= 0) {
+                store(stack_slot(p_i, expr.target->as.variable_expr.slot), &val);
+            } else if (expr.target->type == EXPR_VARIABLE &&
                 expr.target->as.variable_expr.depth >= 0) {
                 environment_assign_at(p_i->environment,
                          expr.target->as.variable_expr.depth,
-                         expr.target->as.variable_expr.name->lexeme, &val);
+                         expr.target->as.variable_expr.name->lexeme,
+                         expr.target->as.variable_expr.name->hash, &val);
             } else {
-                environment_assign(p_i->globals,
-                    expr.target->as.variable_expr.name->lexeme, &val);
+                store(global_slot(p_i, expr.target->as.variable_expr.global,
+                    expr.target->as.variable_expr.name), &val);
             }
+            // the variable now holds val, a caller that keeps it needs its own reference
+            if (!expr.borrowed) val = value_dup(&val);
             break;
         }
-        case EXPR_BINARY:
-            fprintf(stderr, "Not implemented (%d)\n", p_e->type);
-            exit(EXIT_FAILURE);
+        case EXPR_BINARY: {
+            expr_binary_t const expr = p_e->as.binary_expr;
+            if (expr.operator->type != PLUS) {
+                fprintf(stderr, "Not implemented (%d)\n", expr.operator->type);
+                exit(EXIT_FAILURE);
+            }
+            value_t left = evaluate(p_i, expr.left);
+            value_t right = evaluate(p_i, expr.right);
+            if (value_type(left) == VAL_NUMBER && value_type(right) == VAL_NUMBER) {
+                val = value_number(value_as_number(left) + value_as_number(right));
+            } else if (is_string(left) && is_string(right)) {
+                // an owned left operand nobody else holds is appended to in place
+                object_t * p_reused = is_borrowed(expr.left) ? NULL
+                    : obj_concat_unique(value_as_object(left), value_as_object(right));
+                if (p_reused) {
+                    left = value_nil();
+                    val = value_object(p_reused);
+                } else {
+                    val = value_object(obj_concat(value_as_object(left), value_as_object(right)));
+                }
+            } else {
+                fprintf(stderr, "Operands must be two numbers or two strings at line %zu.\n",
+                    expr.operator->line);
+                exit(EXIT_FAILURE);
+            }
+            drop(expr.left, &left);
+            drop(expr.right, &right);
             break;
+        }
         case EXPR_CALL:
             fprintf(stderr, "Not implemented (%d)\n", p_e->type);
             exit(EXIT_FAILURE);
@@ -152,12 +283,12 @@ static value_t evaluate(interpreter_t * p_i, expr_t const * p_e) {
             expr_literal_t const expr = p_e->as.literal_expr;
             switch (expr.kind->type) {
                 case NUMBER:
-                    val.type = VAL_NUMBER;
-                    val.as.number = strtod(expr.kind->lexeme, NULL);
+                    val = value_number(strtod(expr.kind->lexeme, NULL));
                     break;
                 case STRING:
+                    // the lexeme still has its quotes
                     char const * str = expr.kind->lexeme;
-                    obj_string_t * s = obj_string_new(str);
+                    obj_string_t * s = obj_string_copy(str + 1, strlen(str) - 2);
                     val = value_object((object_t*)s);
                     break;
                 case NIL:
@@ -191,7 +322,14 @@ static value_t evaluate(interpreter_t * p_i, expr_t const * p_e) {
             break;
         case EXPR_VARIABLE:
             expr_variable_t const expr = p_e->as.variable_expr;
-            val = *lookup(p_i, expr.name, p_e);
+            value_t * p_slot = lookup(p_i, expr.name, p_e);
+            if (expr.moved) {
+                // last use before the variable is overwritten, its reference moves out
+                val = *p_slot;
+                *p_slot = value_nil();
+            } else {
+                val = expr.borrowed ? *p_slot : value_dup(p_slot);
+            }
             break;
         default:
             fprintf(stderr, "Not implemented (%d)\n", p_e->type);
@@ -199,13 +337,81 @@ static value_t evaluate(interpreter_t * p_i, expr_t const * p_e) {
     }
     return val;
 }
-static value_t * lookup(interpreter_t const * p_i, token_t const * p_t, expr_t const * p_e) {
+static value_t * lookup(interpreter_t * p_i, token_t const * p_t, expr_t const * p_e) {
     int distance = -1;
     if (p_e->type == EXPR_VARIABLE) {
+        if (p_e->as.variable_expr.slot >= 0)
+            return stack_slot(p_i, p_e->as.variable_expr.slot);
         distance = p_e->as.variable_expr.depth;
     }
     if (distance >= 0) {
-        return environment_get_at(p_i->environment, distance, p_t->lexeme);
+        return environment_get_at(p_i->environment, distance, p_t->lexeme, p_t->hash);
+    }
+    return global_slot(p_i, p_e->as.variable_expr.global, p_t);
+}
+static value_t * global_slot(interpreter_t const * p_i, int const slot, token_t const * p_name) {
+    if (slot < 0 || !p_i->globals_defined[slot]) {
+        fprintf(stderr, "Undefined variable '%s' at line %zu.\n", p_name->lexeme, p_name->line);
+        exit(EXIT_FAILURE);
     }
-    return environment_get(p_i->globals, p_t->lexeme);
-}
\ No newline at end of file
+    return &p_i->globals[slot];
+}
+/*
+ * Returns the stack cell of a slot in the current frame, growing the stack
+ * as needed. The pointer is only valid until the next call.
+ */
+static value_t * stack_slot(interpreter_t * p_i, int const slot) {
+    size_t const index = p_i->frame_base + (size_t)slot;
+    if (index >= p_i->stack_capacity) {
+        size_t capacity = p_i->stack_capacity ? p_i->stack_capacity : 16;
+        while (capacity <= index) capacity *= 2;
+        value_t * p_stack = realloc(p_i->stack, capacity * sizeof(value_t));
+        if (!p_stack) exit(EXIT_FAILURE);
+        memset(p_stack + p_i->stack_capacity, 0,
+            (capacity - p_i->stack_capacity) * sizeof(value_t));
+        p_i->stack = p_stack;
+        p_i->stack_capacity = capacity;
+    }
+    return &p_i->stack[index];
+}
+// Makes room for a block's slots, which sit on top of the enclosing block's
+static void open_slots(interpreter_t * p_i, stmt_block_t const * p_block) {
+    if (p_block->slot_count == 0) return;
+    stack_slot(p_i, p_block->first_slot + p_block->slot_count - 1);
+    p_i->stack_top = p_i->frame_base + (size_t)(p_block->first_slot + p_block->slot_count);
+}
+// Drops what a block's locals still hold so nothing outlives its scope
+static void close_slots(interpreter_t * p_i, stmt_block_t const * p_block) {
+    if (p_block->slot_count == 0) return;
+    for (int slot = p_block->first_slot; slot < p_block->first_slot + p_block->slot_count; slot++) {
+        value_t * p_slot = &p_i->stack[p_i->frame_base + (size_t)slot];
+        value_free(p_slot);
+        *p_slot = value_nil();
+    }
+    p_i->stack_top = p_i->frame_base + (size_t)p_block->first_slot;
+}
+/*
+ * Frees what the interpreter holds and drops every value it still has, so
+ * objects larger than a slab block go back to malloc before the caller
+ * releases the slab (under LOX_GC they stay with the collector).
+ */
+void free_interpreter(interpreter_t * p_interpreter) {
+    if (!p_interpreter) return;
+    global_names_entry_t * p_entry;
+    for (size_t i = 0; (p_entry = global_names_next(&p_interpreter->global_names, &i));)
+        free((char*)p_entry->key);
+    global_names_destroy(&p_interpreter->global_names);
+    for (size_t i = 0; i < p_interpreter->globals_count; i++) value_free(&p_interpreter->globals[i]);
+    for (size_t i = 0; i < p_interpreter->stack_capacity; i++) value_free(&p_interpreter->stack[i]);
+    free(p_interpreter->globals);
+    free(p_interpreter->globals_defined);
+    free(p_interpreter->stack);
+    while (p_interpreter->environment) {
+        environment_t * p_enclosing = p_interpreter->environment->enclosing;
+        environment_destroy(p_interpreter->environment);
+        p_interpreter->environment = p_enclosing;
+    }
+    // drops that went through the deferred log
+    obj_rc_flush();
+    *p_interpreter = (interpreter_t){0};
+}
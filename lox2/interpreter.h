@@ -8,14 +8,34 @@
 #include "list.h"
 #include "expr.h"
 #include "../tests/map/map2.h"
+#include "utils/hash.h"
+#include "utils/map_template.h"
+
+#define GLOBAL_NAME_EQUALS(a, b) (strcmp((a), (b)) == 0)
+DEFINE_MAP(global_names, char const *, int, hash_string, GLOBAL_NAME_EQUALS)
 
 typedef struct {
-    environment_t * globals;
+    // Globals get a dense index at resolve time and are read with a single
+    // indexed load. The name map only exists so later definitions of the same
+    // name (REPL, late binding) resolve to the same index.
+    global_names_t global_names; // <char*, int>
+    value_t * globals;
+    bool * globals_defined;
+    size_t globals_count;
+    size_t globals_capacity;
     environment_t * environment;
+    // Locals the resolver proved are never captured live in this contiguous
+    // stack instead of an environment. A call frame starts at frame_base,
+    // cells from stack_top up belong to no running block.
+    value_t * stack;
+    size_t stack_capacity;
+    size_t stack_top;
+    size_t frame_base;
     //map_t * locals; // <expr_t*,int> no need since the depth is embedded in variable expressions
 } interpreter_t;
 
 void interpret(interpreter_t * p_interpreter, list_t * p_statements);
+int interpreter_global_slot(interpreter_t * p_interpreter, char const * p_name, size_t hash);
 //void interpreter_resolve(interpreter_t * p_interpreter, expr_t * p_expr, int depth);
 void free_interpreter(interpreter_t * p_interpreter);
 
@@ -13,6 +13,8 @@
 #include "interpreter.h"
 #include "resolver.h"
 #include "list.h"
+#include "gc.h"
+#include "utils/slab.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -60,12 +62,42 @@ int main() {
 
     resolver_t resolver = {.interpreter = &interpreter, .scopes = NULL};
     resolve(&resolver, &statements);
+#ifdef LOX_GC
+    // LOX_GC_COMPACT=0.5 compacts the heap once half of it is fragmented
+    char const * compact = getenv("LOX_GC_COMPACT");
+    if (compact) gc_set_compaction(atof(compact));
+#endif
     interpret(&interpreter, &statements);
+#ifdef LOX_GC
+    // pause times and fragmentation of the collector, LOX_GC_STATS=1 to print them
+    if (getenv("LOX_GC_STATS")) {
+        gc_stats_t const stats = gc_stats();
+        fprintf(stderr, "gc: %zu cycles, %zu minor, %zu pauses, max %.3f ms, mean %.3f ms\n",
+            stats.collections, stats.minor_collections, stats.pauses,
+            (double)stats.pause_max_ns / 1e6,
+            stats.pauses ? (double)stats.pause_total_ns / 1e6 / (double)stats.pauses : 0.0);
+        fprintf(stderr, "gc: %zu KB held, %.0f%% fragmented, %zu compactions\n",
+            stats.heap_footprint / 1024, stats.fragmentation * 100, stats.compactions);
+    }
+#endif
 
-    //free_interpreter(&interpreter);
-    //free_resolver(&resolver);
+#ifndef LOX_GC
+    // LOX_SLAB_STATS=1 prints what the runtime allocated
+    if (getenv("LOX_SLAB_STATS")) {
+        slab_stats_t const stats = slab_stats();
+        fprintf(stderr, "slab: %zu allocations (%zu large), %zu KB in use, %zu KB in %zu chunks\n",
+            stats.allocations, stats.large, stats.bytes_in_use / 1024,
+            stats.bytes_reserved / 1024, stats.chunks);
+    }
+#endif
+    free_interpreter(&interpreter);
+    free_resolver(&resolver);
     list_free(&tokens);
     list_free(&statements);
+    // whatever is left of the small objects, environments and maps goes at
+    // once, nothing may allocate from the slab after this
+    obj_string_table_free();
+    slab_release_all();
     return 0;
 }
 
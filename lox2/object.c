@@ -0,0 +1,428 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#include "object.h"
+#include <stdio.h>
+#include "gc.h"
+#include "utils/map_template.h"
+#include "utils/slab.h"
+
+// Keys view the string's own chars, so a lookup needs no allocation
+typedef struct {
+    char const * chars;
+    size_t length;
+} string_key_t;
+
+#define STRING_KEY_HASH(k) obj_string_hash((k).chars, (k).length)
+#define STRING_KEY_EQUALS(a, b) \
+    ((a).length == (b).length && memcmp((a).chars, (b).chars, (a).length) == 0)
+DEFINE_MAP(string_table, string_key_t, obj_string_t *, STRING_KEY_HASH, STRING_KEY_EQUALS)
+
+#ifdef LOX_BIASED_RC
+// Every thread interns its own strings, see obj_string_same
+static thread_local string_table_t g_strings = {0};
+#else
+static string_table_t g_strings = {0};
+#endif
+
+#ifdef LOX_BIASED_RC
+thread_local uint32_t t_rc_thread = 0;
+
+// Objects other threads queued to their owner, indexed by thread id
+typedef struct {
+    mtx_t lock;
+    object_t ** items;
+    size_t count;
+    size_t capacity;
+} rc_queue_t;
+
+static rc_queue_t g_rc_queues[RC_MAX_THREADS + 1];
+static atomic_uint g_rc_threads = 0;
+static once_flag g_rc_once = ONCE_FLAG_INIT;
+
+// Drops waiting for the next obj_rc_flush
+static thread_local struct {
+    object_t * items[RC_LOG_SIZE];
+    size_t count;
+} t_rc_log = {0};
+
+static void init_rc_queues(void) {
+    for (size_t i = 0; i <= RC_MAX_THREADS; i++) {
+        if (mtx_init(&g_rc_queues[i].lock, mtx_plain) != thrd_success) {
+            fprintf(stderr, "Failed to create a reference count queue lock\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+uint32_t obj_rc_thread(void) {
+    if (t_rc_thread) return t_rc_thread;
+    call_once(&g_rc_once, init_rc_queues);
+    uint32_t const id = atomic_fetch_add(&g_rc_threads, 1) + 1;
+    if (id > RC_MAX_THREADS) {
+        fprintf(stderr, "More than %d threads allocating objects\n", RC_MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+    t_rc_thread = id;
+    return id;
+}
+
+/*
+ * On the owner: folds the shared count into refcount. True when that
+ * leaves nothing and o is not waiting in the owner's queue, whose flush
+ * settles it again.
+ */
+static bool rc_settle(object_t * o, bool const dequeued) {
+    int bits = atomic_load_explicit(&o->shared, memory_order_acquire);
+    int keep;
+    do {
+        keep = dequeued ? 0 : bits & RC_QUEUED;
+    } while (!atomic_compare_exchange_weak_explicit(&o->shared, &bits, keep,
+        memory_order_acq_rel, memory_order_acquire));
+    o->refcount += (bits - (bits & RC_QUEUED)) / RC_ONE;
+    return o->refcount <= 0 && !keep;
+}
+
+void obj_rc_release(object_t * o) {
+    if (rc_settle(o, false)) free_object(o);
+}
+
+void obj_rc_release_shared(object_t * o) {
+    int const bits = atomic_fetch_sub_explicit(&o->shared, RC_ONE, memory_order_acq_rel);
+    // only a count going below 0 is the owner's to settle, and only once
+    if ((bits - (bits & RC_QUEUED)) / RC_ONE >= 1 || (bits & RC_QUEUED)) return;
+    if (atomic_fetch_or_explicit(&o->shared, RC_QUEUED, memory_order_acq_rel) & RC_QUEUED) return;
+    rc_queue_t * q = &g_rc_queues[o->owner];
+    mtx_lock(&q->lock);
+    if (q->count == q->capacity) {
+        q->capacity = q->capacity ? q->capacity * 2 : 64;
+        q->items = realloc(q->items, q->capacity * sizeof(object_t*));
+        if (!q->items) exit(EXIT_FAILURE);
+    }
+    q->items[q->count++] = o;
+    mtx_unlock(&q->lock);
+}
+
+void obj_dec_ref_deferred(object_t * o) {
+    if (!o) return;
+    if (t_rc_log.count == RC_LOG_SIZE) obj_rc_flush();
+    t_rc_log.items[t_rc_log.count++] = o;
+}
+
+void obj_rc_flush(void) {
+    // freeing an object only drops its children directly, never through the log
+    while (t_rc_log.count) obj_dec_ref(t_rc_log.items[--t_rc_log.count]);
+    if (!t_rc_thread) return;
+    rc_queue_t * q = &g_rc_queues[t_rc_thread];
+    mtx_lock(&q->lock);
+    object_t ** items = q->items;
+    size_t const count = q->count;
+    q->items = NULL;
+    q->count = q->capacity = 0;
+    mtx_unlock(&q->lock);
+    for (size_t i = 0; i < count; i++)
+        if (rc_settle(items[i], true)) free_object(items[i]);
+    free(items);
+}
+
+void obj_share(object_t * o) {
+    if (o && o->type == OBJ_ROPE) obj_as_string(o);
+}
+#endif
+
+#ifndef LOX_GC
+// Drops the reference a dead rope held, true when the child died with it
+static bool drop_child(object_t * o) {
+#ifdef LOX_BIASED_RC
+    if (o->owner != t_rc_thread) {
+        obj_rc_release_shared(o);
+        return false;
+    }
+    return --o->refcount <= 0 && rc_settle(o, false);
+#else
+    return --o->refcount <= 0;
+#endif
+}
+#endif
+
+/*
+ * Gives back a dead object's block. Counted objects come from the slab
+ * allocator, under LOX_GC the collector has its own nursery and pages.
+ */
+static void release_object(object_t * o) {
+#ifdef LOX_GC
+    gc_free(o);
+#else
+    slab_free(o, object_size(o));
+#endif
+}
+
+/*
+ * Freeing a rope releases its children, and a rope built by appending is a
+ * chain as long as the number of appends, so dead children go on a
+ * worklist instead of recursing through obj_dec_ref. Under LOX_GC the
+ * collector frees each dead object itself and children are left alone.
+ */
+void free_object(object_t * o) {
+#ifndef LOX_GC
+    object_t ** pending = NULL;
+    size_t count = 0, capacity = 0;
+#endif
+    while (o) {
+        switch (o->type) {
+            case OBJ_STRING:
+                obj_string_t * s = (obj_string_t*)o;
+                string_table_remove_hashed(&g_strings,
+                    (string_key_t){ s->chars, s->length }, s->hash);
+                release_object(o);
+                break;
+            case OBJ_ROPE:
+#ifndef LOX_GC
+                obj_rope_t * r = (obj_rope_t*)o;
+                object_t * children[] = { r->left, r->right, (object_t*)r->flat };
+                for (size_t i = 0; i < 3; i++) {
+                    if (!children[i] || !drop_child(children[i])) continue;
+                    if (count == capacity) {
+                        capacity = capacity ? capacity * 2 : 16;
+                        pending = realloc(pending, capacity * sizeof(object_t*));
+                        if (!pending) exit(EXIT_FAILURE);
+                    }
+                    pending[count++] = children[i];
+                }
+#endif
+                release_object(o);
+                break;
+            default:
+                release_object(o);
+                break;
+        }
+#ifdef LOX_GC
+        o = NULL;
+#else
+        o = count ? pending[--count] : NULL;
+#endif
+    }
+#ifndef LOX_GC
+    free(pending);
+#endif
+}
+
+size_t object_size(object_t const * o) {
+    switch (o->type) {
+        case OBJ_STRING: return obj_string_size(((obj_string_t const*)o)->length);
+        case OBJ_ROPE:   return sizeof(obj_rope_t);
+        default:         return sizeof(object_t);
+    }
+}
+
+static object_t * allocate_object(size_t const size, object_type_t const type) {
+#ifdef LOX_GC
+    object_t * o = gc_allocate(size);
+#else
+    object_t * o = slab_alloc(size);
+#endif
+    o->type = type;
+    o->refcount = 0;
+#ifdef LOX_BIASED_RC
+    o->owner = obj_rc_thread();
+    atomic_init(&o->shared, 0);
+#endif
+    return o;
+}
+// Undoes allocate_object for an object that was never handed out
+static void discard_object(object_t * o) {
+#ifdef LOX_GC
+    gc_discard(o, object_size(o));
+#else
+    slab_free(o, object_size(o));
+#endif
+}
+
+// A string block with room for length characters, contents left to the caller.
+// Not known to the collector until interned, a duplicate is simply discarded.
+static obj_string_t * allocate_string(size_t const length) {
+    obj_string_t * p_str = (obj_string_t*)allocate_object(obj_string_size(length), OBJ_STRING);
+    p_str->length = length;
+    p_str->chars[length] = '\0';
+    return p_str;
+}
+
+// An existing string handed out again, which may be one a collection in
+// progress has found dead
+static obj_string_t * found(obj_string_t * p_str) {
+#ifdef LOX_GC
+    gc_found((object_t*)p_str);
+#endif
+    return p_str;
+}
+
+// Adds a string known to be missing from the table
+static obj_string_t * intern(obj_string_t * p_str) {
+    *string_table_emplace_hashed(&g_strings,
+        (string_key_t){ p_str->chars, p_str->length }, p_str->hash, NULL) = p_str;
+#ifdef LOX_GC
+    gc_track((object_t*)p_str);
+#endif
+    return p_str;
+}
+
+obj_string_t * obj_string_copy(char const * chars, size_t const length) {
+    size_t const hash = obj_string_hash(chars, length);
+    obj_string_t ** p_found = string_table_find_hashed(&g_strings,
+        (string_key_t){ chars, length }, hash);
+    if (p_found) return found(*p_found);
+    obj_string_t * p_str = allocate_string(length);
+    memcpy(p_str->chars, chars, length);
+    p_str->hash = hash;
+    return intern(p_str);
+}
+
+obj_string_t * obj_string_new(char const * chars) {
+    return obj_string_copy(chars, strlen(chars));
+}
+
+obj_string_t * obj_string_concat(obj_string_t const * a, obj_string_t const * b) {
+    size_t const length = a->length + b->length;
+    // built in place, thrown away again if the result already exists
+    obj_string_t * p_str = allocate_string(length);
+    memcpy(p_str->chars, a->chars, a->length);
+    memcpy(p_str->chars + a->length, b->chars, b->length);
+    p_str->hash = obj_string_hash(p_str->chars, length);
+    obj_string_t ** p_found = string_table_find_hashed(&g_strings,
+        (string_key_t){ p_str->chars, length }, p_str->hash);
+    if (p_found) {
+        discard_object((object_t*)p_str);
+        return found(*p_found);
+    }
+    return intern(p_str);
+}
+
+object_t * obj_concat(object_t * a, object_t * b) {
+    size_t const a_length = obj_string_length(a), b_length = obj_string_length(b);
+    // a rope is never shorter than OBJ_ROPE_MIN_LENGTH, so both are flat here
+    if (a_length + b_length < OBJ_ROPE_MIN_LENGTH)
+        return (object_t*)obj_string_concat(obj_as_string(a), obj_as_string(b));
+    if (b_length == 0) return a;
+    if (a_length == 0) return b;
+    obj_rope_t * p_rope = (obj_rope_t*)allocate_object(sizeof(obj_rope_t), OBJ_ROPE);
+    p_rope->length = a_length + b_length;
+    p_rope->left = a;
+    p_rope->right = b;
+    p_rope->flat = NULL;
+    obj_inc_ref(a);
+    obj_inc_ref(b);
+#ifdef LOX_GC
+    gc_track((object_t*)p_rope);
+    gc_write_barrier((object_t*)p_rope, a);
+    gc_write_barrier((object_t*)p_rope, b);
+#endif
+    return (object_t*)p_rope;
+}
+
+obj_string_t * obj_as_string(object_t * o) {
+    if (o->type == OBJ_STRING) return (obj_string_t*)o;
+    obj_rope_t * p_rope = (obj_rope_t*)o;
+    if (p_rope->flat) return p_rope->flat;
+
+    // filled right to left: take the right side now, come back for the left
+    obj_string_t * p_str = allocate_string(p_rope->length);
+    char * end = p_str->chars + p_rope->length;
+    object_t ** stack = NULL;
+    size_t count = 0, capacity = 0;
+    object_t const * node = o;
+    while (node) {
+        obj_rope_t const * r = (obj_rope_t const*)node;
+        if (node->type == OBJ_ROPE && !r->flat) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                stack = realloc(stack, capacity * sizeof(object_t*));
+                if (!stack) exit(EXIT_FAILURE);
+            }
+            stack[count++] = r->left;
+            node = r->right;
+            continue;
+        }
+        obj_string_t const * piece = node->type == OBJ_STRING ? (obj_string_t const*)node : r->flat;
+        end -= piece->length;
+        memcpy(end, piece->chars, piece->length);
+        node = count ? stack[--count] : NULL;
+    }
+    free(stack);
+
+    p_str->hash = obj_string_hash(p_str->chars, p_str->length);
+    obj_string_t ** p_found = string_table_find_hashed(&g_strings,
+        (string_key_t){ p_str->chars, p_str->length }, p_str->hash);
+    if (p_found) {
+        discard_object((object_t*)p_str);
+        p_str = found(*p_found);
+    } else {
+        intern(p_str);
+    }
+    // from now on the rope is just a handle to the flat string
+    p_rope->flat = p_str;
+    obj_inc_ref((object_t*)p_str);
+#ifdef LOX_GC
+    gc_write_barrier(o, (object_t*)p_str);
+#endif
+    object_t * left = p_rope->left, * right = p_rope->right;
+    p_rope->left = p_rope->right = NULL;
+    obj_dec_ref(left);
+    obj_dec_ref(right);
+    return p_str;
+}
+
+object_t * obj_concat_unique(object_t * a, object_t * b) {
+#ifdef LOX_GC
+    (void)a;
+    (void)b;
+    return NULL;
+#else
+    if (a->type != OBJ_STRING || a->refcount != 1) return NULL;
+#ifdef LOX_BIASED_RC
+    // only the owner's count may hold the one reference
+    if (a->owner != t_rc_thread || atomic_load_explicit(&a->shared, memory_order_acquire) != 0)
+        return NULL;
+#endif
+    obj_string_t * p_str = (obj_string_t*)a;
+    size_t const length = p_str->length + obj_string_length(b);
+    // the block keeps its size class, so object_size still frees it right
+    if (slab_block_size(obj_string_size(length)) != slab_block_size(obj_string_size(p_str->length)))
+        return NULL;
+    // flattening b may share a, as b's flat string
+    obj_string_t const * p_b = obj_as_string(b);
+    if (p_b == p_str || a->refcount != 1) return NULL;
+
+    string_table_remove_hashed(&g_strings,
+        (string_key_t){ p_str->chars, p_str->length }, p_str->hash);
+    memcpy(p_str->chars + p_str->length, p_b->chars, p_b->length);
+    p_str->length = length;
+    p_str->chars[length] = '\0';
+    p_str->hash = obj_string_hash(p_str->chars, length);
+    obj_string_t ** p_found = string_table_find_hashed(&g_strings,
+        (string_key_t){ p_str->chars, length }, p_str->hash);
+    if (p_found) {
+        release_object(a);
+        return (object_t*)*p_found;
+    }
+    a->refcount = 0;
+    return (object_t*)intern(p_str);
+#endif
+}
+
+#ifdef LOX_GC
+void obj_string_relocate(obj_string_t * from, obj_string_t * to) {
+    string_table_remove_hashed(&g_strings, (string_key_t){ from->chars, from->length }, from->hash);
+    if (!to) return;
+    *string_table_emplace_hashed(&g_strings,
+        (string_key_t){ to->chars, to->length }, to->hash, NULL) = to;
+}
+#endif
+
+size_t obj_string_interned(void) {
+    return g_strings.size;
+}
+
+void obj_string_table_free(void) {
+    string_table_destroy(&g_strings);
+}
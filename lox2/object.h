@@ -4,9 +4,21 @@
 
 #ifndef LOX_OBJECT_H
 #define LOX_OBJECT_H
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "utils/hash.h"
+#if defined(LOX_GC) || defined(LOX_BIASED_RC)
+#include <stdatomic.h>
+#endif
+#ifdef LOX_BIASED_RC
+#include <threads.h>
+#endif
+
+#if defined(LOX_GC) && defined(LOX_BIASED_RC)
+#error "LOX_BIASED_RC counts references, LOX_GC replaces counting, pick one"
+#endif
 
 typedef enum {
     OBJ_STRING,
@@ -14,35 +26,121 @@ typedef enum {
     OBJ_CLASS,
     OBJ_INSTANCE,
     OBJ_BOUND_METHOD,
-    OBJ_NATIVE
+    OBJ_NATIVE,
+    OBJ_ROPE
 } object_type_t;
 
 typedef struct object {
     object_type_t type;
-    int refcount;
+    int refcount;          // LOX_BIASED_RC: the owner thread's count
+#ifdef LOX_BIASED_RC
+    uint32_t owner;        // thread that allocated it, see obj_rc_thread
+    atomic_int shared;     // every other thread's count in RC_ONE steps, plus RC_QUEUED
+#endif
+#ifdef LOX_GC
+    atomic_bool marked;    // old object: black or gray when equal to the GC epoch
+    bool remembered;       // old object in the remembered set
+    bool forwarded;        // promoted or compacted, next is the new copy
+    bool paged;            // old object compacted into a page
+    struct object * next;  // old objects list, or the promoted copy
+#endif
 } object_t;
 
+/*
+ * One block: header, then the NUL terminated characters in place. Strings
+ * of up to OBJ_STRING_INLINE characters, identifier sized, all get the same
+ * block size so they share one allocator size class.
+ */
 typedef struct {
     object_t header;
     size_t length;
-    char * chars;
-    uint32_t hash;
+    size_t hash;  // hash_bytes(chars, length), same as hash_string(chars)
+    char chars[];
 } obj_string_t;
 
-static inline void free_object(object_t * o) {
+#define OBJ_STRING_INLINE 15
+
+static inline size_t obj_string_size(size_t const length) {
+    size_t const capacity = length < OBJ_STRING_INLINE ? OBJ_STRING_INLINE : length;
+    return sizeof(obj_string_t) + capacity + 1;
+}
+
+// Frees o, a string is dropped from the intern table first
+void free_object(object_t * o);
+// Bytes o occupies, for the collector's accounting
+size_t object_size(object_t const * o);
+
+#ifdef LOX_GC
+// The collector owns every object, references are not counted
+static inline void obj_inc_ref(object_t * o) {
+    (void)o;
+}
+static inline void obj_dec_ref(object_t * o) {
+    (void)o;
+}
+static inline void obj_dec_ref_deferred(object_t * o) {
+    (void)o;
+}
+static inline void obj_rc_flush(void) {}
+static inline void obj_share(object_t * o) {
+    (void)o;
+}
+#elif defined(LOX_BIASED_RC)
+/*
+ * Biased reference counting, for objects used by several interpreter
+ * threads. An object is biased to the thread that allocated it, its owner:
+ * the owner counts in the plain refcount, every other thread in the atomic
+ * shared count, so a thread working on its own objects never pays for an
+ * atomic. The real count is the sum of both.
+ *
+ * When the owner's count drops to 0 it folds the shared count in and the
+ * object is dead if that is 0 too. A drop that takes the shared count
+ * below 0 (the owner counted the reference that went away) queues the
+ * object to its owner, which folds it at its next obj_rc_flush. Objects
+ * are only ever freed by their owner, so the slab allocator and the intern
+ * table stay per thread: every thread interns its own strings, and string
+ * equality compares contents across threads (obj_string_same).
+ *
+ * Drops of values overwritten in or destroyed with an environment go
+ * through obj_dec_ref_deferred, a per-thread log applied in batches by
+ * obj_rc_flush, which gc_safepoint calls after every statement.
+ *
+ * Strings are immutable once interned, a rope is not until flattened:
+ * obj_share flattens one before it is handed to another thread. A thread
+ * flushes before it exits, what is queued to an exited thread is leaked.
+ */
+#define RC_QUEUED 1
+#define RC_ONE 2
+#define RC_MAX_THREADS 64
+#define RC_LOG_SIZE 256
+
+extern thread_local uint32_t t_rc_thread;  // 0 until the thread allocates
+
+// This thread's id, registering it on first use
+uint32_t obj_rc_thread(void);
+// Settles o on its owner once the owner's count reached 0
+void obj_rc_release(object_t * o);
+// A drop by a thread other than o's owner
+void obj_rc_release_shared(object_t * o);
+// obj_dec_ref, applied at the next obj_rc_flush
+void obj_dec_ref_deferred(object_t * o);
+// Applies this thread's deferred drops and settles what other threads queued to it
+void obj_rc_flush(void);
+// Readies o to be handed to another thread
+void obj_share(object_t * o);
+
+static inline void obj_inc_ref(object_t * o) {
     if (!o) return;
-    switch (o->type) {
-        case OBJ_STRING:
-            obj_string_t * s = (obj_string_t*)o;
-            if (s->chars) free(s->chars);
-            free(s);
-            break;
-        default:
-            free(o);
-            break;
-    }
+    if (o->owner == t_rc_thread) o->refcount++;
+    else atomic_fetch_add_explicit(&o->shared, RC_ONE, memory_order_relaxed);
 }
 
+static inline void obj_dec_ref(object_t * o) {
+    if (!o) return;
+    if (o->owner != t_rc_thread) obj_rc_release_shared(o);
+    else if (--o->refcount <= 0) obj_rc_release(o);
+}
+#else
 static inline void obj_inc_ref(object_t * o) {
     if (!o) return;
     o->refcount++;
@@ -55,27 +153,84 @@ static inline void obj_dec_ref(object_t * o) {
         free_object(o);
     }
 }
+static inline void obj_dec_ref_deferred(object_t * o) {
+    obj_dec_ref(o);
+}
+static inline void obj_rc_flush(void) {}
+static inline void obj_share(object_t * o) {
+    (void)o;
+}
+#endif
 
-static inline uint32_t obj_string_hash(char const * key, size_t const len) {
-    if (!key || !len) return 0;
-    uint32_t h = 2166136261u;
-    for (size_t i = 0; i < len; ++i) {
-        h ^= (unsigned char)key[i];
-        h *= 16777619u;
-    }
-    return h;
+static inline size_t obj_string_hash(char const * key, size_t const len) {
+    if (!key) return 0;
+    return hash_bytes(key, len);
 }
 
-static inline obj_string_t *obj_string_new(char const * chars) { /* convenience: strdup */
-    obj_string_t * p_str = malloc(sizeof(obj_string_t));
-    if (!p_str) return NULL;
-    p_str->header.type = OBJ_STRING;
-    p_str->header.refcount = 0;
-    p_str->length = strlen(chars);
-    p_str->chars = malloc(p_str->length + 1);
-    if (!p_str->chars) return NULL;
-    memcpy(p_str->chars, chars, p_str->length + 1);
-    p_str->hash = obj_string_hash(p_str->chars, p_str->length);
-    return p_str;
+/*
+ * Strings are interned: every obj_string_t with the same contents is the
+ * same object, so string equality is pointer equality (value_equals) and
+ * duplicates share storage. The table is weak, it holds no reference and
+ * a string leaves it when its last reference goes away.
+ */
+// The interned string for chars[0..length), created on first use
+obj_string_t * obj_string_copy(char const * chars, size_t length);
+// Same for a NUL terminated string
+obj_string_t * obj_string_new(char const * chars);
+// a + b, interned
+obj_string_t * obj_string_concat(obj_string_t const * a, obj_string_t const * b);
+// Live strings in the intern table (this thread's under LOX_BIASED_RC)
+size_t obj_string_interned(void);
+// Empties and frees the intern table, for teardown before slab_release_all
+void obj_string_table_free(void);
+// Equal contents, which interning makes pointer equality within a thread
+static inline bool obj_string_same(obj_string_t const * a, obj_string_t const * b) {
+#ifdef LOX_BIASED_RC
+    return a == b || (a->hash == b->hash && a->length == b->length &&
+        memcmp(a->chars, b->chars, a->length) == 0);
+#else
+    return a == b;
+#endif
+}
+#ifdef LOX_GC
+// Points the intern table at a string's new copy, or drops it for NULL
+void obj_string_relocate(obj_string_t * from, obj_string_t * to);
+#endif
+
+/*
+ * A lazy concatenation, so s = s + piece in a loop costs O(length) overall
+ * instead of copying s every time. It is flattened into an interned
+ * string the first time its characters are needed (printing, comparing),
+ * after which it keeps only the flat string and releases its children.
+ */
+typedef struct {
+    object_t header;
+    size_t length;
+    object_t * left;      // string or rope, both NULL once flattened
+    object_t * right;
+    obj_string_t * flat;  // set by obj_as_string
+} obj_rope_t;
+
+// Results shorter than this are copied into an interned string right away
+#define OBJ_ROPE_MIN_LENGTH 64
+
+static inline bool obj_is_string(object_t const * o) {
+    return o && (o->type == OBJ_STRING || o->type == OBJ_ROPE);
+}
+static inline size_t obj_string_length(object_t const * o) {
+    return o->type == OBJ_STRING ? ((obj_string_t const *)o)->length : ((obj_rope_t const *)o)->length;
 }
+// a + b for two strings or ropes, a rope unless the result is short
+object_t * obj_concat(object_t * a, object_t * b);
+// The interned string for a string or rope, flattening a rope once
+obj_string_t * obj_as_string(object_t * o);
+/*
+ * a + b appended to a in place, for a caller holding the only reference to
+ * a flat string a that it gives up anyway. Returns NULL when a is shared or
+ * its block has no room, the caller then falls back to obj_concat. Otherwise
+ * the caller's reference to a is gone and the result is returned as
+ * obj_concat would return it. Never reuses under LOX_GC, where references
+ * are not counted.
+ */
+object_t * obj_concat_unique(object_t * a, object_t * b);
 #endif //LOX_OBJECT_H
\ No newline at end of file
@@ -92,6 +92,7 @@ static expr_t * assignment(parser_t * p_parser) {
             assign->type = EXPR_ASSIGN;
             assign->as.assign_expr.target = p_expr;
             assign->as.assign_expr.value = value;
+            assign->as.assign_expr.borrowed = false;
             return assign;
         }
         if (p_expr->type == EXPR_GET) {
@@ -261,6 +262,11 @@ static expr_t * primary(parser_t * p_parser) {
         if (!expr) exit(EXIT_FAILURE);
         expr->type = EXPR_VARIABLE;
         expr->as.variable_expr.name = copy_token(p_parser->p_previous);
+        expr->as.variable_expr.depth = -1;
+        expr->as.variable_expr.slot = -1;
+        expr->as.variable_expr.global = -1;
+        expr->as.variable_expr.borrowed = false;
+        expr->as.variable_expr.moved = false;
         return expr;
     }
     if (token_match(p_parser, 1, LEFT_PAREN)) {
@@ -317,6 +323,9 @@ static stmt_t * variable_declaration(parser_t * p_parser)  {
     var_decl->type = STMT_VAR;
     var_decl->as.var_stmt.name = copy_token(&name);
     var_decl->as.var_stmt.initializer = p_initializer;
+    var_decl->as.var_stmt.slot = -1;
+    var_decl->as.var_stmt.captured = false;
+    var_decl->as.var_stmt.global = -1;
     return var_decl;
 }
 
@@ -384,6 +393,9 @@ static stmt_t * for_statement(parser_t * p_parser) {
         if (!p_new_body) exit(EXIT_FAILURE);
         p_new_body->type = STMT_BLOCK;
         p_new_body->as.block_stmt.count = 2;
+        p_new_body->as.block_stmt.needs_environment = true;
+        p_new_body->as.block_stmt.first_slot = 0;
+        p_new_body->as.block_stmt.slot_count = 0;
         p_new_body->as.block_stmt.statements = malloc(sizeof(stmt_t*) * 2);
         p_new_body->as.block_stmt.statements[0] = p_body;
         stmt_t * p_stmt_expr_temp = malloc(sizeof(stmt_t));
@@ -413,11 +425,15 @@ static stmt_t * for_statement(parser_t * p_parser) {
         if (!p_new_new_new_body) exit(EXIT_FAILURE);
         p_new_new_new_body->type = STMT_BLOCK;
         p_new_new_new_body->as.block_stmt.count = 2;
+        p_new_new_new_body->as.block_stmt.needs_environment = true;
+        p_new_new_new_body->as.block_stmt.first_slot = 0;
+        p_new_new_new_body->as.block_stmt.slot_count = 0;
         p_new_new_new_body->as.block_stmt.statements = malloc(sizeof(stmt_t*) * 2);
         if (!p_new_new_new_body->as.block_stmt.statements)
             exit(EXIT_FAILURE);
         p_new_new_new_body->as.block_stmt.statements[0] = p_initializer;
         p_new_new_new_body->as.block_stmt.statements[1] = p_body;
+        p_body = p_new_new_new_body;
     }
     return p_body;
 }
@@ -495,6 +511,11 @@ static stmt_t * block_statement(parser_t * p_parser) {
 
     size_t capacity = 1;
     p_stmt->as.block_stmt.count = 0;
+    // the resolver clears this for blocks without declarations
+    p_stmt->as.block_stmt.needs_environment = true;
+    // and sets the range of frame slots its locals take
+    p_stmt->as.block_stmt.first_slot = 0;
+    p_stmt->as.block_stmt.slot_count = 0;
     p_stmt->as.block_stmt.statements = malloc(sizeof(stmt_t*) * capacity);
     if (!p_stmt->as.block_stmt.statements) exit(EXIT_FAILURE);
     while (!token_check(p_parser, RIGHT_BRACE) && !token_is_at_end(p_parser)) {
@@ -587,8 +608,9 @@ static expr_t * finish_call(parser_t * p_parser, expr_t * callee) {
     return p_expr;
 }
 
+// Optional parts (initializers, else branches, return values) may be NULL
 static void free_expr(void ** pp_expr) {
-    if (!pp_expr || !*pp_expr) exit(EXIT_FAILURE);
+    if (!pp_expr || !*pp_expr) return;
     expr_t * p_expr = *pp_expr;
      switch (p_expr->type) {
          case EXPR_ASSIGN:
@@ -647,7 +669,7 @@ static void free_expr(void ** pp_expr) {
     free(p_expr);
 }
 static void free_stmt(void ** pp_stmt) {
-    if (!pp_stmt || !*pp_stmt) exit(EXIT_FAILURE);
+    if (!pp_stmt || !*pp_stmt) return;
     stmt_t * p_stmt = *pp_stmt;
     switch (p_stmt->type) {
         case STMT_BLOCK:
@@ -662,6 +684,7 @@ static void free_stmt(void ** pp_stmt) {
                 token_free((void**)&p_stmt->as.function_stmt.params[i]);
             }
             free(p_stmt->as.function_stmt.params);
+            free(p_stmt->as.function_stmt.params_captured);
             for (size_t i = 0; i < p_stmt->as.function_stmt.count; i++) {
                 free_stmt((void**)&p_stmt->as.function_stmt.body[i]);
             }
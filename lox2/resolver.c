@@ -8,76 +8,117 @@
 #include "expr.h"
 
 #include "utils/stack.h"
+#include "utils/hash.h"
 
 #undef NULL
 #define NULL nullptr
 
-static void resolve_statement(resolver_t * p_resolver, stmt_t const * p_stmt);
+// Per-name info kept in a scope map
+typedef struct {
+    bool defined;
+    int slot; // index into the call frame, -1 if the name lives in an environment
+} local_t;
+
+// One lexical scope. Only scopes holding captured names get an environment
+// at runtime, so only those count towards a variable's depth.
+typedef struct {
+    map_t * names; // <char*, local_t>
+    int slot_count;
+    bool has_environment;
+} scope_t;
+
+// Escape analysis state, see escape_statement
+typedef struct {
+    bool * p_captured;
+    int function_depth;
+} escape_local_t;
+
+typedef struct {
+    stack_t * scopes; // Stack<map_t*> of <char*, escape_local_t>
+    int function_depth;
+} escape_t;
+
+static void resolve_statements(resolver_t * p_resolver, list_t const * p_statements);
+static void resolve_statement(resolver_t * p_resolver, stmt_t * p_stmt);
 static void resolve_expression(resolver_t * p_resolver, expr_t * p_expr);
-static void begin_scope(resolver_t const * p_resolver);
-static void end_scope(resolver_t const * p_resolver);
-static bool * new_bool(bool v);
-static void declare(resolver_t const * p_resolver, char const * p_name);
-static void define(resolver_t const * p_resolver, char const * p_name);
-static int resolve_local(resolver_t const * p_resolver, expr_t * p_expr, char const * p_name);
+static void resolve_function(resolver_t * p_resolver, stmt_function_t const * p_function,
+    function_type_t type);
+static void begin_scope(resolver_t const * p_resolver, bool has_environment);
+static void end_scope(resolver_t * p_resolver);
+static bool block_has_declarations(stmt_block_t const * p_block);
+static bool block_has_captured_declarations(stmt_block_t const * p_block);
+static int declare(resolver_t * p_resolver, char const * p_name, size_t hash, bool captured);
+static void define(resolver_t const * p_resolver, char const * p_name, size_t hash);
+static int resolve_local(resolver_t const * p_resolver, expr_t * p_expr, char const * p_name, size_t hash);
+
+static void escape_statements(escape_t * p_escape, stmt_t ** pp_stmts, size_t count);
+static void escape_statement(escape_t * p_escape, stmt_t * p_stmt);
+static void escape_expression(escape_t * p_escape, expr_t const * p_expr);
+
+static void own_statements(stmt_t ** pp_stmts, size_t count);
+static void own_statement(stmt_t * p_stmt);
+static void own_expression(expr_t * p_expr, bool borrowed);
 /*
  * Expects list_t of type List<stmt_t*>
  */
 void resolve(resolver_t * p_resolver, list_t * p_statements) {
     if (!p_resolver || !p_statements) return;
     if (!p_resolver->scopes || p_resolver->scopes->capacity == 0) p_resolver->scopes =  stack_create(4);
-    for (size_t i = 0; i < p_statements->count; i++) {
-        resolve_statement(p_resolver, p_statements->data[i]);
-        // TODO error handling
-    }
+
+    // Escape analysis runs first so every declaration already knows whether
+    // a nested function captures it when slots are handed out below.
+    escape_t escape = { .scopes = stack_create(4), .function_depth = 0 };
+    escape_statements(&escape, (stmt_t**)p_statements->data, p_statements->count);
+    free(escape.scopes->data);
+    free(escape.scopes);
+
+    resolve_statements(p_resolver, p_statements);
+    own_statements((stmt_t**)p_statements->data, p_statements->count);
 }
 
 void free_resolver(resolver_t * p_resolver) {
     if (!p_resolver) return;
     stack_destroy(p_resolver->scopes);
 }
-static void resolve_statement(resolver_t * p_resolver, stmt_t const * p_stmt) {
+static void resolve_statements(resolver_t * p_resolver, list_t const * p_statements) {
+    for (size_t i = 0; i < p_statements->count; i++) {
+        resolve_statement(p_resolver, p_statements->data[i]);
+        // TODO error handling
+    }
+}
+static void resolve_statement(resolver_t * p_resolver, stmt_t * p_stmt) {
     switch (p_stmt->type) {
         case STMT_BLOCK:
-            begin_scope(p_resolver);
+            // A block that declares nothing gets no scope, so depths computed
+            // inside it skip it. A block whose locals all stay in frame slots
+            // gets a scope but no environment.
+            bool const has_scope = block_has_declarations(&p_stmt->as.block_stmt);
+            p_stmt->as.block_stmt.needs_environment =
+                block_has_captured_declarations(&p_stmt->as.block_stmt);
+            if (has_scope) begin_scope(p_resolver, p_stmt->as.block_stmt.needs_environment);
+            p_stmt->as.block_stmt.first_slot = p_resolver->local_count;
             list_t statements = {
                 .data = (void**)p_stmt->as.block_stmt.statements,
                 .count = p_stmt->as.block_stmt.count,
                 .capacity = p_stmt->as.block_stmt.count,
                 .free_fn = NULL // no need to free, points to existing statements
             };
-            resolve(p_resolver, &statements);
-            end_scope(p_resolver);
+            resolve_statements(p_resolver, &statements);
+            // the interpreter releases these slots when the block ends
+            p_stmt->as.block_stmt.slot_count =
+                p_resolver->local_count - p_stmt->as.block_stmt.first_slot;
+            if (has_scope) end_scope(p_resolver);
             break;
         case STMT_FUNCTION:
-            declare(p_resolver, p_stmt->as.function_stmt.name->lexeme);
-            define(p_resolver, p_stmt->as.function_stmt.name->lexeme);
-
-            //resolve_function(p_resolver, &p_stmt->as.function_stmt, FUNCTION_TYPE_FUNCTION);
-
-            function_type_t const enclosing = p_resolver->current_function;
-            p_resolver->current_function = FUNCTION_TYPE_FUNCTION;
-            begin_scope(p_resolver);
-
-            for (size_t i = 0; i < p_stmt->as.function_stmt.params_count; i++) {
-                token_t const * param = p_stmt->as.function_stmt.params[i];
-                declare(p_resolver, param->lexeme);
-                define(p_resolver, param->lexeme);
-            }
-            list_t function_body = {
-                .data = (void**)p_stmt->as.function_stmt.body,
-                .count = p_stmt->as.function_stmt.count,
-                .capacity = p_stmt->as.function_stmt.count,
-                .free_fn = NULL // no need to free, points to existing statements
-            };
-            resolve(p_resolver, &function_body);
-            end_scope(p_resolver);
-            p_resolver->current_function = enclosing;
+            token_t const * p_function_name = p_stmt->as.function_stmt.name;
+            declare(p_resolver, p_function_name->lexeme, p_function_name->hash, true);
+            define(p_resolver, p_function_name->lexeme, p_function_name->hash);
+            resolve_function(p_resolver, &p_stmt->as.function_stmt, FUNCTION_TYPE_FUNCTION);
             break;
         case STMT_CLASS:
             stmt_class_t const * s = &p_stmt->as.class_stmt;
-            declare(p_resolver, s->name->lexeme);
-            define(p_resolver, s->name->lexeme);
+            declare(p_resolver, s->name->lexeme, s->name->hash, true);
+            define(p_resolver, s->name->lexeme, s->name->hash);
 
             class_type_t const class_enclosing = p_resolver->current_class;
             p_resolver->current_class = CLASS_TYPE_CLASS;
@@ -97,11 +138,13 @@ static void resolve_statement(resolver_t * p_resolver, stmt_t const * p_stmt) {
                         }
                     }
                 }
-                begin_scope(p_resolver);
-                map_put(stack_peek(p_resolver->scopes), "super", new_bool(true));
+                begin_scope(p_resolver, true);
+                declare(p_resolver, "super", hash_string("super"), true);
+                define(p_resolver, "super", hash_string("super"));
             }
-            begin_scope(p_resolver);
-            map_put(stack_peek(p_resolver->scopes), "this", new_bool(true));
+            begin_scope(p_resolver, true);
+            declare(p_resolver, "this", hash_string("this"), true);
+            define(p_resolver, "this", hash_string("this"));
 
             for (size_t i = 0; i < s->methods_count; i++) {
                 stmt_t const * p_method = s->methods[i];
@@ -109,29 +152,7 @@ static void resolve_statement(resolver_t * p_resolver, stmt_t const * p_stmt) {
                 if (strcmp(p_method->as.function_stmt.name->lexeme, "init") == 0) {
                     decl = FUNCTION_TYPE_INITIALIZER;
                 }
-
-
-                //resolve_function(p_resolver, &p_method->as.function_stmt, decl);
-
-                function_type_t const method_enclosing = p_resolver->current_function;
-                p_resolver->current_function = decl;
-                begin_scope(p_resolver);
-
-                for (size_t j = 0; i < p_method->as.function_stmt.params_count; j++) {
-                    token_t const * param = p_method->as.function_stmt.params[j];
-                    declare(p_resolver, param->lexeme);
-                    define(p_resolver, param->lexeme);
-                }
-                list_t method_body = {
-                    .data = (void**)p_method->as.function_stmt.body,
-                    .count = p_method->as.function_stmt.count,
-                    .capacity = p_method->as.function_stmt.count,
-                    .free_fn = NULL // no need to free, points to existing statements
-                };
-                resolve(p_resolver, &method_body);
-                end_scope(p_resolver);
-                p_resolver->current_function = method_enclosing;
-
+                resolve_function(p_resolver, &p_method->as.function_stmt, decl);
             }
 
             end_scope(p_resolver);
@@ -166,11 +187,14 @@ static void resolve_statement(resolver_t * p_resolver, stmt_t const * p_stmt) {
             }
             break;
         case STMT_VAR:
-            const char * name = p_stmt->as.var_stmt.name->lexeme;
-            declare(p_resolver, name);
-            if (p_stmt->as.var_stmt.initializer)
-                resolve_expression(p_resolver, p_stmt->as.var_stmt.initializer);
-            define(p_resolver, p_stmt->as.var_stmt.name->lexeme);
+            stmt_var_t * p_var = &p_stmt->as.var_stmt;
+            const char * name = p_var->name->lexeme;
+            p_var->slot = declare(p_resolver, name, p_var->name->hash, p_var->captured);
+            if (stack_is_empty(p_resolver->scopes))
+                p_var->global = interpreter_global_slot(p_resolver->interpreter, name, p_var->name->hash);
+            if (p_var->initializer)
+                resolve_expression(p_resolver, p_var->initializer);
+            define(p_resolver, name, p_var->name->hash);
             break;
         case STMT_WHILE:
             resolve_expression(p_resolver, p_stmt->as.while_stmt.condition);
@@ -187,10 +211,11 @@ static void resolve_expression(resolver_t * p_resolver, expr_t * p_expr) {
         case EXPR_ASSIGN:
             resolve_expression(p_resolver, p_expr->as.assign_expr.value);
             if (p_expr->as.assign_expr.target->type == EXPR_VARIABLE) {
-                char const * name = p_expr->as.assign_expr.target->as.variable_expr.name->lexeme;
+                expr_t * target = p_expr->as.assign_expr.target;
                 // if resolve local returns -1, assignment is in global scope
-                p_expr->as.assign_expr.target->as.variable_expr.depth =
-                    resolve_local(p_resolver, p_expr, name);
+                target->as.variable_expr.depth =
+                    resolve_local(p_resolver, target, target->as.variable_expr.name->lexeme,
+                        target->as.variable_expr.name->hash);
             }
             break;
         case EXPR_BINARY:
@@ -227,29 +252,26 @@ static void resolve_expression(resolver_t * p_resolver, expr_t * p_expr) {
                 fprintf(stderr, "Resolver error: 'super' used in a class with no superclass.\n");
                 exit(EXIT_FAILURE);
             }
-            resolve_local(p_resolver, p_expr, "super");
+            // keyword tokens carry no hash
+            resolve_local(p_resolver, p_expr, "super", hash_string("super"));
             break;
         case EXPR_THIS:
             if (p_resolver->current_class == CLASS_TYPE_NONE) {
                 fprintf(stderr, "Resolver error: 'this' used outside of a class.\n");
                 return;
             }
-            resolve_local(p_resolver, p_expr, "this");
+            resolve_local(p_resolver, p_expr, "this", hash_string("this"));
             break;
         case EXPR_UNARY:
             resolve_expression(p_resolver, p_expr->as.unary_expr.right);
             break;
         case EXPR_VARIABLE:
             if (!stack_is_empty(p_resolver->scopes)) {
-                map_t * scope = stack_peek(p_resolver->scopes);
-                if (map_contains(scope, p_expr->as.variable_expr.name->lexeme)) {
-                    bool * ret;
-                    if (!map_get(scope, p_expr->as.variable_expr.name->lexeme, (void**)&ret)) {
-                        fprintf(stderr, "failed to get from map\n");
-                        exit(EXIT_FAILURE);
-                    }
-                    bool const * defined = ret;
-                    if (defined && *defined == false) {
+                scope_t const * scope = stack_peek(p_resolver->scopes);
+                token_t const * p_name = p_expr->as.variable_expr.name;
+                local_t const * ret = map_find_hashed(scope->names, p_name->lexeme, p_name->hash);
+                if (ret) {
+                    if (ret->defined == false) {
                         fprintf(
                             stderr,
                             "Resolver error: cannot read local variable '%s' in its own initializer\n",
@@ -259,7 +281,8 @@ static void resolve_expression(resolver_t * p_resolver, expr_t * p_expr) {
                 }
             }
             p_expr->as.variable_expr.depth =
-                resolve_local(p_resolver, p_expr, p_expr->as.variable_expr.name->lexeme);
+                resolve_local(p_resolver, p_expr, p_expr->as.variable_expr.name->lexeme,
+                    p_expr->as.variable_expr.name->hash);
             break;
         default:
             fprintf(stderr, "Not implemented (%d)\n", p_expr->type);
@@ -267,11 +290,40 @@ static void resolve_expression(resolver_t * p_resolver, expr_t * p_expr) {
 
     }
 }
-static void * bool_copy(void const * ptr) {
-    bool * ret = malloc(sizeof(bool));
-    if (!ret) exit(EXIT_FAILURE);
-    *ret = *(bool*)ptr;
-    return ret;
+static void resolve_function(resolver_t * p_resolver, stmt_function_t const * p_function,
+    function_type_t const type) {
+    function_type_t const enclosing = p_resolver->current_function;
+    int const enclosing_local_count = p_resolver->local_count;
+    p_resolver->current_function = type;
+    // every function starts its own frame
+    p_resolver->local_count = 0;
+
+    bool has_environment = false;
+    for (size_t i = 0; i < p_function->params_count; i++) {
+        if (p_function->params_captured && p_function->params_captured[i])
+            has_environment = true;
+    }
+    list_t const function_body = {
+        .data = (void**)p_function->body,
+        .count = p_function->count,
+        .capacity = p_function->count,
+        .free_fn = NULL // no need to free, points to existing statements
+    };
+    stmt_block_t const body = { .statements = p_function->body, .count = p_function->count };
+    if (block_has_captured_declarations(&body)) has_environment = true;
+
+    begin_scope(p_resolver, has_environment);
+    for (size_t i = 0; i < p_function->params_count; i++) {
+        token_t const * param = p_function->params[i];
+        declare(p_resolver, param->lexeme, param->hash,
+            p_function->params_captured && p_function->params_captured[i]);
+        define(p_resolver, param->lexeme, param->hash);
+    }
+    resolve_statements(p_resolver, &function_body);
+    end_scope(p_resolver);
+
+    p_resolver->local_count = enclosing_local_count;
+    p_resolver->current_function = enclosing;
 }
 static void * str_copy(void const * ptr) {
     size_t const len = strlen(ptr);
@@ -285,84 +337,435 @@ static bool str_equal(void const * a, void const * b) {
     return strcmp(a, b) == 0;
 }
 static size_t str_hash(void const * key) {
-    if (!key) return 0;
-    unsigned char const * s = key;
-    size_t hash = 5381;
-    int c;
-    while ((c = *s++))
-        hash = ((hash << 5) + hash) + c;
-    return hash;
+    return hash_string(key);
 }
-// Map of type <char*, bool*>
-static void begin_scope(resolver_t const * p_resolver) {
-    map_config_t const charptr_bool_cfg = {
-        .value_copy = bool_copy,
-        .value_free = free,
+// Map of type <char*, local_t>, locals stored inline
+static void begin_scope(resolver_t const * p_resolver, bool const has_environment) {
+    map_config_t const charptr_local_cfg = {
         .key_copy = str_copy,
         .key_free = free,
         .key_equals = str_equal,
         .key_hash = str_hash,
         .key_size = sizeof(char*),
-        .value_size = sizeof(bool),
+        .value_size = sizeof(local_t),
     };
-    if (!stack_push(p_resolver->scopes,
-        map_create(1, &charptr_bool_cfg)))
+    scope_t * scope = malloc(sizeof(scope_t));
+    if (!scope) exit(EXIT_FAILURE);
+    scope->names = map_create(1, &charptr_local_cfg);
+    scope->slot_count = 0;
+    scope->has_environment = has_environment;
+    if (!stack_push(p_resolver->scopes, scope))
         exit(EXIT_FAILURE);
 }
 
-static void end_scope(resolver_t const * p_resolver) {
+static void end_scope(resolver_t * p_resolver) {
     if (!stack_is_empty(p_resolver->scopes)) {
-        map_t * scope = stack_pop(p_resolver->scopes);
-        map_destroy(scope);
+        scope_t * scope = stack_pop(p_resolver->scopes);
+        // slots of this scope are free for the next sibling scope
+        p_resolver->local_count -= scope->slot_count;
+        map_destroy(scope->names);
+        free(scope);
     } else {
         exit(EXIT_FAILURE);
     }
 }
 
-static bool * new_bool(bool const v) {
-    bool * p = malloc(sizeof(bool));
-    if (!p) return NULL;
-    *p = v;
-    return p;
+// Only direct children matter, nested blocks get their own scope.
+static bool block_has_declarations(stmt_block_t const * p_block) {
+    for (size_t i = 0; i < p_block->count; i++) {
+        switch (p_block->statements[i]->type) {
+            case STMT_VAR:
+            case STMT_FUNCTION:
+            case STMT_CLASS:
+                return true;
+            default:
+                break;
+        }
+    }
+    return false;
 }
-static void declare(resolver_t const * p_resolver, char const * p_name) {
-    if (stack_is_empty(p_resolver->scopes)) return;
-    map_t * scope = stack_peek(p_resolver->scopes);
-    if (map_contains(scope, p_name)) {
+static bool block_has_captured_declarations(stmt_block_t const * p_block) {
+    for (size_t i = 0; i < p_block->count; i++) {
+        switch (p_block->statements[i]->type) {
+            case STMT_VAR:
+                if (p_block->statements[i]->as.var_stmt.captured) return true;
+                break;
+            case STMT_FUNCTION:
+            case STMT_CLASS:
+                // callables are bound in an environment until calls exist
+                return true;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+// Returns the frame slot given to the name, -1 for globals and captured names.
+static int declare(resolver_t * p_resolver, char const * p_name, size_t const hash, bool const captured) {
+    if (stack_is_empty(p_resolver->scopes)) return -1;
+    scope_t * scope = stack_peek(p_resolver->scopes);
+    if (map_contains_hashed(scope->names, p_name, hash)) {
         fprintf(stderr, "Resolver error: variable already declared in this scope");
         exit(EXIT_FAILURE);
     }
-    bool constexpr defined = false;
-    map_put(scope, p_name, &defined);
-
+    local_t local = { .defined = false, .slot = -1 };
+    if (!captured) {
+        local.slot = p_resolver->local_count++;
+        scope->slot_count++;
+    }
+    map_put_hashed(scope->names, p_name, hash, &local);
+    return local.slot;
 }
-static void define(resolver_t const * p_resolver, char const * p_name) {
+static void define(resolver_t const * p_resolver, char const * p_name, size_t const hash) {
     if (stack_is_empty(p_resolver->scopes)) return;
-    map_t * scope = stack_peek(p_resolver->scopes);
-    if (!map_contains(scope, p_name)) return;
-
-    // bool * ret;
-    // if (!map_get(scope, p_name, (void**)&ret)) {
-    //     fprintf(stderr, "failed to get from map\n");
-    //     exit(EXIT_FAILURE);
-    // }
-
-    ////bool * p_old = ret;
-    //if (p_old) free(p_old);
-    bool constexpr defined = true;
-    map_put(scope, p_name, &defined);
+    scope_t const * scope = stack_peek(p_resolver->scopes);
+    local_t * local;
+    if (!map_get_hashed(scope->names, p_name, hash, (void**)&local)) return;
+    local->defined = true;
 }
 
-static int resolve_local(resolver_t const * p_resolver, expr_t * p_expr, char const * p_name) {
+/*
+ * Sets the slot (or global index) of a variable expression and returns its
+ * depth, counted in environments. Returns -1 for globals and for locals
+ * living in a slot. hash is the name's, from its token.
+ */
+static int resolve_local(resolver_t const * p_resolver, expr_t * p_expr, char const * p_name,
+    size_t const hash) {
+    int distance = 0;
     for (int i = (int)stack_size(p_resolver->scopes) - 1; i >= 0; i--) {
-        const map_t * scope = (map_t*)p_resolver->scopes->data[i];
-        if (map_contains(scope, p_name)) {
-            const int distance = (int)stack_size(p_resolver->scopes) - 1 - i;
-            if (p_expr->type == EXPR_VARIABLE)
-                p_expr->as.variable_expr.depth = distance;
+        scope_t const * scope = p_resolver->scopes->data[i];
+        local_t const * local = map_find_hashed(scope->names, p_name, hash);
+        if (local) {
+            int const depth = local->slot >= 0 ? -1 : distance;
+            if (p_expr->type == EXPR_VARIABLE) {
+                p_expr->as.variable_expr.slot = local->slot;
+                p_expr->as.variable_expr.depth = depth;
+            }
             //interpreter_resolve(p_resolver->interpreter, p_expr, distance);
-            return distance;
+            return depth;
         }
+        if (scope->has_environment) distance++;
+    }
+    if (p_expr->type == EXPR_VARIABLE) {
+        p_expr->as.variable_expr.slot = -1;
+        p_expr->as.variable_expr.global = interpreter_global_slot(p_resolver->interpreter, p_name, hash);
     }
     return -1;
-}
\ No newline at end of file
+}
+
+/*
+ * Escape analysis.
+ *
+ * Walks the tree once before resolution and marks every local declaration
+ * that is referenced from a function nested inside the one declaring it.
+ * Only those need an environment, everything else gets a frame slot.
+ */
+static void escape_begin_scope(escape_t const * p_escape) {
+    map_config_t const charptr_escape_cfg = {
+        .key_copy = str_copy,
+        .key_free = free,
+        .key_equals = str_equal,
+        .key_hash = str_hash,
+        .key_size = sizeof(char*),
+        .value_size = sizeof(escape_local_t),
+    };
+    if (!stack_push(p_escape->scopes, map_create(1, &charptr_escape_cfg)))
+        exit(EXIT_FAILURE);
+}
+static void escape_end_scope(escape_t const * p_escape) {
+    map_destroy(stack_pop(p_escape->scopes));
+}
+static void escape_declare(escape_t const * p_escape, char const * p_name, bool * p_captured) {
+    *p_captured = false;
+    if (stack_is_empty(p_escape->scopes)) return; // globals never need capturing
+    escape_local_t const local = {
+        .p_captured = p_captured,
+        .function_depth = p_escape->function_depth
+    };
+    map_put(stack_peek(p_escape->scopes), p_name, &local);
+}
+static void escape_reference(escape_t const * p_escape, char const * p_name) {
+    for (int i = (int)stack_size(p_escape->scopes) - 1; i >= 0; i--) {
+        escape_local_t * local;
+        if (map_get(p_escape->scopes->data[i], p_name, (void**)&local)) {
+            if (local->function_depth < p_escape->function_depth)
+                *local->p_captured = true;
+            return;
+        }
+    }
+}
+static void escape_function(escape_t * p_escape, stmt_function_t * p_function) {
+    if (!p_function->params_captured && p_function->params_count > 0) {
+        p_function->params_captured = calloc(p_function->params_count, sizeof(bool));
+        if (!p_function->params_captured) exit(EXIT_FAILURE);
+    }
+    p_escape->function_depth++;
+    escape_begin_scope(p_escape);
+    for (size_t i = 0; i < p_function->params_count; i++)
+        escape_declare(p_escape, p_function->params[i]->lexeme, &p_function->params_captured[i]);
+    escape_statements(p_escape, p_function->body, p_function->count);
+    escape_end_scope(p_escape);
+    p_escape->function_depth--;
+}
+static void escape_statements(escape_t * p_escape, stmt_t ** pp_stmts, size_t const count) {
+    for (size_t i = 0; i < count; i++)
+        escape_statement(p_escape, pp_stmts[i]);
+}
+static void escape_statement(escape_t * p_escape, stmt_t * p_stmt) {
+    if (!p_stmt) return;
+    switch (p_stmt->type) {
+        case STMT_BLOCK:
+            escape_begin_scope(p_escape);
+            escape_statements(p_escape, p_stmt->as.block_stmt.statements,
+                p_stmt->as.block_stmt.count);
+            escape_end_scope(p_escape);
+            break;
+        case STMT_FUNCTION:
+            // functions and classes stay in environments, no flag to set
+            escape_function(p_escape, &p_stmt->as.function_stmt);
+            break;
+        case STMT_CLASS:
+            for (size_t i = 0; i < p_stmt->as.class_stmt.superclass_count; i++)
+                escape_expression(p_escape, p_stmt->as.class_stmt.superclass[i]);
+            for (size_t i = 0; i < p_stmt->as.class_stmt.methods_count; i++)
+                escape_function(p_escape, &p_stmt->as.class_stmt.methods[i]->as.function_stmt);
+            break;
+        case STMT_EXPRESSION:
+            escape_expression(p_escape, p_stmt->as.expression_stmt.expression);
+            break;
+        case STMT_IF:
+            escape_expression(p_escape, p_stmt->as.if_stmt.condition);
+            escape_statement(p_escape, p_stmt->as.if_stmt.then_branch);
+            escape_statement(p_escape, p_stmt->as.if_stmt.else_branch);
+            break;
+        case STMT_PRINT:
+            escape_expression(p_escape, p_stmt->as.print_stmt.expression);
+            break;
+        case STMT_RETURN:
+            escape_expression(p_escape, p_stmt->as.return_stmt.value);
+            break;
+        case STMT_VAR:
+            escape_declare(p_escape, p_stmt->as.var_stmt.name->lexeme,
+                &p_stmt->as.var_stmt.captured);
+            escape_expression(p_escape, p_stmt->as.var_stmt.initializer);
+            break;
+        case STMT_WHILE:
+            escape_expression(p_escape, p_stmt->as.while_stmt.condition);
+            escape_statement(p_escape, p_stmt->as.while_stmt.body);
+            break;
+    }
+}
+static void escape_expression(escape_t * p_escape, expr_t const * p_expr) {
+    if (!p_expr) return;
+    switch (p_expr->type) {
+        case EXPR_ASSIGN:
+            escape_expression(p_escape, p_expr->as.assign_expr.value);
+            escape_expression(p_escape, p_expr->as.assign_expr.target);
+            break;
+        case EXPR_BINARY:
+            escape_expression(p_escape, p_expr->as.binary_expr.left);
+            escape_expression(p_escape, p_expr->as.binary_expr.right);
+            break;
+        case EXPR_CALL:
+            escape_expression(p_escape, p_expr->as.call_expr.callee);
+            for (size_t i = 0; i < p_expr->as.call_expr.count; i++)
+                escape_expression(p_escape, p_expr->as.call_expr.arguments[i]);
+            break;
+        case EXPR_GET:
+            escape_expression(p_escape, p_expr->as.get_expr.object);
+            break;
+        case EXPR_GROUPING:
+            escape_expression(p_escape, p_expr->as.grouping_expr.expression);
+            break;
+        case EXPR_LOGICAL:
+            escape_expression(p_escape, p_expr->as.logical_expr.left);
+            escape_expression(p_escape, p_expr->as.logical_expr.right);
+            break;
+        case EXPR_SET:
+            escape_expression(p_escape, p_expr->as.set_expr.object);
+            escape_expression(p_escape, p_expr->as.set_expr.value);
+            break;
+        case EXPR_UNARY:
+            escape_expression(p_escape, p_expr->as.unary_expr.right);
+            break;
+        case EXPR_VARIABLE:
+            escape_reference(p_escape, p_expr->as.variable_expr.name->lexeme);
+            break;
+        case EXPR_LITERAL:
+        case EXPR_SUPER:
+        case EXPR_THIS:
+            break;
+    }
+}
+
+/*
+ * Ownership analysis.
+ *
+ * Decides for every variable read and assignment whether the interpreter
+ * counts a reference to its value, so a value that is only looked at costs
+ * no obj_inc_ref/obj_dec_ref pair:
+ *
+ *   owned     the value gets stored or outlives the expression, so the read
+ *             takes a reference of its own (value_dup) for the consumer
+ *   borrowed  the consumer only looks at it (print, an operand of +, a
+ *             statement's discarded result) before anything can assign to
+ *             the variable, no reference is taken and none is dropped
+ *   moved     the x in x = x + e, when e neither reads nor assigns x: the
+ *             old value is dead once the assignment lands, so the read takes
+ *             over x's reference and a string only x held is appended to in
+ *             place (obj_concat_unique)
+ *
+ * Anything not marked stays owned, which is always safe.
+ */
+// Assigns, or may once calls and setters run
+static bool has_effects(expr_t const * p_expr) {
+    if (!p_expr) return false;
+    switch (p_expr->type) {
+        case EXPR_ASSIGN:
+        case EXPR_CALL:
+        case EXPR_SET:
+            return true;
+        case EXPR_BINARY:
+            return has_effects(p_expr->as.binary_expr.left) || has_effects(p_expr->as.binary_expr.right);
+        case EXPR_LOGICAL:
+            return has_effects(p_expr->as.logical_expr.left) || has_effects(p_expr->as.logical_expr.right);
+        case EXPR_GROUPING:
+            return has_effects(p_expr->as.grouping_expr.expression);
+        case EXPR_UNARY:
+            return has_effects(p_expr->as.unary_expr.right);
+        case EXPR_GET:
+            return has_effects(p_expr->as.get_expr.object);
+        default:
+            return false;
+    }
+}
+static bool reads_name(expr_t const * p_expr, char const * p_name) {
+    if (!p_expr) return false;
+    switch (p_expr->type) {
+        case EXPR_VARIABLE:
+            return strcmp(p_expr->as.variable_expr.name->lexeme, p_name) == 0;
+        case EXPR_ASSIGN:
+            return reads_name(p_expr->as.assign_expr.value, p_name);
+        case EXPR_BINARY:
+            return reads_name(p_expr->as.binary_expr.left, p_name) ||
+                reads_name(p_expr->as.binary_expr.right, p_name);
+        case EXPR_LOGICAL:
+            return reads_name(p_expr->as.logical_expr.left, p_name) ||
+                reads_name(p_expr->as.logical_expr.right, p_name);
+        case EXPR_GROUPING:
+            return reads_name(p_expr->as.grouping_expr.expression, p_name);
+        case EXPR_UNARY:
+            return reads_name(p_expr->as.unary_expr.right, p_name);
+        case EXPR_GET:
+            return reads_name(p_expr->as.get_expr.object, p_name);
+        case EXPR_CALL:
+        case EXPR_SET:
+            return true;
+        default:
+            return false;
+    }
+}
+static void own_function(stmt_function_t const * p_function) {
+    own_statements(p_function->body, p_function->count);
+}
+static void own_statements(stmt_t ** pp_stmts, size_t const count) {
+    for (size_t i = 0; i < count; i++)
+        own_statement(pp_stmts[i]);
+}
+static void own_statement(stmt_t * p_stmt) {
+    if (!p_stmt) return;
+    switch (p_stmt->type) {
+        case STMT_BLOCK:
+            own_statements(p_stmt->as.block_stmt.statements, p_stmt->as.block_stmt.count);
+            break;
+        case STMT_FUNCTION:
+            own_function(&p_stmt->as.function_stmt);
+            break;
+        case STMT_CLASS:
+            for (size_t i = 0; i < p_stmt->as.class_stmt.superclass_count; i++)
+                own_expression(p_stmt->as.class_stmt.superclass[i], false);
+            for (size_t i = 0; i < p_stmt->as.class_stmt.methods_count; i++)
+                own_function(&p_stmt->as.class_stmt.methods[i]->as.function_stmt);
+            break;
+        case STMT_EXPRESSION:
+            own_expression(p_stmt->as.expression_stmt.expression, true);
+            break;
+        case STMT_IF:
+            own_expression(p_stmt->as.if_stmt.condition, true);
+            own_statement(p_stmt->as.if_stmt.then_branch);
+            own_statement(p_stmt->as.if_stmt.else_branch);
+            break;
+        case STMT_PRINT:
+            own_expression(p_stmt->as.print_stmt.expression, true);
+            break;
+        case STMT_RETURN:
+            own_expression(p_stmt->as.return_stmt.value, false);
+            break;
+        case STMT_VAR:
+            own_expression(p_stmt->as.var_stmt.initializer, false);
+            break;
+        case STMT_WHILE:
+            own_expression(p_stmt->as.while_stmt.condition, true);
+            own_statement(p_stmt->as.while_stmt.body);
+            break;
+    }
+}
+/*
+ * borrowed: the consumer of p_expr's value only looks at it right away.
+ */
+static void own_expression(expr_t * p_expr, bool const borrowed) {
+    if (!p_expr) return;
+    switch (p_expr->type) {
+        case EXPR_ASSIGN:
+            expr_assign_t * p_assign = &p_expr->as.assign_expr;
+            p_assign->borrowed = borrowed;
+            own_expression(p_assign->value, false);
+            if (p_assign->target->type != EXPR_VARIABLE || p_assign->value->type != EXPR_BINARY)
+                break;
+            expr_binary_t const * p_binary = &p_assign->value->as.binary_expr;
+            char const * p_name = p_assign->target->as.variable_expr.name->lexeme;
+            if (p_binary->operator->type == PLUS && p_binary->left->type == EXPR_VARIABLE &&
+                strcmp(p_binary->left->as.variable_expr.name->lexeme, p_name) == 0 &&
+                !reads_name(p_binary->right, p_name) && !has_effects(p_binary->right)) {
+                p_binary->left->as.variable_expr.borrowed = false;
+                p_binary->left->as.variable_expr.moved = true;
+            }
+            break;
+        case EXPR_BINARY:
+            // + copies what it keeps, so both operands are only looked at,
+            // the left one as long as evaluating the right one cannot assign
+            own_expression(p_expr->as.binary_expr.left, !has_effects(p_expr->as.binary_expr.right));
+            own_expression(p_expr->as.binary_expr.right, true);
+            break;
+        case EXPR_VARIABLE:
+            p_expr->as.variable_expr.borrowed = borrowed;
+            p_expr->as.variable_expr.moved = false;
+            break;
+        case EXPR_CALL:
+            own_expression(p_expr->as.call_expr.callee, false);
+            for (size_t i = 0; i < p_expr->as.call_expr.count; i++)
+                own_expression(p_expr->as.call_expr.arguments[i], false);
+            break;
+        case EXPR_GET:
+            own_expression(p_expr->as.get_expr.object, false);
+            break;
+        case EXPR_GROUPING:
+            own_expression(p_expr->as.grouping_expr.expression, false);
+            break;
+        case EXPR_LOGICAL:
+            own_expression(p_expr->as.logical_expr.left, false);
+            own_expression(p_expr->as.logical_expr.right, false);
+            break;
+        case EXPR_SET:
+            own_expression(p_expr->as.set_expr.object, false);
+            own_expression(p_expr->as.set_expr.value, false);
+            break;
+        case EXPR_UNARY:
+            own_expression(p_expr->as.unary_expr.right, false);
+            break;
+        case EXPR_LITERAL:
+        case EXPR_SUPER:
+        case EXPR_THIS:
+            break;
+    }
+}
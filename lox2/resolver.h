@@ -25,7 +25,8 @@ typedef enum {
 
 typedef struct {
     interpreter_t * interpreter;
-    stack_t * scopes; // Stack<map_t*>
+    stack_t * scopes; // Stack<scope_t*>
+    int local_count; // frame slots in use by the function being resolved
 
     function_type_t current_function;
     class_type_t current_class;
@@ -38,12 +38,16 @@ typedef enum {
 typedef struct {
 	 stmt_t ** statements;
 	 size_t count;
+	 bool needs_environment;
+	 int first_slot;
+	 int slot_count;
 } stmt_block_t;
 
 typedef struct {
 	 token_t * name;
 	 token_t ** params;
 	 size_t params_count;
+	 bool * params_captured;
 	 stmt_t ** body;
 	 size_t count;
 } stmt_function_t;
@@ -78,6 +82,9 @@ typedef struct {
 typedef struct {
 	 token_t * name;
 	 expr_t * initializer;
+	 int slot;
+	 bool captured;
+	 int global;
 } stmt_var_t;
 
 typedef struct {
@@ -0,0 +1,140 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+/*
+ * bench_cmap: multithreaded throughput of the concurrent map against map2
+ * behind one mutex, the obvious way to share a map today.
+ *
+ * KEYS identifier keys are inserted up front, then each thread runs OPS
+ * operations on random keys: a lookup, or with the given write share a
+ * put that overwrites the value. Reported is the total Mops/s over all
+ * threads, best of BENCH_REPEATS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include "map/map2.h"
+#include "utils/concurrent_map.h"
+#include "utils/hash.h"
+
+#define BENCH_REPEATS 3
+#define KEYS 4096
+#define OPS (1 << 20)
+#define MAX_THREADS 8
+
+static char g_keys[KEYS][16];
+
+static size_t str_hash(void const * key) {
+    return hash_string(key);
+}
+static bool str_equals(void const * a, void const * b) {
+    return strcmp(a, b) == 0;
+}
+static void * str_copy(void const * p) {
+    size_t const len = strlen(p) + 1;
+    char * copy = malloc(len);
+    if (!copy) exit(EXIT_FAILURE);
+    memcpy(copy, p, len);
+    return copy;
+}
+
+typedef struct {
+    cmap_t * cmap;      // either this
+    hashmap_t * map2;   // or this behind lock
+    mtx_t * lock;
+    unsigned writes_per_1024;
+    unsigned seed;
+} worker_t;
+
+static inline unsigned next_random(unsigned * state) {
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int run_worker(void * arg) {
+    worker_t * w = arg;
+    unsigned state = w->seed;
+    size_t found = 0;
+    for (size_t i = 0; i < OPS; i++) {
+        unsigned const r = next_random(&state);
+        char const * key = g_keys[r % KEYS];
+        bool const write = (r >> 22) % 1024 < w->writes_per_1024;
+        void * value = (void *)(uintptr_t)(i + 1);
+        if (w->cmap) {
+            if (write) cmap_put(w->cmap, key, value);
+            else found += cmap_get(w->cmap, key) != NULL;
+        } else {
+            mtx_lock(w->lock);
+            if (write) map_upsert(w->map2, key, &value);
+            else found += map_find(w->map2, key) != NULL;
+            mtx_unlock(w->lock);
+        }
+    }
+    if (found == SIZE_MAX) printf("unreachable\n");  // keeps the lookups alive
+    return 0;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static double measure(bool const concurrent, int const threads, unsigned const writes_per_1024) {
+    cmap_config_t const cmap_cfg = { str_hash, str_equals, str_copy, free };
+    map_config_t const map2_cfg = { .key_size = sizeof(char *), .key_hash = str_hash,
+        .key_equals = str_equals, .key_copy = str_copy, .key_free = free,
+        .value_size = sizeof(void *) };
+    double best = 0;
+    for (int rep = 0; rep < BENCH_REPEATS; rep++) {
+        cmap_t * cmap = concurrent ? cmap_create(KEYS, &cmap_cfg) : NULL;
+        hashmap_t * map2 = concurrent ? NULL : map_create(KEYS, &map2_cfg);
+        mtx_t lock;
+        mtx_init(&lock, mtx_plain);
+        for (size_t i = 0; i < KEYS; i++) {
+            void * value = (void *)(uintptr_t)(i + 1);
+            if (cmap) cmap_put(cmap, g_keys[i], value);
+            else map_upsert(map2, g_keys[i], &value);
+        }
+
+        thrd_t ids[MAX_THREADS];
+        worker_t workers[MAX_THREADS];
+        double const t0 = now_s();
+        for (int t = 0; t < threads; t++) {
+            workers[t] = (worker_t){ cmap, map2, &lock, writes_per_1024, 2463534242u + (unsigned)t * 7919u };
+            if (thrd_create(&ids[t], run_worker, &workers[t]) != thrd_success) exit(EXIT_FAILURE);
+        }
+        for (int t = 0; t < threads; t++) thrd_join(ids[t], NULL);
+        double const mops = (double)OPS * threads / (now_s() - t0) / 1e6;
+        if (mops > best) best = mops;
+
+        cmap_destroy(cmap);
+        map_destroy(map2);
+        mtx_destroy(&lock);
+    }
+    return best;
+}
+
+int main(void) {
+    for (size_t i = 0; i < KEYS; i++) snprintf(g_keys[i], sizeof(g_keys[i]), "name_%zu", i);
+    unsigned const write_shares[] = { 0, 10, 102 };  // 0%, 1%, 10%
+    int const thread_counts[] = { 1, 2, 4, 8 };
+
+    printf("%-8s %7s %12s %12s\n", "threads", "writes", "cmap Mops/s", "map2+mutex");
+    for (size_t w = 0; w < sizeof(write_shares) / sizeof(write_shares[0]); w++) {
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+            double const c = measure(true, thread_counts[t], write_shares[w]);
+            double const m = measure(false, thread_counts[t], write_shares[w]);
+            printf("%-8d %6.0f%% %12.1f %12.1f\n", thread_counts[t],
+                write_shares[w] * 100.0 / 1024, c, m);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+/*
+ * bench_gc: full collections of one heap with 0 to MAX_HELPERS helper
+ * threads, to see marking and sweeping scale with cores.
+ *
+ * The heap is ROOTS rooted chains of ropes over distinct pieces, about
+ * 1.3M objects, rebuilt with as much garbage before every collection so
+ * the sweep has something to free. Reported is the best of BENCH_REPEATS
+ * gc_collect calls, which wait for the background sweep to finish.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gc.h"
+#include "object.h"
+
+#define BENCH_REPEATS 3
+#define ROOTS 2048
+#define CHAIN 160  // pieces per chain
+#define MAX_HELPERS 8
+
+static value_t g_roots[ROOTS];
+
+static void mark_roots(void * context) {
+    (void)context;
+    for (size_t i = 0; i < ROOTS; i++) gc_mark_value(&g_roots[i]);
+}
+
+// Rooted chains, then the same number of unrooted ones
+static void build(unsigned const round) {
+    char piece[41];
+    for (size_t i = 0; i < 2 * ROOTS; i++) {
+        object_t * chain = NULL;
+        for (size_t j = 0; j < CHAIN; j++) {
+            snprintf(piece, sizeof(piece), "%-40zu", ((size_t)round * 2 * ROOTS + i) * CHAIN + j);
+            object_t * leaf = (object_t*)obj_string_new(piece);
+            chain = chain ? obj_concat(chain, leaf) : leaf;
+        }
+        if (i < ROOTS) g_roots[i] = value_object(chain);
+    }
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec * 1e-6;
+}
+
+int main(void) {
+    gc_add_roots(mark_roots, NULL);
+    gc_set_step_work(0);
+    size_t const helper_counts[] = { 0, 1, 2, 4, MAX_HELPERS };
+    unsigned round = 0;
+    double base = 0;
+
+    printf("%-8s %10s %9s %10s\n", "helpers", "objects", "ms", "speedup");
+    for (size_t h = 0; h < sizeof(helper_counts) / sizeof(helper_counts[0]); h++) {
+        gc_set_threads(helper_counts[h]);
+        double best = 1e30;
+        size_t objects = 0;
+        for (int rep = 0; rep < BENCH_REPEATS; rep++) {
+            build(round++);
+            objects = gc_stats().objects;
+            double const t0 = now_ms();
+            gc_collect();
+            double const t = now_ms() - t0;
+            if (t < best) best = t;
+        }
+        if (h == 0) base = best;
+        printf("%-8zu %10zu %9.2f %9.2fx\n", helper_counts[h], objects, best, base / best);
+    }
+    return 0;
+}
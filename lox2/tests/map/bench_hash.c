@@ -0,0 +1,203 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+/*
+ * bench_hash: hash_bytes against the byte-at-a-time hashes it replaced
+ * (djb2 from the environment and resolver configs, FNV-1a from the string
+ * object).
+ *
+ * Throughput: ns per hash and GB/s at several key lengths, best of
+ * BENCH_REPEATS.
+ *
+ * Quality, per key set (identifiers, numbered names, dense integers as
+ * text, random bytes):
+ *   buckets  chi-square of the low 12 bits over 4096 buckets, divided by
+ *            its expected value (1.00 is ideal, well above 1 means lumps)
+ *   full     keys sharing their whole 64 bit hash with an earlier key
+ *   aval     worst output bit bias when flipping one input bit, 0 is
+ *            ideal (each output bit flips half the time)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utils/hash.h"
+
+#define BENCH_REPEATS 5
+#define BENCH_BYTES (1 << 24)  // bytes hashed per length and repeat
+#define QUALITY_KEYS (1 << 16)
+#define QUALITY_BUCKETS 4096
+#define KEY_MAX 64
+
+static size_t djb2(void const * data, size_t const len) {
+    unsigned char const * p = data;
+    size_t hash = 5381;
+    for (size_t i = 0; i < len; i++) hash = ((hash << 5) + hash) + p[i];
+    return hash;
+}
+static size_t fnv1a(void const * data, size_t const len) {
+    unsigned char const * p = data;
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+static size_t wy(void const * data, size_t const len) {
+    return hash_bytes(data, len);
+}
+
+typedef struct {
+    char const * name;
+    size_t (*fn)(void const * data, size_t len);
+} hash_impl_t;
+
+static hash_impl_t const g_impls[] = {
+    { "djb2", djb2 },
+    { "fnv1a", fnv1a },
+    { "hash_bytes", wy },
+};
+#define IMPL_COUNT (sizeof(g_impls) / sizeof(g_impls[0]))
+
+static double now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+static uint64_t g_rng = 0x9e3779b97f4a7c15ULL;
+static uint64_t next_random(void) {
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 7;
+    g_rng ^= g_rng << 17;
+    return g_rng;
+}
+
+static void throughput(void) {
+    size_t const lengths[] = { 4, 8, 16, 32, 64, 256, 4096 };
+    unsigned char * buffer = malloc(4096 + 64);
+    if (!buffer) exit(EXIT_FAILURE);
+    for (size_t i = 0; i < 4096 + 64; i++) buffer[i] = (unsigned char)next_random();
+
+    printf("%-11s", "ns/hash");
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) printf(" %8zu", lengths[l]);
+    printf("   GB/s@4096\n");
+    for (size_t h = 0; h < IMPL_COUNT; h++) {
+        printf("%-11s", g_impls[h].name);
+        double gbs = 0;
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            size_t const len = lengths[l];
+            size_t const calls = BENCH_BYTES / len;
+            double best = 1e30;
+            size_t sink = 0;
+            for (int rep = 0; rep < BENCH_REPEATS; rep++) {
+                double const t0 = now_ns();
+                // vary the start so calls cannot be folded together
+                for (size_t i = 0; i < calls; i++) sink += g_impls[h].fn(buffer + (i & 63), len);
+                double const t = (now_ns() - t0) / (double)calls;
+                if (t < best) best = t;
+            }
+            if (sink == 42) printf("!");
+            printf(" %8.2f", best);
+            if (len == 4096) gbs = (double)len / best;
+        }
+        printf("   %9.2f\n", gbs);
+    }
+    free(buffer);
+}
+
+typedef enum { KEYS_IDENT, KEYS_NUMBERED, KEYS_DIGITS, KEYS_RANDOM } key_set_t;
+static char const * const g_key_set_names[] = { "ident", "numbered", "digits", "random" };
+
+// Writes key i of the set into out, returns its length
+static size_t make_key(key_set_t const set, size_t const i, unsigned char * out) {
+    static char const letters[] = "abcdefghijklmnopqrstuvwxyz_";
+    switch (set) {
+        case KEYS_IDENT: {
+            // short lowercase names, like the identifiers of a program
+            size_t n = i, len = 0;
+            do {
+                out[len++] = (unsigned char)letters[n % 27];
+                n /= 27;
+            } while (n);
+            return len;
+        }
+        case KEYS_NUMBERED:
+            return (size_t)snprintf((char *)out, KEY_MAX, "name_%zu", i);
+        case KEYS_DIGITS:
+            return (size_t)snprintf((char *)out, KEY_MAX, "%zu", i);
+        case KEYS_RANDOM:
+        default: {
+            size_t const len = 8 + next_random() % 24;
+            for (size_t j = 0; j < len; j++) out[j] = (unsigned char)next_random();
+            return len;
+        }
+    }
+}
+
+static int compare_size(void const * a, void const * b) {
+    size_t const x = *(size_t const *)a, y = *(size_t const *)b;
+    return (x > y) - (x < y);
+}
+
+static void quality(void) {
+    size_t * hashes = malloc(QUALITY_KEYS * sizeof(size_t));
+    size_t * buckets = malloc(QUALITY_BUCKETS * sizeof(size_t));
+    if (!hashes || !buckets) exit(EXIT_FAILURE);
+    unsigned char key[KEY_MAX];
+
+    printf("\n%-11s %-9s %8s %6s %6s\n", "quality", "keys", "buckets", "full", "aval");
+    for (size_t h = 0; h < IMPL_COUNT; h++) {
+        for (key_set_t set = KEYS_IDENT; set <= KEYS_RANDOM; set++) {
+            g_rng = 0x9e3779b97f4a7c15ULL;
+            memset(buckets, 0, QUALITY_BUCKETS * sizeof(size_t));
+            for (size_t i = 0; i < QUALITY_KEYS; i++) {
+                size_t const len = make_key(set, i, key);
+                hashes[i] = g_impls[h].fn(key, len);
+                buckets[hashes[i] & (QUALITY_BUCKETS - 1)]++;
+            }
+            double const expected = (double)QUALITY_KEYS / QUALITY_BUCKETS;
+            double chi = 0;
+            for (size_t b = 0; b < QUALITY_BUCKETS; b++)
+                chi += (buckets[b] - expected) * (buckets[b] - expected) / expected;
+
+            qsort(hashes, QUALITY_KEYS, sizeof(size_t), compare_size);
+            size_t full = 0;
+            for (size_t i = 1; i < QUALITY_KEYS; i++) full += hashes[i] == hashes[i - 1];
+
+            // avalanche over the first 1024 keys of the set
+            size_t flips[64] = {0};
+            size_t trials = 0;
+            g_rng = 0x9e3779b97f4a7c15ULL;
+            for (size_t i = 0; i < 1024; i++) {
+                size_t const len = make_key(set, i, key);
+                size_t const base = g_impls[h].fn(key, len);
+                for (size_t bit = 0; bit < len * 8; bit++) {
+                    key[bit / 8] ^= (unsigned char)(1u << bit % 8);
+                    size_t const diff = base ^ g_impls[h].fn(key, len);
+                    key[bit / 8] ^= (unsigned char)(1u << bit % 8);
+                    for (size_t o = 0; o < sizeof(size_t) * 8; o++) flips[o] += diff >> o & 1;
+                    trials++;
+                }
+            }
+            double worst = 0;
+            for (size_t o = 0; o < sizeof(size_t) * 8; o++) {
+                double const bias = (double)flips[o] / (double)trials - 0.5;
+                if (bias > worst) worst = bias;
+                if (-bias > worst) worst = -bias;
+            }
+            printf("%-11s %-9s %8.2f %6zu %6.3f\n", g_impls[h].name, g_key_set_names[set],
+                chi / (QUALITY_BUCKETS - 1), full, worst);
+        }
+    }
+    free(buckets);
+    free(hashes);
+}
+
+int main(void) {
+    throughput();
+    quality();
+    return 0;
+}
@@ -0,0 +1,209 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+/*
+ * bench_map: runs the same workloads on every map in the tree and prints
+ * one row per map, key kind and size.
+ *
+ *   insert   ns per put, building the map from empty and destroying it
+ *   hit      ns per lookup of a present key
+ *   miss     ns per lookup of an absent key
+ *   iter     ns per entry for a full iteration
+ *   B/entry  live bytes held by the map after the build, per entry
+ *   alloc    allocations made during the build, per entry
+ *
+ * Maps are created the way the interpreter creates them (8 buckets or an
+ * expected count of 8), so the chained maps keep 8 buckets at every size.
+ * Times are the best of BENCH_REPEATS runs. Build with optimizations.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "bench_map.h"
+
+#define BENCH_REPEATS 5
+#define BENCH_LOOKUPS (1 << 16)
+#define BENCH_KEY_LEN 32
+#define BENCH_NODE_SIZE 48  // about an expr_t
+
+alloc_stats_t g_alloc_stats = {0};
+
+// Counting allocator, a header in front of each block keeps its size
+typedef union {
+    size_t size;
+    max_align_t align;
+} alloc_header_t;
+
+void * bench_malloc(size_t const size) {
+    alloc_header_t * h = malloc(sizeof(alloc_header_t) + size);
+    if (!h) exit(EXIT_FAILURE);
+    h->size = size;
+    g_alloc_stats.allocations++;
+    g_alloc_stats.live_bytes += size;
+    return h + 1;
+}
+void * bench_calloc(size_t const count, size_t const size) {
+    void * p = bench_malloc(count * size);
+    memset(p, 0, count * size);
+    return p;
+}
+void * bench_realloc(void * p, size_t const size) {
+    if (!p) return bench_malloc(size);
+    alloc_header_t * h = (alloc_header_t *)p - 1;
+    size_t const old_size = h->size;
+    h = realloc(h, sizeof(alloc_header_t) + size);
+    if (!h) exit(EXIT_FAILURE);
+    h->size = size;
+    g_alloc_stats.allocations++;
+    g_alloc_stats.live_bytes = g_alloc_stats.live_bytes - old_size + size;
+    return h + 1;
+}
+void bench_free(void * p) {
+    if (!p) return;
+    alloc_header_t * h = (alloc_header_t *)p - 1;
+    g_alloc_stats.live_bytes -= h->size;
+    free(h);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+typedef struct {
+    key_kind_t kind;
+    size_t count;
+    void const ** keys;         // stored keys
+    void const ** lookup_keys;  // equal to keys but separate objects, like a token's lexeme
+    void const ** miss_keys;
+    void * storage;             // backing memory for the keys
+} key_set_t;
+
+static key_set_t make_keys(key_kind_t const kind, size_t const count) {
+    key_set_t set = { .kind = kind, .count = count };
+    set.keys = malloc(3 * count * sizeof(void *));
+    if (!set.keys) exit(EXIT_FAILURE);
+    set.lookup_keys = set.keys + count;
+    set.miss_keys = set.keys + 2 * count;
+    size_t const item = kind == KEYS_STRING ? BENCH_KEY_LEN : BENCH_NODE_SIZE;
+    unsigned char * storage = malloc(3 * count * item);
+    if (!storage) exit(EXIT_FAILURE);
+    set.storage = storage;
+    for (size_t i = 0; i < count; i++) {
+        unsigned char * key = storage + i * item;
+        unsigned char * lookup = storage + (count + i) * item;
+        unsigned char * miss = storage + (2 * count + i) * item;
+        if (kind == KEYS_STRING) {
+            snprintf((char *)key, BENCH_KEY_LEN, "name_%zu", i);
+            snprintf((char *)lookup, BENCH_KEY_LEN, "name_%zu", i);
+            snprintf((char *)miss, BENCH_KEY_LEN, "miss_%zu", i);
+            set.lookup_keys[i] = lookup;
+        } else {
+            // a pointer key is only equal to itself
+            set.lookup_keys[i] = key;
+        }
+        set.keys[i] = key;
+        set.miss_keys[i] = miss;
+    }
+    return set;
+}
+static void free_keys(key_set_t const * set) {
+    free(set->storage);
+    free(set->keys);
+}
+
+// Values are the key's index + 1 so a lookup can be checked
+static void * value_for(size_t const i) {
+    return (void *)(uintptr_t)(i + 1);
+}
+static void * build(bench_map_impl_t const * impl, key_set_t const * set) {
+    void * map = impl->create(set->kind);
+    for (size_t i = 0; i < set->count; i++) impl->put(map, set->keys[i], value_for(i));
+    return map;
+}
+
+typedef struct {
+    double insert, hit, miss, iter;
+    double bytes_per_entry, allocs_per_entry;
+} bench_result_t;
+
+static bench_result_t run(bench_map_impl_t const * impl, key_set_t const * set) {
+    bench_result_t r = { 1e30, 1e30, 1e30, 1e30, 0, 0 };
+    size_t const n = set->count;
+    alloc_stats_t const before = g_alloc_stats;
+    void * map = build(impl, set);
+    r.bytes_per_entry = (double)(g_alloc_stats.live_bytes - before.live_bytes) / (double)n;
+    r.allocs_per_entry = (double)(g_alloc_stats.allocations - before.allocations) / (double)n;
+
+    // small maps are built and walked many times over so the clock can resolve them
+    size_t const rounds = BENCH_LOOKUPS / n + 1;
+    for (int rep = 0; rep < BENCH_REPEATS; rep++) {
+        double t0 = now_ns();
+        for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+            size_t const k = i % n;
+            if (impl->get(map, set->lookup_keys[k]) != value_for(k)) {
+                fprintf(stderr, "%s: lookup of key %zu failed\n", impl->name, k);
+                exit(EXIT_FAILURE);
+            }
+        }
+        double t = (now_ns() - t0) / BENCH_LOOKUPS;
+        if (t < r.hit) r.hit = t;
+
+        t0 = now_ns();
+        for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+            if (impl->get(map, set->miss_keys[i % n])) {
+                fprintf(stderr, "%s: absent key %zu found\n", impl->name, i % n);
+                exit(EXIT_FAILURE);
+            }
+        }
+        t = (now_ns() - t0) / BENCH_LOOKUPS;
+        if (t < r.miss) r.miss = t;
+
+        t0 = now_ns();
+        for (size_t i = 0; i < rounds; i++) {
+            if (impl->iterate(map) != n) {
+                fprintf(stderr, "%s: iteration missed entries\n", impl->name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        t = (now_ns() - t0) / (double)(rounds * n);
+        if (t < r.iter) r.iter = t;
+    }
+    impl->destroy(map);
+
+    for (int rep = 0; rep < BENCH_REPEATS; rep++) {
+        double const t0 = now_ns();
+        for (size_t i = 0; i < rounds; i++) impl->destroy(build(impl, set));
+        double const t = (now_ns() - t0) / (double)(rounds * n);
+        if (t < r.insert) r.insert = t;
+    }
+    return r;
+}
+
+int main(void) {
+    bench_map_impl_t const * impls[] = {
+        &bench_map_v1, &bench_map_utils, &bench_map_map2, &bench_map_template,
+    };
+    size_t const sizes[] = { 4, 8, 64, 1024, 8192 };
+    key_kind_t const kinds[] = { KEYS_STRING, KEYS_POINTER };
+
+    printf("%-9s %-7s %6s %9s %9s %9s %9s %8s %6s\n",
+        "map", "keys", "n", "insert", "hit", "miss", "iter", "B/entry", "alloc");
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            key_set_t const set = make_keys(kinds[k], sizes[s]);
+            for (size_t m = 0; m < sizeof(impls) / sizeof(impls[0]); m++) {
+                bench_result_t const r = run(impls[m], &set);
+                printf("%-9s %-7s %6zu %9.1f %9.1f %9.1f %9.2f %8.1f %6.2f\n",
+                    impls[m]->name, kinds[k] == KEYS_STRING ? "string" : "pointer",
+                    set.count, r.insert, r.hit, r.miss, r.iter,
+                    r.bytes_per_entry, r.allocs_per_entry);
+            }
+            free_keys(&set);
+        }
+        printf("\n");
+    }
+    return 0;
+}
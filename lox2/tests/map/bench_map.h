@@ -0,0 +1,75 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#ifndef LOX_BENCH_MAP_H
+#define LOX_BENCH_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Shared pieces of the bench_map target.
+ *
+ * Every map is wrapped in a bench_map_impl_t by its own bench_map_<name>.c,
+ * which includes the map's .c file directly. The maps all export map_create,
+ * map_put, ... so the adapters rename those with #define before the include,
+ * and route malloc/calloc/realloc/free to the counting versions below so
+ * allocations and live bytes can be reported per entry.
+ */
+
+typedef struct {
+    size_t allocations;  // malloc, calloc and realloc calls
+    size_t live_bytes;
+} alloc_stats_t;
+
+extern alloc_stats_t g_alloc_stats;
+
+void * bench_malloc(size_t size);
+void * bench_calloc(size_t count, size_t size);
+void * bench_realloc(void * p, size_t size);
+void bench_free(void * p);
+
+typedef enum {
+    KEYS_STRING,   // short identifier names, copied by the map
+    KEYS_POINTER,  // node addresses like expr_t*, stored as is
+} key_kind_t;
+
+typedef struct {
+    char const * name;
+    void * (*create)(key_kind_t kind);
+    void (*destroy)(void * map);
+    void (*put)(void * map, void const * key, void * value);
+    void * (*get)(void * map, void const * key);  // NULL when missing
+    size_t (*iterate)(void * map);                // visits every entry, returns the count
+} bench_map_impl_t;
+
+extern bench_map_impl_t const bench_map_v1;
+extern bench_map_impl_t const bench_map_utils;
+extern bench_map_impl_t const bench_map_map2;
+extern bench_map_impl_t const bench_map_template;
+
+static inline size_t bench_hash_ptr(void const * p) {
+    uintptr_t const x = (uintptr_t)p;
+    return (size_t)(x ^ (x >> 4) ^ (x >> 16));
+}
+static inline bool bench_ptr_equals(void const * a, void const * b) {
+    return a == b;
+}
+static inline bool bench_str_equals(void const * a, void const * b) {
+    return strcmp(a, b) == 0;
+}
+static inline void * bench_identity(void const * p) {
+    return (void *)p;
+}
+static inline void * bench_str_copy(void const * p) {
+    size_t const len = strlen(p) + 1;
+    char * copy = bench_malloc(len);
+    memcpy(copy, p, len);
+    return copy;
+}
+
+#endif //LOX_BENCH_MAP_H
@@ -0,0 +1,61 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+// Swiss table from map2.c, inline values the way the interpreter uses it
+
+#include "bench_map.h"
+#include "utils/hash.h"
+#include "utils/slab.h"
+
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define realloc bench_realloc
+#define free bench_free
+// map2 takes its tables and map blocks from the slab, counted here at the
+// size of the block the slab would really hand out
+#define slab_alloc(size) bench_malloc(slab_block_size(size))
+#define slab_free(p, size) bench_free(p)
+#include "map2.c"
+
+static size_t str_hash(void const * key) {
+    return hash_string(key);
+}
+static void * map2_create(key_kind_t const kind) {
+    if (kind == KEYS_POINTER)
+        return map_create(8, &(map_config_t){ .key_size = sizeof(void *),
+            .key_hash = bench_hash_ptr, .key_equals = bench_ptr_equals,
+            .key_copy = bench_identity,
+            .value_size = sizeof(void *) });
+    return map_create(8, &(map_config_t){ .key_size = sizeof(char *),
+        .key_hash = str_hash, .key_equals = bench_str_equals,
+        .key_copy = bench_str_copy, .key_free = bench_free,
+        .value_size = sizeof(void *) });
+}
+static void map2_destroy(void * map) {
+    map_destroy(map);
+}
+static void map2_put(void * map, void const * key, void * value) {
+    map_upsert(map, key, &value);
+}
+static void * map2_get(void * map, void const * key) {
+    void ** p_value = map_find(map, key);
+    return p_value ? *p_value : NULL;
+}
+static size_t map2_iterate(void * map) {
+    size_t count = 0;
+    void ** p_value;
+    for (size_t i = 0; (p_value = map_next(map, &i));) {
+        if (*p_value) count++;
+    }
+    return count;
+}
+
+bench_map_impl_t const bench_map_map2 = {
+    .name = "map2",
+    .create = map2_create,
+    .destroy = map2_destroy,
+    .put = map2_put,
+    .get = map2_get,
+    .iterate = map2_iterate,
+};
@@ -0,0 +1,86 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+// DEFINE_MAP from utils/map_template.h, one instantiation per key kind
+
+#include "bench_map.h"
+#include "utils/hash.h"
+
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define realloc bench_realloc
+#define free bench_free
+#include "utils/map_template.h"
+
+#define STR_EQUALS(a, b) (strcmp((a), (b)) == 0)
+#define PTR_EQUALS(a, b) ((a) == (b))
+DEFINE_MAP(bench_str, char const *, void *, hash_string, STR_EQUALS)
+DEFINE_MAP(bench_ptr, void const *, void *, bench_hash_ptr, PTR_EQUALS)
+
+typedef struct {
+    key_kind_t kind;
+    union {
+        bench_str_t str;
+        bench_ptr_t ptr;
+    } as;
+} template_map_t;
+
+static void * template_create(key_kind_t const kind) {
+    template_map_t * map = malloc(sizeof(template_map_t));
+    if (!map) exit(EXIT_FAILURE);
+    memset(map, 0, sizeof(*map));
+    map->kind = kind;
+    return map;
+}
+static void template_destroy(void * p_map) {
+    template_map_t * map = p_map;
+    if (map->kind == KEYS_POINTER) {
+        bench_ptr_destroy(&map->as.ptr);
+    } else {
+        bench_str_entry_t * e;
+        for (size_t i = 0; (e = bench_str_next(&map->as.str, &i));) free((void *)e->key);
+        bench_str_destroy(&map->as.str);
+    }
+    free(map);
+}
+static void template_put(void * p_map, void const * key, void * value) {
+    template_map_t * map = p_map;
+    if (map->kind == KEYS_POINTER) {
+        bench_ptr_put(&map->as.ptr, key, value);
+        return;
+    }
+    // the map keeps the key as given, so only a new key gets an owned copy
+    size_t const hash = hash_string(key);
+    void ** p_value = bench_str_find_hashed(&map->as.str, key, hash);
+    if (!p_value) p_value = bench_str_emplace_hashed(&map->as.str, bench_str_copy(key), hash, NULL);
+    *p_value = value;
+}
+static void * template_get(void * p_map, void const * key) {
+    template_map_t * map = p_map;
+    void ** p_value = map->kind == KEYS_POINTER
+        ? bench_ptr_find(&map->as.ptr, key)
+        : bench_str_find(&map->as.str, key);
+    return p_value ? *p_value : NULL;
+}
+static size_t template_iterate(void * p_map) {
+    template_map_t * map = p_map;
+    size_t count = 0;
+    if (map->kind == KEYS_POINTER) {
+        bench_ptr_entry_t const * e;
+        for (size_t i = 0; (e = bench_ptr_next(&map->as.ptr, &i));) count += e->value != NULL;
+    } else {
+        bench_str_entry_t const * e;
+        for (size_t i = 0; (e = bench_str_next(&map->as.str, &i));) count += e->value != NULL;
+    }
+    return count;
+}
+
+bench_map_impl_t const bench_map_template = {
+    .name = "template",
+    .create = template_create,
+    .destroy = template_destroy,
+    .put = template_put,
+    .get = template_get,
+    .iterate = template_iterate,
+};
@@ -0,0 +1,89 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+// Chained map from lox2/utils/map.c
+
+#include "bench_map.h"
+
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define realloc bench_realloc
+#define free bench_free
+#define map_create utils_map_create
+#define map_default_config utils_map_default_config
+#define map_destroy utils_map_destroy
+#define map_put utils_map_put
+#define map_get utils_map_get
+#define map_remove utils_map_remove
+#define map_size utils_map_size
+#define map_contains utils_map_contains
+#define map_entry_key utils_map_entry_key
+#define map_entry_value utils_map_entry_value
+#define map_get_enumerator utils_map_get_enumerator
+#define map_enumerator_next utils_map_enumerator_next
+#define map_enumerator_current utils_map_enumerator_current
+#define map_enumerator_reset utils_map_enumerator_reset
+#define map_enumerator_destroy utils_map_enumerator_destroy
+#define map_entry_free utils_map_entry_free
+#include "../../utils/map.c"
+
+static void keep_value(void const ** value) {
+    (void)value;
+}
+static void free_key(void const ** key) {
+    free((void *)*key);
+    *key = NULL;
+}
+
+static void * utils_create(key_kind_t const kind) {
+    if (kind == KEYS_POINTER)
+        return utils_map_create(8, (map_config_t){ .hash = bench_hash_ptr,
+            .cmp = bench_ptr_equals, .kcopy = bench_identity, .vcopy = bench_identity,
+            .kfree = keep_value, .vfree = keep_value });
+    return utils_map_create(8, (map_config_t){ .vcopy = bench_identity,
+        .kfree = free_key, .vfree = keep_value });
+}
+// map_destroy only frees keys and values, not the entry nodes, so release
+// the chains here first
+static void utils_destroy(void * p_map) {
+    map_t * map = p_map;
+    for (size_t i = 0; i < map->num_buckets; i++) {
+        struct map_entry * entry = map->buckets[i];
+        while (entry) {
+            struct map_entry * next = entry->next;
+            free_map_entry(entry, map->kfree, map->vfree);
+            free(entry);
+            entry = next;
+        }
+        map->buckets[i] = NULL;
+    }
+    utils_map_destroy(map);
+}
+static void utils_put(void * map, void const * key, void * value) {
+    utils_map_put(map, key, value);
+}
+static void * utils_get(void * map, void const * key) {
+    return utils_map_get(map, key);
+}
+static size_t utils_iterate(void * map) {
+    size_t count = 0;
+    map_enumerator_t * it = utils_map_get_enumerator(map);
+    while (utils_map_enumerator_next(it)) {
+        map_entry_t const * entry = utils_map_enumerator_current(it);
+        if (utils_map_entry_value(entry)) count++;
+    }
+    // the enumerator's destroy is a no-op, it was malloc'ed
+    utils_map_enumerator_destroy(it);
+    free(it);
+    return count;
+}
+
+bench_map_impl_t const bench_map_utils = {
+    .name = "utils",
+    .create = utils_create,
+    .destroy = utils_destroy,
+    .put = utils_put,
+    .get = utils_get,
+    .iterate = utils_iterate,
+};
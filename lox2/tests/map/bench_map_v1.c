@@ -0,0 +1,92 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+// v1 map (extra/Map.c). It allocates through memory_allocate, a region that
+// is never freed, so the shim hands out counted blocks and remembers them;
+// destroying the map releases them all the way dropping the region would.
+
+#include "bench_map.h"
+
+#define memory_allocate v1_memory_allocate
+#define memory_reallocate v1_memory_reallocate
+#define map_create v1_map_create
+#define map_default_config v1_map_default_config
+#define map_destroy v1_map_destroy
+#define map_put v1_map_put
+#define map_get v1_map_get
+#define map_get_slot v1_map_get_slot
+#define map_remove v1_map_remove
+#define map_size v1_map_size
+#define map_contains v1_map_contains
+#define map_entry_key v1_map_entry_key
+#define map_entry_value v1_map_entry_value
+#define map_iterator v1_map_iterator
+#define map_iterator_next v1_map_iterator_next
+#define map_get_enumerator v1_map_get_enumerator
+#define map_enumerator_next v1_map_enumerator_next
+#define map_enumerator_current v1_map_enumerator_current
+#define map_enumerator_reset v1_map_enumerator_reset
+#define map_enumerator_destroy v1_map_enumerator_destroy
+#include "../../../extra/Map.c"
+
+static void ** g_blocks = NULL;
+static size_t g_blocks_count = 0;
+static size_t g_blocks_capacity = 0;
+
+void * v1_memory_allocate(size_t const size) {
+    if (size == 0) return NULL;
+    if (g_blocks_count == g_blocks_capacity) {
+        g_blocks_capacity = g_blocks_capacity ? g_blocks_capacity * 2 : 256;
+        g_blocks = realloc(g_blocks, g_blocks_capacity * sizeof(void *));
+        if (!g_blocks) exit(EXIT_FAILURE);
+    }
+    void * p = bench_malloc(size);
+    g_blocks[g_blocks_count++] = p;
+    return p;
+}
+
+// Like the region version: a fresh block, the old one stays until destroy
+void * v1_memory_reallocate(void * p, size_t const old_size, size_t const new_size) {
+    void * moved = v1_memory_allocate(new_size);
+    if (p) memcpy(moved, p, old_size);
+    return moved;
+}
+
+static void * v1_create(key_kind_t const kind) {
+    if (kind == KEYS_POINTER)
+        return v1_map_create(8, (map_config_t){ .hash = bench_hash_ptr,
+            .cmp = bench_ptr_equals, .kcopy = bench_identity, .vcopy = bench_identity });
+    // default string config, values stored as given
+    return v1_map_create(8, (map_config_t){ .vcopy = bench_identity });
+}
+// One map alive at a time, so every block belongs to it
+static void v1_destroy(void * map) {
+    v1_map_destroy(map);
+    for (size_t i = 0; i < g_blocks_count; i++) bench_free(g_blocks[i]);
+    g_blocks_count = 0;
+}
+static void v1_put(void * map, void const * key, void * value) {
+    v1_map_put(map, key, value);
+}
+static void * v1_get(void * map, void const * key) {
+    return v1_map_get(map, key);
+}
+static size_t v1_iterate(void * map) {
+    size_t count = 0;
+    map_iterator_t it = v1_map_iterator(map);
+    map_entry_t const * entry;
+    while ((entry = v1_map_iterator_next(&it))) {
+        if (v1_map_entry_value(entry)) count++;
+    }
+    return count;
+}
+
+bench_map_impl_t const bench_map_v1 = {
+    .name = "v1",
+    .create = v1_create,
+    .destroy = v1_destroy,
+    .put = v1_put,
+    .get = v1_get,
+    .iterate = v1_iterate,
+};
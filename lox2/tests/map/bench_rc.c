@@ -0,0 +1,98 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+/*
+ * bench_rc: what a value_dup + value_free pair costs under LOX_BIASED_RC,
+ * on a string this thread owns (plain count), on one another thread
+ * allocated (atomic shared count), and with the drop deferred to
+ * obj_rc_flush. A bare atomic add/sub pair is the cost of counting every
+ * reference atomically.
+ *
+ * Reported is ns per pair, best of BENCH_REPEATS.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <threads.h>
+#include <time.h>
+#include "value.h"
+#include "object.h"
+
+#define BENCH_REPEATS 5
+#define OPS (1 << 24)
+
+static double now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double dup_free(value_t const * v) {
+    double best = 1e30;
+    for (int rep = 0; rep < BENCH_REPEATS; rep++) {
+        double const t0 = now_ns();
+        for (size_t i = 0; i < OPS; i++) {
+            value_t copy = value_dup(v);
+            value_free(&copy);
+        }
+        double const t = (now_ns() - t0) / OPS;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+static double dup_deferred(value_t const * v) {
+    double best = 1e30;
+    for (int rep = 0; rep < BENCH_REPEATS; rep++) {
+        double const t0 = now_ns();
+        for (size_t i = 0; i < OPS; i++) {
+            value_t const copy = value_dup(v);
+            obj_dec_ref_deferred(value_as_object(copy));
+        }
+        obj_rc_flush();
+        double const t = (now_ns() - t0) / OPS;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+static double atomic_pair(void) {
+    atomic_int count = 1;
+    double best = 1e30;
+    for (int rep = 0; rep < BENCH_REPEATS; rep++) {
+        double const t0 = now_ns();
+        for (size_t i = 0; i < OPS; i++) {
+            atomic_fetch_add_explicit(&count, 1, memory_order_relaxed);
+            atomic_fetch_sub_explicit(&count, 1, memory_order_acq_rel);
+        }
+        double const t = (now_ns() - t0) / OPS;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+// Allocates a string on its own thread and hands main its only reference
+static int make_foreign(void * arg) {
+    value_t * v = arg;
+    *v = value_object((object_t*)obj_string_new("allocated on another thread"));
+    obj_rc_flush();
+    return 0;
+}
+
+int main(void) {
+    value_t own = value_object((object_t*)obj_string_new("allocated here"));
+    value_t foreign = value_nil();
+    thrd_t thread;
+    if (thrd_create(&thread, make_foreign, &foreign) != thrd_success) return 1;
+    thrd_join(thread, NULL);
+
+    printf("%-24s %8s\n", "", "ns/pair");
+    printf("%-24s %8.2f\n", "owner", dup_free(&own));
+    printf("%-24s %8.2f\n", "owner, deferred drop", dup_deferred(&own));
+    printf("%-24s %8.2f\n", "other thread", dup_free(&foreign));
+    printf("%-24s %8.2f\n", "other, deferred drop", dup_deferred(&foreign));
+    printf("%-24s %8.2f\n", "atomic add + sub", atomic_pair());
+    value_free(&own);
+    return 0;
+}
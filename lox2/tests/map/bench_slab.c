@@ -0,0 +1,107 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+/*
+ * bench_slab: slab_alloc/slab_free against malloc/free on the interpreter's
+ * pattern, a pool of live blocks of object sizes (16 to 512 bytes) where a
+ * random one is freed and replaced by a fresh block of a random size.
+ *
+ * Reported is ns per free + allocate pair, best of BENCH_REPEATS, for a
+ * few pool sizes.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "utils/slab.h"
+
+#define BENCH_REPEATS 5
+#define OPS (1 << 22)
+
+typedef struct {
+    char const * name;
+    void * (*alloc)(size_t size);
+    void (*free)(void * p, size_t size);
+} allocator_t;
+
+static void * heap_alloc(size_t const size) {
+    void * p = malloc(size);
+    if (!p) exit(EXIT_FAILURE);
+    return p;
+}
+static void heap_free(void * p, size_t const size) {
+    (void)size;
+    free(p);
+}
+
+static allocator_t const g_allocators[] = {
+    { "malloc", heap_alloc, heap_free },
+    { "slab", slab_alloc, slab_free },
+};
+#define ALLOCATOR_COUNT (sizeof(g_allocators) / sizeof(g_allocators[0]))
+
+static uint64_t g_rng = 0x9e3779b97f4a7c15ULL;
+static uint64_t next_random(void) {
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 7;
+    g_rng ^= g_rng << 17;
+    return g_rng;
+}
+// Mostly small, like strings and ropes, now and then an environment map
+static size_t random_size(void) {
+    uint64_t const r = next_random();
+    return r % 8 ? 16 + r % 112 : 128 + r % 385;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double measure(allocator_t const * a, size_t const live) {
+    void ** blocks = malloc(live * sizeof(void *));
+    size_t * sizes = malloc(live * sizeof(size_t));
+    if (!blocks || !sizes) exit(EXIT_FAILURE);
+    double best = 1e30;
+    for (int rep = 0; rep < BENCH_REPEATS; rep++) {
+        g_rng = 0x9e3779b97f4a7c15ULL;
+        for (size_t i = 0; i < live; i++) {
+            sizes[i] = random_size();
+            blocks[i] = a->alloc(sizes[i]);
+        }
+        double const t0 = now_ns();
+        for (size_t i = 0; i < OPS; i++) {
+            size_t const victim = next_random() % live;
+            a->free(blocks[victim], sizes[victim]);
+            sizes[victim] = random_size();
+            blocks[victim] = a->alloc(sizes[victim]);
+            *(char *)blocks[victim] = (char)i;  // touch it, as a constructor would
+        }
+        double const t = (now_ns() - t0) / OPS;
+        if (t < best) best = t;
+        for (size_t i = 0; i < live; i++) a->free(blocks[i], sizes[i]);
+    }
+    free(sizes);
+    free(blocks);
+    return best;
+}
+
+int main(void) {
+    size_t const pools[] = { 1000, 100000, 1000000 };
+    printf("%-8s", "ns/pair");
+    for (size_t p = 0; p < sizeof(pools) / sizeof(pools[0]); p++) printf(" %10zu", pools[p]);
+    printf("\n");
+    for (size_t a = 0; a < ALLOCATOR_COUNT; a++) {
+        printf("%-8s", g_allocators[a].name);
+        for (size_t p = 0; p < sizeof(pools) / sizeof(pools[0]); p++)
+            printf(" %10.2f", measure(&g_allocators[a], pools[p]));
+        printf("\n");
+    }
+    slab_stats_t const stats = slab_stats();
+    printf("\nslab: %zu allocations, %zu large, %zu KB reserved in %zu chunks\n",
+        stats.allocations, stats.large, stats.bytes_reserved / 1024, stats.chunks);
+    return 0;
+}
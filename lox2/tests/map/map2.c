@@ -3,6 +3,7 @@
 //
 
 #include "map2.h"
+#include "utils/slab.h"
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -10,6 +11,41 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MAP_USE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ * Swiss table.
+ *
+ * Open addressing over a flat slot array with one control byte per slot.
+ * A control byte is either MAP_CTRL_EMPTY, MAP_CTRL_DELETED (tombstone) or
+ * the low 7 bits of the hash (h2) of the key stored in the slot. Lookups scan
+ * control bytes a group of MAP_GROUP_WIDTH at a time (one SSE2 compare) and
+ * only touch slots whose h2 matches. The first group of control bytes is
+ * mirrored past the end so a group starting near the end can be loaded
+ * without wrapping.
+ *
+ * Slot layout: [size_t hash][void * key][value]. The value is the pointer
+ * returned by value_copy, or the value itself when the map is inline (no
+ * value_copy, see map2.h).
+ *
+ * Small mode: a map created for at most MAP_SMALL_CAPACITY entries starts
+ * without control bytes (ctrl == NULL). Its slots sit in the same block as
+ * the hashmap_t and are searched linearly, comparing the stored hash first.
+ * Inserting past MAP_SMALL_CAPACITY moves everything into a Swiss table.
+ * Most scopes and environments hold a handful of names and never leave it.
+ */
+#define MAP_GROUP_WIDTH 16
+#define MAP_CTRL_EMPTY ((int8_t)-128)   // 0b10000000
+#define MAP_CTRL_DELETED ((int8_t)-2)   // 0b11111110
+#define MAP_MIN_CAPACITY 16
+#define MAP_SMALL_CAPACITY 8
+
 static void * default_copy(void const * src);
 static void default_free(void * ptr);
 static size_t default_hash(void const * key);
@@ -29,23 +65,125 @@ static const map_config_t DEFAULT_MAP_CONFIG = {
     default_free
 };
 
-static void free_map_entry(map_entry_t * entry, free_fn_t kfree, free_fn_t vfree);
+// Group matching, a bit per slot of the group
+typedef uint32_t group_mask_t;
 
-struct map_entry {
-    void * key;
-    void * value;
-    struct map_entry * next;
-};
+static inline int mask_lowest(group_mask_t const mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#ifdef MAP_USE_SSE2
+static inline group_mask_t group_match(int8_t const * ctrl, int8_t const h2) {
+    __m128i const group = _mm_loadu_si128((__m128i const *)ctrl);
+    return (group_mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+static inline group_mask_t group_match_empty(int8_t const * ctrl) {
+    return group_match(ctrl, MAP_CTRL_EMPTY);
+}
+// empty or deleted, both have the sign bit set
+static inline group_mask_t group_match_free(int8_t const * ctrl) {
+    __m128i const group = _mm_loadu_si128((__m128i const *)ctrl);
+    return (group_mask_t)_mm_movemask_epi8(group);
+}
+#else
+static inline group_mask_t group_match(int8_t const * ctrl, int8_t const h2) {
+    group_mask_t mask = 0;
+    for (int i = 0; i < MAP_GROUP_WIDTH; i++)
+        if (ctrl[i] == h2) mask |= (group_mask_t)1 << i;
+    return mask;
+}
+static inline group_mask_t group_match_empty(int8_t const * ctrl) {
+    return group_match(ctrl, MAP_CTRL_EMPTY);
+}
+static inline group_mask_t group_match_free(int8_t const * ctrl) {
+    group_mask_t mask = 0;
+    for (int i = 0; i < MAP_GROUP_WIDTH; i++)
+        if (ctrl[i] < 0) mask |= (group_mask_t)1 << i;
+    return mask;
+}
+#endif
+
+// Spreads weak hashes (pointer keys, short strings) so h1 and h2 both get
+// usable bits. Applied inside the map, so callers still pass key_hash values.
+static inline size_t mix_hash(size_t const hash) {
+    uint64_t h = (uint64_t)hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+static inline size_t hash_h1(size_t const hash) { return hash >> 7; }
+static inline int8_t hash_h2(size_t const hash) { return (int8_t)(hash & 0x7F); }
+
+static inline bool map_is_inline(hashmap_t const * map) {
+    return map->value_copy == NULL;
+}
+static inline unsigned char * slot_at(hashmap_t const * map, size_t const index) {
+    return map->slots + index * map->slot_size;
+}
+static inline size_t * slot_hash(unsigned char * slot) {
+    return (size_t *)slot;
+}
+static inline void ** slot_key(unsigned char * slot) {
+    return (void **)(slot + sizeof(size_t));
+}
+static inline void * slot_value_area(unsigned char * slot) {
+    return slot + sizeof(size_t) + sizeof(void*);
+}
+// What map_get/map_find hand out for a slot
+static inline void * slot_value(hashmap_t const * map, unsigned char * slot) {
+    if (map_is_inline(map)) return slot_value_area(slot);
+    return *(void **)slot_value_area(slot);
+}
+static inline bool map_is_small(hashmap_t const * map) {
+    return map->ctrl == NULL;
+}
+static inline void set_ctrl(hashmap_t const * map, size_t const index, int8_t const h2) {
+    map->ctrl[index] = h2;
+    // keep the mirrored tail in sync
+    if (index < MAP_GROUP_WIDTH) map->ctrl[map->capacity + index] = h2;
+}
+static void free_slot(hashmap_t const * map, unsigned char * slot) {
+    map->key_free(*slot_key(slot));
+    if (map_is_inline(map)) {
+        // the storage is the map's, value_free only releases what the value owns
+        if (map->value_free) map->value_free(slot_value_area(slot));
+    } else {
+        map->value_free(*(void **)slot_value_area(slot));
+    }
+}
 
+// Table memory comes from the slab allocator, which exits when out of memory
+static void alloc_table(hashmap_t * map, size_t const capacity) {
+    map->ctrl = slab_alloc(capacity + MAP_GROUP_WIDTH);
+    map->slots = slab_alloc(capacity * map->slot_size);
+    memset(map->ctrl, (unsigned char)MAP_CTRL_EMPTY, capacity + MAP_GROUP_WIDTH);
+    map->capacity = capacity;
+    map->tombstones = 0;
+}
+static void free_table(int8_t * ctrl, unsigned char * slots, size_t const capacity, size_t const slot_size) {
+    slab_free(ctrl, capacity + MAP_GROUP_WIDTH);
+    slab_free(slots, capacity * slot_size);
+}
 
 hashmap_t * map_create(size_t const num_buckets, map_config_t const * map_config) {
     if (!map_config) {
         return map_create(num_buckets, &DEFAULT_MAP_CONFIG);
     }
-    hashmap_t * map = malloc(sizeof(hashmap_t));
-    map->num_buckets = num_buckets;
-    map->buckets = calloc(num_buckets, sizeof(map_entry_t*));
-    if (!map->buckets) { free(map); exit(-1); }
+    // slot_size depends on the config, so size the small area after reading it
+    size_t const value_size = map_config->value_copy || map_config->value_size == 0
+        ? sizeof(void*) : map_config->value_size;
+    size_t const slot_size = sizeof(size_t) + sizeof(void*)
+        + ((value_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1));
+    bool const small = num_buckets <= MAP_SMALL_CAPACITY;
+    size_t const block_size = sizeof(hashmap_t) + (small ? MAP_SMALL_CAPACITY * slot_size : 0);
+    hashmap_t * map = slab_alloc(block_size);
+    map->block_size = block_size;
     map->size = 0;
 
     map->key_size   =  map_config -> key_size;
@@ -55,43 +193,99 @@ hashmap_t * map_create(size_t const num_buckets, map_config_t const * map_config
     map->key_free   =  map_config ->   key_free ? map_config -> key_free   : default_free;
 
     map->value_size =  map_config -> value_size;
-    map->value_copy =  map_config -> value_copy ? map_config -> value_copy : default_copy;
-    map->value_free =  map_config -> value_free ? map_config -> value_free : default_free;
+    // No value_copy with a known value_size stores values inline in the slot
+    bool const inline_values = !map_config->value_copy && map_config->value_size > 0;
+    map->value_copy =  inline_values ? NULL : map_config -> value_copy ? map_config -> value_copy : default_copy;
+    map->value_free =  map_config -> value_free ? map_config -> value_free
+                     : inline_values ? NULL : default_free;
 
+    map->slot_size = slot_size;
+
+    if (small) {
+        map->ctrl = NULL;
+        map->slots = (unsigned char *)(map + 1);
+        map->capacity = MAP_SMALL_CAPACITY;
+        map->tombstones = 0;
+        return map;
+    }
+    // num_buckets is the expected element count, keep it under the load factor
+    size_t capacity = MAP_MIN_CAPACITY;
+    while (capacity * 7 / 8 < num_buckets) capacity *= 2;
+    alloc_table(map, capacity);
     return map;
 }
 
 void map_destroy(hashmap_t * map) {
-    if (!map || !map->buckets) return;
-    for (size_t i = 0; i < map->num_buckets; i++) {
-        map_entry_t * entry = map->buckets[i];
-        while (entry) {
-            map_entry_t * next = entry->next;
-            free_map_entry(entry, map->key_free, map->value_free);
-            entry = next;
-        }
+    if (!map) return;
+    if (map_is_small(map)) {
+        for (size_t i = 0; i < map->size; i++) free_slot(map, slot_at(map, i));
+        slab_free(map, map->block_size);
+        return;
     }
-    free(map->buckets);
-    free(map);
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] >= 0) free_slot(map, slot_at(map, i));
+    }
+    free_table(map->ctrl, map->slots, map->capacity, map->slot_size);
+    slab_free(map, map->block_size);
 }
 
-static void resize_map(hashmap_t * map, size_t const num_buckets) {
-
-    map_entry_t ** new_buckets = calloc(num_buckets, sizeof(map_entry_t*));
-    if (!new_buckets) { map_destroy(map); exit(-1); }
+// First empty or deleted slot on the probe sequence of hash
+static size_t find_free_slot(hashmap_t const * map, size_t const hash) {
+    size_t const mask = map->capacity - 1;
+    size_t pos = hash_h1(hash) & mask;
+    for (size_t stride = MAP_GROUP_WIDTH; ; stride += MAP_GROUP_WIDTH) {
+        group_mask_t const free_mask = group_match_free(map->ctrl + pos);
+        if (free_mask) return (pos + mask_lowest(free_mask)) & mask;
+        pos = (pos + stride) & mask; // triangular, visits every group once
+    }
+}
 
-    for (size_t i = 0; i < map->num_buckets; i++) {
-        map_entry_t * entry = map->buckets[i];
-        while (entry) {
-            map_entry_t * next = entry->next;
-            size_t const new_index = map->key_hash(entry->key) % num_buckets;
-            new_buckets[new_index] = entry;
-            entry = next;
+// Slot index holding key, or SIZE_MAX
+static size_t find_slot(hashmap_t const * map, void const * key, size_t const hash) {
+    if (map_is_small(map)) {
+        for (size_t i = 0; i < map->size; i++) {
+            unsigned char * slot = slot_at(map, i);
+            if (*slot_hash(slot) == hash && map->key_equals(key, *slot_key(slot)))
+                return i;
+        }
+        return SIZE_MAX;
+    }
+    size_t const mask = map->capacity - 1;
+    int8_t const h2 = hash_h2(hash);
+    size_t pos = hash_h1(hash) & mask;
+    for (size_t stride = MAP_GROUP_WIDTH; stride <= map->capacity + MAP_GROUP_WIDTH; stride += MAP_GROUP_WIDTH) {
+        group_mask_t match = group_match(map->ctrl + pos, h2);
+        while (match) {
+            size_t const index = (pos + mask_lowest(match)) & mask;
+            unsigned char * slot = slot_at(map, index);
+            if (*slot_hash(slot) == hash && map->key_equals(key, *slot_key(slot)))
+                return index;
+            match &= match - 1;
         }
+        // an empty slot ends the probe, the key would have been placed there
+        if (group_match_empty(map->ctrl + pos)) return SIZE_MAX;
+        pos = (pos + stride) & mask;
     }
-    free(map->buckets);
-    map->buckets = new_buckets;
-    map->num_buckets = num_buckets;
+    return SIZE_MAX;
+}
+
+// Rebuilds the table with the given capacity, dropping tombstones
+static void resize_map(hashmap_t * map, size_t const capacity) {
+    int8_t * old_ctrl = map->ctrl;
+    unsigned char * old_slots = map->slots;
+    size_t const old_capacity = map_is_small(map) ? map->size : map->capacity;
+    size_t const old_table_capacity = map->capacity;
+    bool const was_small = map_is_small(map);
+    alloc_table(map, capacity);
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!was_small && old_ctrl[i] < 0) continue;
+        unsigned char * old_slot = old_slots + i * map->slot_size;
+        size_t const index = find_free_slot(map, *slot_hash(old_slot));
+        memcpy(slot_at(map, index), old_slot, map->slot_size);
+        set_ctrl(map, index, hash_h2(*slot_hash(old_slot)));
+    }
+    if (was_small) return; // the small slots live in the map's own block
+    free_table(old_ctrl, old_slots, old_table_capacity, map->slot_size);
 }
 /**
  *
@@ -101,27 +295,87 @@ static void resize_map(hashmap_t * map, size_t const num_buckets) {
  * @return returns false if any error, true if success
  */
 bool map_put(hashmap_t * map, void const * key, void const * value) {
-    if (!map || !map->buckets || !key) return false;
-    if ((map->size + 1) * 4 > map->num_buckets * 3) resize_map(map, map->num_buckets * 2);
-    size_t const index = map->key_hash(key) % map->num_buckets;
-    map_entry_t * entry = map->buckets[index];
-    while (entry) {
-        if (map->key_equals(key, entry->key)) {
-            map->value_free(entry->value);
-            entry->value = map->value_copy(value);
-            return true;
+    if (!map || !key) return false;
+    return map_put_hashed(map, key, map->key_hash(key), value);
+}
+/*
+ * Same as map_put with a hash the caller already has. It must be the value
+ * key_hash would return for key.
+ */
+bool map_put_hashed(hashmap_t * map, void const * key, size_t const key_hash, void const * value) {
+    if (!map || !key) return false;
+    bool inserted;
+    void * area = map_emplace_hashed(map, key, key_hash, &inserted);
+    if (map_is_inline(map)) {
+        if (!inserted && map->value_free) map->value_free(area);
+        memcpy(area, value, map->value_size);
+    } else {
+        if (!inserted) map->value_free(*(void **)area);
+        *(void **)area = map->value_copy(value);
+    }
+    return true;
+}
+/*
+ * Get-or-insert. Returns the address of the value storage for key (see
+ * map_slot), adding the key with zeroed storage first if it is missing.
+ * The caller constructs the value in place, nothing is copied or freed.
+ */
+void * map_emplace(hashmap_t * map, void const * key, bool * p_inserted) {
+    if (!map || !key) return NULL;
+    return map_emplace_hashed(map, key, map->key_hash(key), p_inserted);
+}
+void * map_emplace_hashed(hashmap_t * map, void const * key, size_t const key_hash,
+    bool * p_inserted) {
+    if (!map || !key) return NULL;
+    size_t const hash = mix_hash(key_hash);
+    size_t index = find_slot(map, key, hash);
+    if (p_inserted) *p_inserted = index == SIZE_MAX;
+    if (index != SIZE_MAX) return slot_value_area(slot_at(map, index));
+
+    if (map_is_small(map) && map->size < MAP_SMALL_CAPACITY) {
+        index = map->size;
+    } else {
+        if (map_is_small(map)) {
+            resize_map(map, MAP_MIN_CAPACITY);
+        } else if ((map->size + map->tombstones + 1) * 8 > map->capacity * 7) {
+            // grow, or just drop tombstones
+            size_t const capacity = (map->size + 1) * 8 > map->capacity * 7 / 2
+                ? map->capacity * 2 : map->capacity;
+            resize_map(map, capacity);
         }
-        entry = entry->next;
+        index = find_free_slot(map, hash);
+        if (map->ctrl[index] == MAP_CTRL_DELETED) map->tombstones--;
+        set_ctrl(map, index, hash_h2(hash));
     }
-    // Not found: add new entry
-    entry = malloc(sizeof(map_entry_t));
-    if (!entry) return false;
-    entry->key = map->key_copy(key);
-    entry->value = map->value_copy(value);
-    entry->next = map->buckets[index];
-    map->buckets[index] = entry;
+    unsigned char * slot = slot_at(map, index);
+    *slot_hash(slot) = hash;
+    *slot_key(slot) = map->key_copy(key);
+    memset(slot_value_area(slot), 0, map->slot_size - sizeof(size_t) - sizeof(void*));
     map->size++;
-    return true;
+    return slot_value_area(slot);
+}
+/*
+ * Insert or overwrite. Inline maps write value over the stored one in
+ * place without value_free/value_copy, so the old value's resources stay
+ * with the caller. Returns what map_find would return for key.
+ */
+void * map_upsert(hashmap_t * map, void const * key, void const * value) {
+    if (!map || !key) return NULL;
+    return map_upsert_hashed(map, key, map->key_hash(key), value);
+}
+void * map_upsert_hashed(hashmap_t * map, void const * key, size_t const hash,
+    void const * value) {
+    if (!map || !key) return NULL;
+    bool inserted;
+    void * area = map_emplace_hashed(map, key, hash, &inserted);
+    if (map_is_inline(map)) {
+        memcpy(area, value, map->value_size);
+        return area;
+    }
+    // pointer maps may hold scalars in the pointer itself, so replace it
+    if (!inserted) map->value_free(*(void **)area);
+    *(void **)area = map->value_copy(value);
+    return *(void **)area;
 }
 
 /**
@@ -138,6 +392,8 @@ bool map_put(hashmap_t * map, void const * key, void const * value) {
  *   - Therefore, `out_val` **must point to a uintptr_t or void* variable**, not a smaller type.
  *   - Do NOT pass a pointer to a type smaller than the platform pointer size (e.g., bool or int on 64-bit),
  *     as this will cause memory corruption.
+ *   - For inline maps `out_val` receives the address of the value inside the
+ *     table, valid until the next insertion or removal.
  *
  * Example usage:
  *   uintptr_t tmp;
@@ -146,35 +402,74 @@ bool map_put(hashmap_t * map, void const * key, void const * value) {
  *   }
  */
 bool map_get(hashmap_t * map, void const * key, void ** out_value) {
-    if (!map || !map->buckets || !key) return false;
-    size_t const index = map->key_hash(key) % map->num_buckets;
-    map_entry_t const * entry = map->buckets[index];
-    while (entry) {
-        if (map->key_equals(key, entry->key)) {
-            *out_value = (uintptr_t*)entry->value;
-            return true;
-        }
-        entry = entry->next;
-    }
-    return false;
+    if (!map || !key) return false;
+    return map_get_hashed(map, key, map->key_hash(key), out_value);
+}
+bool map_get_hashed(hashmap_t * map, void const * key, size_t const hash, void ** out_value) {
+    if (!map || !key) return false;
+    size_t const index = find_slot(map, key, mix_hash(hash));
+    if (index == SIZE_MAX) return false;
+    *out_value = (uintptr_t*)slot_value(map, slot_at(map, index));
+    return true;
+}
+/*
+ * Single lookup returning the stored value, or NULL if the key is missing.
+ * Replaces the map_contains + map_get pair when the stored values are
+ * never NULL themselves (inline maps, or everything copied through value_copy).
+ */
+void * map_find(hashmap_t const * map, void const * key) {
+    if (!map || !key) return NULL;
+    return map_find_hashed(map, key, map->key_hash(key));
+}
+void * map_find_hashed(hashmap_t const * map, void const * key, size_t const hash) {
+    if (!map || !key) return NULL;
+    size_t const index = find_slot(map, key, mix_hash(hash));
+    if (index == SIZE_MAX) return NULL;
+    return slot_value(map, slot_at(map, index));
+}
+
+/*
+ * Address of the value storage for key, or NULL. For inline maps that is the
+ * value itself, for pointer maps the cell holding the pointer from
+ * value_copy. Stays valid until a new key is inserted (growth moves slots)
+ * or any key is removed (small maps move their last entry into the hole).
+ */
+void * map_slot(hashmap_t const * map, void const * key) {
+    if (!map || !key) return NULL;
+    return map_slot_hashed(map, key, map->key_hash(key));
+}
+void * map_slot_hashed(hashmap_t const * map, void const * key, size_t const hash) {
+    if (!map || !key) return NULL;
+    size_t const index = find_slot(map, key, mix_hash(hash));
+    if (index == SIZE_MAX) return NULL;
+    return slot_value_area(slot_at(map, index));
 }
 
 bool map_remove(hashmap_t * map,  void const * key) {
-    fprintf(stderr, "map_remove is not implemented");
-    exit(EXIT_FAILURE);
+    if (!map || !key) return false;
+    size_t const index = find_slot(map, key, mix_hash(map->key_hash(key)));
+    if (index == SIZE_MAX) return false;
+    free_slot(map, slot_at(map, index));
+    if (map_is_small(map)) {
+        // keep the small entries packed, the last one fills the hole
+        if (index != --map->size)
+            memcpy(slot_at(map, index), slot_at(map, map->size), map->slot_size);
+        return true;
+    }
+    // a tombstone keeps probe sequences running through this slot intact
+    set_ctrl(map, index, MAP_CTRL_DELETED);
+    map->size--;
+    map->tombstones++;
+    return true;
 }
 
 bool map_contains(hashmap_t const * map, void const * key) {
-    if (!map || !map->buckets || !key) return false;
-    size_t const index = map->key_hash(key) % map->num_buckets;
-    map_entry_t const * entry = map->buckets[index];
-    while (entry) {
-        if (map->key_equals(key, entry->key)) {
-            return true;
-        }
-        entry = entry->next;
-    }
-    return false;
+    if (!map || !key) return false;
+    return map_contains_hashed(map, key, map->key_hash(key));
+}
+bool map_contains_hashed(hashmap_t const * map, void const * key, size_t const hash) {
+    if (!map || !key) return false;
+    return find_slot(map, key, mix_hash(hash)) != SIZE_MAX;
 }
 
 size_t map_size(hashmap_t * map) {
@@ -182,6 +477,21 @@ size_t map_size(hashmap_t * map) {
     return map->size;
 }
 
+/*
+ * Iteration in slot order: for (size_t i = 0; (v = map_next(map, &i));)
+ * returns each stored value like map_find does. The map must not gain keys
+ * while iterating.
+ */
+void * map_next(hashmap_t const * map, size_t * p_index) {
+    if (!map) return NULL;
+    size_t const end = map_is_small(map) ? map->size : map->capacity;
+    for (; *p_index < end; (*p_index)++) {
+        if (!map_is_small(map) && map->ctrl[*p_index] < 0) continue;
+        return slot_value(map, slot_at(map, (*p_index)++));
+    }
+    return NULL;
+}
+
 
 // Default copy/free functions for simple types
 static inline void * default_copy(void const * src) {
@@ -197,11 +507,3 @@ static inline size_t default_hash(void const * key) {
 static inline bool default_equals(void const * a, void const * b) {
     return a == b;
 }
-
-static void free_map_entry(map_entry_t * entry,
-        free_fn_t const kfree, free_fn_t const vfree) {
-    if (!entry || !kfree || !vfree) return;
-    kfree(entry->key);
-    vfree(entry->value);
-    free(entry);
-}
\ No newline at end of file
@@ -5,6 +5,7 @@
 #ifndef LOX_MAP2_H
 #define LOX_MAP2_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -20,16 +21,17 @@ typedef bool (*equals_fn_t)(void const * a, void const * b);
 typedef void * (*copy_fn_t)(void const * ptr);
 typedef void (*free_fn_t)(void * data);
 
-// Map entry structure
-typedef struct map_entry map_entry_t;
-
-// Main hashmap structure
+// Main hashmap structure, an open addressing Swiss table (see map2.c)
 typedef struct hashmap hashmap_t;
 typedef hashmap_t map_t;
 struct hashmap {
-    map_entry_t ** buckets;
-    size_t num_buckets;
+    int8_t * ctrl;          // capacity + 16 control bytes, NULL in small mode
+    unsigned char * slots;  // capacity * slot_size, inline after the map in small mode
+    size_t capacity;        // power of two
+    size_t slot_size;
     size_t size;  // current number of elements
+    size_t tombstones;
+    size_t block_size;      // of the map itself, small area included
 
     // Key info
     size_t key_size;
@@ -48,6 +50,13 @@ struct hashmap {
 #endif
 };
 
+/*
+ * Values are copied with value_copy and the returned pointer is stored. When
+ * value_copy is NULL and value_size is set the map is inline instead: values
+ * are memcpy'd into the table, map_get/map_find return their address (valid
+ * until the next insertion or removal) and value_free, if given, gets that
+ * address to release whatever the value owns.
+ */
 typedef struct {
 
     // key handlers
@@ -65,7 +74,8 @@ typedef struct {
 
 // API Functions
 
-// Create a new map
+// Create a new map, num_buckets is the expected element count. Up to 8
+// starts in small mode: inline entries and a linear search until it grows
 hashmap_t * map_create(size_t num_buckets, map_config_t const * map_config);
 
 // Destroy the map and free all memory
@@ -77,7 +87,28 @@ bool map_put(hashmap_t * map, void const * key, void const * value);
 // Retrieve a value for a given key (returns 0 if found, -1 if not)
 bool map_get(hashmap_t * map, void const * key, void ** out_value);
 
-// Remove a key-value pair (returns 0 if removed, -1 if not found)
+// Variants taking the key's hash, which must equal key_hash(key). Lets callers
+// that hash a key once (identifier tokens) skip rehashing on every access.
+bool map_put_hashed(hashmap_t * map, void const * key, size_t hash, void const * value);
+bool map_get_hashed(hashmap_t * map, void const * key, size_t hash, void ** out_value);
+bool map_contains_hashed(hashmap_t const * map, void const * key, size_t hash);
+
+// Single lookup: the stored value, or NULL if the key is missing
+void * map_find(hashmap_t const * map, void const * key);
+void * map_find_hashed(hashmap_t const * map, void const * key, size_t hash);
+
+// In-place access, see map2.c. Returned pointers stay valid until a new key
+// is inserted or any key is removed.
+void * map_slot(hashmap_t const * map, void const * key);
+void * map_slot_hashed(hashmap_t const * map, void const * key, size_t hash);
+void * map_emplace(hashmap_t * map, void const * key, bool * p_inserted);
+void * map_emplace_hashed(hashmap_t * map, void const * key, size_t hash, bool * p_inserted);
+void * map_upsert(hashmap_t * map, void const * key, void const * value);
+void * map_upsert_hashed(hashmap_t * map, void const * key, size_t hash, void const * value);
+
+// Remove a key-value pair (returns true if removed, false if not found). In
+// small mode the last entry moves into the hole, so this invalidates value
+// pointers from map_find, map_slot and map_emplace.
 bool map_remove(hashmap_t * map,  void const * key);
 
 // Check if a key exists
@@ -86,4 +117,7 @@ bool map_contains(hashmap_t const * map, void const * key);
 // Get the number of elements in the map
 size_t map_size(hashmap_t * map);
 
+// Next stored value from *p_index on, NULL at the end (see map2.c)
+void * map_next(hashmap_t const * map, size_t * p_index);
+
 #endif //LOX_MAP2_H
\ No newline at end of file
@@ -6,8 +6,14 @@
 #include "value.h"
 #include "expr.h"
 #include "map/map2.h"
+#include "utils/map_template.h"
+#include "utils/hash.h"
+#include "utils/concurrent_map.h"
+#include <threads.h>
 #include <string.h>
 #include <assert.h>
+#include "gc.h"
+#include "utils/slab.h"
 
 // typedef struct map map_t;
 //
@@ -84,13 +90,7 @@ static map_config_t const EXPRPTR_INT_CONFIG = {
 
 // <char*,bool>
 size_t str_hash(void const * key) {
-    if (!key) return 0;
-    unsigned char const * s = key;
-    size_t hash = 5381;
-    int c;
-    while ((c = *s++))
-        hash = ((hash << 5) + hash) + c;
-    return hash;
+    return hash_string(key);
 }
 bool str_equal(void const * a, void const * b) {
     if (!a || !b) return false;
@@ -145,7 +145,93 @@ static map_config_t const CHARPTR_VALUEPTR_CONFIG = {
     value_copy2,
     value_free2
 };
+// <uint32_t, value_t> specialized
+static inline size_t hash_u32(uint32_t const key) { return key * 2654435761u; }
+#define U32_EQUALS(a, b) ((a) == (b))
+DEFINE_MAP(symbol_value, uint32_t, value_t, hash_u32, U32_EQUALS)
+
 #define CHECK_BOOL(val, expected) assert((val) == (expected))
+// <char*,void*> shared between threads
+#ifdef LOX_GC
+#define GC_TEST_ROOTS 64
+typedef struct {
+    value_t values[GC_TEST_ROOTS];
+} gc_test_roots_t;
+static char big_string[GC_NURSERY_MAX_OBJECT + 1];
+static void gc_test_mark(void * context) {
+    gc_test_roots_t * roots = context;
+    for (size_t i = 0; i < GC_TEST_ROOTS; i++) gc_mark_value(&roots->values[i]);
+}
+#endif
+
+#define CMAP_TEST_THREADS 4
+#define CMAP_TEST_KEYS 2000
+typedef struct {
+    cmap_t * map;
+    int id;
+} cmap_worker_t;
+static int cmap_worker(void * arg) {
+    cmap_worker_t const * w = arg;
+    char name[32];
+    for (int i = 0; i < CMAP_TEST_KEYS; i++) {
+        snprintf(name, sizeof(name), "t%d_%d", w->id, i);
+        void * value = (void*)(intptr_t)(i + 1);
+        assert(cmap_put_if_absent(w->map, name, value) == value);
+        // every thread also interns one shared key, all must get the same value
+        snprintf(name, sizeof(name), "shared_%d", i % 64);
+        void * shared = cmap_put_if_absent(w->map, name, (void*)(intptr_t)(w->id + 1));
+        assert(shared != nullptr && (intptr_t)shared <= CMAP_TEST_THREADS);
+        // read what another thread may be writing right now
+        snprintf(name, sizeof(name), "t%d_%d", (w->id + 1) % CMAP_TEST_THREADS, i);
+        void * other = cmap_get(w->map, name);
+        assert(other == nullptr || (intptr_t)other == i + 1 || (intptr_t)other == -(i + 1));
+    }
+    for (int i = 0; i < CMAP_TEST_KEYS; i += 2) {
+        snprintf(name, sizeof(name), "t%d_%d", w->id, i);
+        assert(cmap_remove(w->map, name));
+    }
+    for (int i = 1; i < CMAP_TEST_KEYS; i += 2) {
+        snprintf(name, sizeof(name), "t%d_%d", w->id, i);
+        assert(!cmap_put(w->map, name, (void*)(intptr_t)-(i + 1)));
+    }
+    return 0;
+}
+
+#ifdef LOX_BIASED_RC
+#define RC_TEST_THREADS 4
+#define RC_TEST_SHARED 32
+#define RC_TEST_ROUNDS 2000
+typedef struct {
+    value_t const * shared;  // the main thread's strings
+    value_t handed;          // a reference main counted, dropped here
+    value_t last;            // main's only reference to a string, dropped here
+    size_t equal;
+} rc_worker_t;
+static int rc_worker(void * arg) {
+    rc_worker_t * w = arg;
+    for (int i = 0; i < RC_TEST_ROUNDS; i++) {
+        value_t const * p_shared = &w->shared[i % RC_TEST_SHARED];
+        value_t copy = value_dup(p_shared);
+        // a rope of this thread over main's string, its child references are shared counts
+        value_t v_rope = value_object(obj_concat(value_as_object(copy), value_as_object(copy)));
+        // interned here too: another object, still equal
+        obj_string_t const * p_text = obj_as_string(value_as_object(copy));
+        value_t own = value_object((object_t*)obj_string_copy(p_text->chars, p_text->length));
+        if (value_as_object(own) != value_as_object(*p_shared) && value_equals(&own, p_shared)) w->equal++;
+        value_free(&own);
+        value_free(&v_rope);
+        if (i % 2) value_free(&copy);
+        else obj_dec_ref_deferred(value_as_object(copy));
+        if (i % 100 == 0) obj_rc_flush();
+    }
+    value_free(&w->handed);
+    value_free(&w->last);
+    obj_rc_flush();
+    slab_release_all();
+    return 0;
+}
+#endif
+
 void run_map_tests(void) {
 
 
@@ -204,13 +290,9 @@ void run_map_tests(void) {
     printf("=== Test 3: <char*, value_t*> ===\n");
     hashmap_t * m3 = map_create(3, &CHARPTR_VALUEPTR_CONFIG);
     char const * key_c = "var1";
-    value_t val_c = {0};
-    val_c.type = VAL_NUMBER;
-    val_c.as.number = 2.5;
+    value_t val_c = value_number(2.5);
     char const * key_d = "var2";
-    value_t val_d = {0};
-    val_d.type = VAL_NUMBER;
-    val_d.as.number = 3.5;
+    value_t val_d = value_number(3.5);
 
     assert(map_put(m3, key_c, &val_c));
     assert(map_put(m3, key_d, &val_d));
@@ -226,10 +308,630 @@ void run_map_tests(void) {
     printf("Passed <char*, value_t*> test.\n");
     // Ensure proper put and get for pointers to data
 
+    printf("=== Test 4: hashed lookups ===\n");
+    size_t const hash_c = str_hash(key_c);
+    assert(map_find(m3, key_c) == val_res_c);
+    assert(map_find_hashed(m3, key_c, hash_c) == val_res_c);
+    assert(map_find(m3, "nonexistent") == nullptr);
+    assert(map_contains_hashed(m3, key_c, hash_c));
+    val_c = value_number(4.5);
+    assert(map_put_hashed(m3, key_c, hash_c, &val_c));
+    value_t const * val_res_e = map_find_hashed(m3, key_c, hash_c);
+    assert(val_res_e && value_as_number(*val_res_e) == 4.5);
+    assert(map_size(m3) == 2);
+    printf("Passed hashed lookup test.\n");
+
+    printf("=== Test 5: inline values, growth and removal ===\n");
+    map_config_t const charptr_inline_cfg = {
+        .key_size = sizeof(char*),
+        .key_hash = str_hash,
+        .key_equals = str_equal,
+        .key_copy = str_copy,
+        .key_free = str_free,
+        .value_size = sizeof(value_t),
+    };
+    hashmap_t * m4 = map_create(1, &charptr_inline_cfg);
+    char name[16];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        value_t const v = value_number(i);
+        assert(map_put(m4, name, &v));
+    }
+    assert(map_size(m4) == 1000);
+    for (int i = 0; i < 1000; i += 2) {
+        snprintf(name, sizeof(name), "v%d", i);
+        assert(map_remove(m4, name));
+    }
+    assert(map_remove(m4, "v0") == false);
+    assert(map_size(m4) == 500);
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        value_t const * v = map_find(m4, name);
+        if (i % 2) assert(v && value_as_number(*v) == i);
+        else assert(v == nullptr);
+    }
+    // reinsertion reuses tombstones
+    for (int i = 0; i < 1000; i += 2) {
+        snprintf(name, sizeof(name), "v%d", i);
+        value_t const v = value_number(-i);
+        assert(map_put(m4, name, &v));
+    }
+    assert(map_size(m4) == 1000);
+    assert(value_as_number(*(value_t*)map_find(m4, "v998")) == -998);
+    printf("Passed inline value test.\n");
+
+    printf("=== Test 6: in place updates ===\n");
+    bool inserted;
+    value_t * p_slot = map_emplace(m4, "fresh", &inserted);
+    assert(inserted && value_type(*p_slot) == VAL_NIL);
+    *p_slot = value_number(1.5);
+    assert(map_emplace(m4, "fresh", &inserted) == p_slot && !inserted);
+    assert(map_slot(m4, "fresh") == p_slot);
+    value_t const v_up = value_bool(true);
+    assert(map_upsert(m4, "fresh", &v_up) == p_slot);
+    assert(value_type(*p_slot) == VAL_BOOL && value_as_bool(*p_slot));
+    assert(map_slot(m4, "missing") == nullptr);
+    map_destroy(m4);
+    printf("Passed in place update test.\n");
+
+    printf("=== Test 7: DEFINE_MAP <uint32_t, value_t> ===\n");
+    symbol_value_t sv = {0};
+    assert(symbol_value_find(&sv, 1) == nullptr);
+    for (uint32_t i = 0; i < 1000; i++)
+        symbol_value_put(&sv, i, value_number(i));
+    assert(sv.size == 1000);
+    for (uint32_t i = 0; i < 1000; i += 3)
+        assert(symbol_value_remove(&sv, i));
+    assert(!symbol_value_remove(&sv, 0));
+    size_t seen = 0;
+    symbol_value_entry_t const * e;
+    for (size_t i = 0; (e = symbol_value_next(&sv, &i));) {
+        assert(e->key % 3 != 0 && value_as_number(e->value) == e->key);
+        seen++;
+    }
+    assert(seen == sv.size);
+    bool sv_inserted;
+    value_t * p_sv = symbol_value_emplace(&sv, 3, &sv_inserted);
+    assert(sv_inserted && value_type(*p_sv) == VAL_NIL);
+    assert(value_as_number(*symbol_value_find(&sv, 4)) == 4);
+    symbol_value_destroy(&sv);
+    printf("Passed DEFINE_MAP test.\n");
+
+    printf("=== Test 8: small mode ===\n");
+    hashmap_t * m5 = map_create(1, &charptr_inline_cfg);
+    assert(m5->ctrl == nullptr);
+    for (int i = 0; i < 8; i++) {
+        snprintf(name, sizeof(name), "s%d", i);
+        value_t const v = value_number(i);
+        assert(map_put(m5, name, &v));
+    }
+    assert(m5->ctrl == nullptr && map_size(m5) == 8);
+    // removing from the middle moves the last entry into the hole
+    assert(map_remove(m5, "s2") && !map_contains(m5, "s2"));
+    assert(value_as_number(*(value_t*)map_find(m5, "s7")) == 7);
+    value_t * p_small = map_emplace(m5, "s2", &inserted);
+    assert(inserted && m5->ctrl == nullptr);
+    *p_small = value_number(2);
+    // the ninth key switches to the hashed table
+    for (int i = 8; i < 40; i++) {
+        snprintf(name, sizeof(name), "s%d", i);
+        value_t const v = value_number(i);
+        assert(map_put(m5, name, &v));
+    }
+    assert(m5->ctrl != nullptr && map_size(m5) == 40);
+    for (int i = 0; i < 40; i++) {
+        snprintf(name, sizeof(name), "s%d", i);
+        assert(value_as_number(*(value_t*)map_find(m5, name)) == i);
+    }
+    map_destroy(m5);
+    printf("Passed small mode test.\n");
+
+    printf("=== Test 9: concurrent map ===\n");
+    cmap_config_t const cmap_cfg = { str_hash, str_equal, str_copy, str_free };
+    cmap_t * cm = cmap_create(0, &cmap_cfg);
+    thrd_t threads[CMAP_TEST_THREADS];
+    cmap_worker_t workers[CMAP_TEST_THREADS];
+    for (int i = 0; i < CMAP_TEST_THREADS; i++) {
+        workers[i] = (cmap_worker_t){ cm, i };
+        assert(thrd_create(&threads[i], cmap_worker, &workers[i]) == thrd_success);
+    }
+    for (int i = 0; i < CMAP_TEST_THREADS; i++) thrd_join(threads[i], nullptr);
+    assert(cmap_size(cm) == CMAP_TEST_THREADS * CMAP_TEST_KEYS / 2 + 64);
+    for (int t = 0; t < CMAP_TEST_THREADS; t++) {
+        for (int i = 0; i < CMAP_TEST_KEYS; i++) {
+            snprintf(name, sizeof(name), "t%d_%d", t, i);
+            void * v = cmap_get(cm, name);
+            assert(i % 2 ? (intptr_t)v == -(i + 1) : v == nullptr);
+        }
+    }
+    cmap_destroy(cm);
+    printf("Passed concurrent map test.\n");
+
+    printf("=== Test 10: value representation ===\n");
+    // both layouts keep zeroed memory nil and agree on the accessors
+    value_t zeroed;
+    memset(&zeroed, 0, sizeof(zeroed));
+    value_t const nil = value_nil();
+    assert(value_type(zeroed) == VAL_NIL && value_equals(&zeroed, &nil));
+    double const numbers[] = { 0.0, -0.0, 1.5, -3.0, 1e308, -1e-308, 1.0 / 0.0, -1.0 / 0.0 };
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+        value_t const v = value_number(numbers[i]);
+        assert(value_type(v) == VAL_NUMBER && value_as_number(v) == numbers[i]);
+        assert(value_is_truthy(&v) == (numbers[i] != 0.0));
+    }
+    value_t const pos_zero = value_number(0.0), neg_zero = value_number(-0.0);
+    value_t const nan = value_number(0.0 / 0.0);
+    assert(value_equals(&pos_zero, &neg_zero) && !value_equals(&nan, &nan));
+    assert(value_type(nan) == VAL_NUMBER && value_as_number(nan) != value_as_number(nan));
+    value_t const t = value_bool(true), f = value_bool(false);
+    assert(value_type(t) == VAL_BOOL && value_as_bool(t) && value_is_truthy(&t));
+    assert(value_type(f) == VAL_BOOL && !value_as_bool(f) && !value_is_truthy(&f));
+    assert(!value_equals(&f, &nil) && !value_equals(&f, &pos_zero));
+    obj_string_t * p_hello = obj_string_new("hello");
+    value_t o = value_object((object_t*)p_hello);
+    assert(value_type(o) == VAL_OBJ && value_as_object(o) == (object_t*)p_hello);
+    assert(value_is_truthy(&o));
+#ifndef LOX_GC
+    assert(p_hello->header.refcount == 1);
+#endif
+    value_free(&o);
+    assert(value_type(o) == VAL_NIL);
+#ifdef LOX_NAN_BOXING
+    assert(sizeof(value_t) == 8);
+#endif
+    printf("Passed value representation test.\n");
+
+    printf("=== Test 11: string interning ===\n");
+    size_t const interned = obj_string_interned();
+    obj_string_t * p_ab = obj_string_new("ab");
+    assert(obj_string_copy("abc", 2) == p_ab && obj_string_interned() == interned + 1);
+    obj_string_t * p_a = obj_string_new("a");
+    obj_string_t * p_b = obj_string_copy("b", 1);
+    assert(obj_string_concat(p_a, p_b) == p_ab);
+    value_t v_ab = value_object((object_t*)p_ab);
+    value_t const v_cat = value_object((object_t*)obj_string_concat(p_a, p_b));
+    assert(value_equals(&v_ab, &v_cat));
+    assert(p_ab->hash == hash_string("ab") && strcmp(p_ab->chars, "ab") == 0);
+    // one block, short strings all in the inline size class
+    assert((void*)p_ab->chars == (void*)(p_ab + 1));
+    assert(obj_string_size(0) == obj_string_size(OBJ_STRING_INLINE));
+    assert(obj_string_size(OBJ_STRING_INLINE + 1) == sizeof(obj_string_t) + OBJ_STRING_INLINE + 2);
+    value_t v_a = value_object((object_t*)p_a), v_b = value_object((object_t*)p_b);
+    assert(!value_equals(&v_a, &v_b));
+#ifndef LOX_GC
+    // the table is weak, dead strings leave it
+    assert(p_ab->header.refcount == 2);
+    value_free(&v_a);
+    value_free(&v_b);
+    assert(obj_string_interned() == interned + 1);
+    obj_string_t * p_a2 = obj_string_new("a");
+    assert(obj_string_interned() == interned + 2 && p_a2->header.refcount == 0);
+    value_t v_a2 = value_object((object_t*)p_a2);
+    value_free(&v_a2);
+    value_free(&v_ab);
+    obj_dec_ref((object_t*)p_ab);
+    assert(obj_string_interned() == interned);
+#endif
+    printf("Passed string interning test.\n");
+
+    printf("=== Test 12: ropes ===\n");
+    // s = s + piece, 20000 times
+    size_t const pieces = 20000;
+    obj_string_t * p_piece = obj_string_new("xyz");
+    value_t v_piece = value_object((object_t*)p_piece);
+    value_t v_s = value_object((object_t*)obj_string_new(""));
+    for (size_t i = 0; i < pieces; i++) {
+        value_t const next = value_object(obj_concat(value_as_object(v_s), (object_t*)p_piece));
+        value_free(&v_s);
+        v_s = next;
+    }
+    object_t * p_rope = value_as_object(v_s);
+    assert(p_rope->type == OBJ_ROPE && obj_string_length(p_rope) == pieces * 3);
+    // short results stay flat and interned
+    value_t const v_short = value_object(obj_concat((object_t*)p_piece, (object_t*)p_piece));
+    assert(value_as_object(v_short)->type == OBJ_STRING &&
+        value_as_object(v_short) == (object_t*)obj_string_new("xyzxyz"));
+    obj_string_t const * p_flat = obj_as_string(p_rope);
+    assert(p_flat->length == pieces * 3 && strncmp(p_flat->chars, "xyzxyzxyz", 9) == 0);
+    assert(strcmp(p_flat->chars + p_flat->length - 3, "xyz") == 0);
+    assert(obj_as_string(p_rope) == p_flat && ((obj_rope_t*)p_rope)->left == nullptr);
+    // equal to the same contents built another way
+    value_t v_other = value_object(obj_concat((object_t*)obj_string_copy(p_flat->chars, 60),
+        (object_t*)obj_string_copy(p_flat->chars + 60, p_flat->length - 60)));
+    assert(value_as_object(v_other)->type == OBJ_ROPE && value_equals(&v_s, &v_other));
+    value_t const v_flat = value_object((object_t*)p_flat);
+    assert(value_equals(&v_other, &v_flat) && !value_equals(&v_other, &v_short));
+    value_free(&v_other);
+    // an unflattened chain is freed without recursion
+    value_t v_chain = value_object((object_t*)obj_string_new(""));
+    for (size_t i = 0; i < 200000; i++) {
+        value_t const next = value_object(obj_concat(value_as_object(v_chain), (object_t*)p_piece));
+        value_free(&v_chain);
+        v_chain = next;
+    }
+    value_free(&v_chain);
+    value_free(&v_s);
+    value_free(&v_piece);
+    printf("Passed rope test.\n");
+
+    printf("=== Test 13: tracing collector ===\n");
+#ifdef LOX_GC
+    gc_collect();  // nothing above is rooted
+    gc_stats_t const before = gc_stats();
+    assert(before.objects == 0 && obj_string_interned() == 0);
+    gc_test_roots_t roots = {0};
+    gc_add_roots(gc_test_mark, &roots);
+    roots.values[0] = value_object((object_t*)obj_string_new("kept"));
+    // a rope keeps its pieces alive until it is flattened
+    object_t * p_left = (object_t*)obj_string_new("the left piece, which is long enough that the concatenation ");
+    object_t * p_right = (object_t*)obj_string_new("becomes a rope");
+    roots.values[1] = value_object(obj_concat(p_left, p_right));
+    for (int i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "garbage%d", i);
+        obj_string_new(name);
+    }
+    assert(gc_stats().objects == 104 && obj_string_interned() == 103);
+    gc_collect();
+    assert(gc_stats().objects == 4 && obj_string_interned() == 3);
+    assert(gc_stats().bytes_allocated < before.bytes_allocated + 1024);
+    // dead strings left the weak intern table, live ones are found again
+    assert(obj_string_new("kept") == (obj_string_t*)value_as_object(roots.values[0]));
+    assert(obj_string_interned() == 3 && obj_as_string(value_as_object(roots.values[1])));
+    assert(gc_stats().objects == 5 && obj_string_interned() == 4);
+    gc_collect();
+    assert(gc_stats().objects == 3 && obj_string_interned() == 2);  // the flat string, no pieces
+    // the heap growth trigger
+    size_t const collections = gc_stats().collections;
+    gc_safepoint();
+    assert(gc_stats().collections == collections);
+    for (int i = 0; gc_stats().bytes_allocated <= gc_stats().next_gc; i++) {
+        snprintf(name, sizeof(name), "fill%d", i);
+        obj_string_new(name);
+    }
+    // a cycle runs in steps, one per safe point
+    size_t steps = 0;
+    do {
+        gc_safepoint();
+        steps++;
+    } while (gc_stats().collecting);
+    assert(steps > 2 && gc_stats().pauses >= steps);
+    assert(gc_stats().collections == collections + 1 && gc_stats().objects == 3);
+    assert(gc_stats().next_gc >= GC_MIN_HEAP &&
+        gc_stats().next_gc >= gc_stats().bytes_allocated * GC_HEAP_GROW_FACTOR);
+    gc_remove_roots(gc_test_mark, &roots);
+    gc_collect();
+    assert(gc_stats().objects == 0);
+    printf("Passed tracing collector test.\n");
+#else
+    printf("Skipped, built without LOX_GC.\n");
+#endif
+
+    printf("=== Test 14: nursery ===\n");
+#ifdef LOX_GC
+    gc_add_roots(gc_test_mark, &roots);
+    roots.values[0] = value_object((object_t*)obj_string_new("survivor"));
+    roots.values[1] = value_nil();
+    object_t * p_young = value_as_object(roots.values[0]);
+    assert(gc_is_young(p_young) && gc_stats().young_objects == 1);
+    for (int i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "young%d", i);
+        obj_string_new(name);
+    }
+    size_t const old_objects = gc_stats().objects - gc_stats().young_objects;
+    size_t const minors = gc_stats().minor_collections;
+    gc_collect_minor();
+    // the survivor was copied out and its root updated, the rest is gone
+    object_t * p_promoted = value_as_object(roots.values[0]);
+    assert(p_promoted != p_young && !gc_is_young(p_promoted));
+    assert(gc_stats().minor_collections == minors + 1 && gc_stats().young_objects == 0);
+    assert(gc_stats().objects == old_objects + 1 && gc_stats().nursery_used == 0);
+    assert(obj_string_new("survivor") == (obj_string_t*)p_promoted);
+    assert(obj_string_interned() == old_objects + 1);
+    // an old rope pointing at a young string is found through the barrier
+    object_t * p_long = (object_t*)obj_string_new("a string long enough to make the concatenation below a rope, ");
+    roots.values[1] = value_object(obj_concat(p_long, p_promoted));
+    gc_collect_minor();
+    object_t * p_rope_old = value_as_object(roots.values[1]);
+    assert(p_rope_old->type == OBJ_ROPE && !gc_is_young(p_rope_old));
+    obj_string_t * p_flat_young = obj_as_string(p_rope_old);
+    assert(gc_is_young((object_t*)p_flat_young) && p_rope_old->remembered);
+    gc_collect_minor();
+    obj_string_t const * p_flat_old = ((obj_rope_t*)p_rope_old)->flat;
+    assert(p_flat_old != p_flat_young && !gc_is_young((object_t const*)p_flat_old));
+    assert(!p_rope_old->remembered && p_flat_old->length == obj_string_length(p_rope_old));
+    assert(obj_string_copy(p_flat_old->chars, p_flat_old->length) == p_flat_old);
+    // overflowing the nursery allocates old until a safe point empties it
+    for (int i = 0; gc_stats().nursery_used + 64 <= GC_NURSERY_SIZE; i++) {
+        snprintf(name, sizeof(name), "fill%d", i);
+        obj_string_new(name);
+    }
+    assert(!gc_is_young((object_t*)obj_string_new("overflowed")));
+    // and large objects always start old
+    assert(!gc_is_young((object_t*)obj_string_copy(big_string, GC_NURSERY_MAX_OBJECT)));
+    gc_safepoint();
+    assert(gc_stats().young_objects == 0 && gc_stats().nursery_used == 0);
+    gc_remove_roots(gc_test_mark, &roots);
+    gc_collect();
+    assert(gc_stats().objects == 0 && obj_string_interned() == 0);
+    printf("Passed nursery test.\n");
+#else
+    printf("Skipped, built without LOX_GC.\n");
+#endif
+
+    printf("=== Test 15: incremental cycles ===\n");
+#ifdef LOX_GC
+    gc_add_roots(gc_test_mark, &roots);
+    // old strings kept only by the intern table once the roots are cleared,
+    // the first ones rooted are promoted first and swept last
+    roots.values[0] = value_object((object_t*)obj_string_new("found while marking"));
+    roots.values[1] = value_object((object_t*)obj_string_new("found while sweeping"));
+    for (int i = 2; i < GC_TEST_ROOTS; i++) {
+        snprintf(name, sizeof(name), "pad%d", i);
+        roots.values[i] = value_object((object_t*)obj_string_new(name));
+    }
+    gc_collect();
+    object_t * p_marking = value_as_object(roots.values[0]);
+    object_t * p_sweeping = value_as_object(roots.values[1]);
+    for (int i = 0; i < GC_TEST_ROOTS; i++) roots.values[i] = value_nil();
+    assert(obj_string_interned() == GC_TEST_ROOTS);
+
+    gc_set_step_work(1);
+    gc_start();
+    assert(gc_stats().marking);
+    // a lookup hands out a white string, storing it into a scanned root
+    // goes through the barrier
+    roots.values[0] = value_object((object_t*)obj_string_new("found while marking"));
+    gc_value_barrier(&roots.values[0]);
+    assert(value_as_object(roots.values[0]) == p_marking);
+    while (gc_stats().marking) gc_safepoint();
+    assert(gc_stats().collecting && obj_string_interned() > 2);
+    roots.values[1] = value_object((object_t*)obj_string_new("found while sweeping"));
+    gc_value_barrier(&roots.values[1]);
+    assert(value_as_object(roots.values[1]) == p_sweeping);
+    size_t const pauses = gc_stats().pauses;
+    while (gc_stats().collecting) gc_safepoint();
+    assert(gc_stats().pauses > pauses + GC_TEST_ROOTS / 2);
+    // only the two resurrected strings are left
+    assert(obj_string_interned() == 2 && gc_stats().objects == 2);
+    assert(obj_string_new("found while marking") == (obj_string_t*)p_marking);
+    assert(obj_string_new("found while sweeping") == (obj_string_t*)p_sweeping);
+
+    // a step size of 0 finishes a cycle in one pause
+    gc_set_step_work(0);
+    roots.values[0] = roots.values[1] = value_nil();
+    gc_start();
+    gc_safepoint();
+    assert(!gc_stats().collecting && gc_stats().objects == 0);
+    assert(gc_stats().pause_max_ns > 0 && gc_stats().pause_total_ns >= gc_stats().pause_max_ns);
+    gc_set_step_work(GC_STEP_WORK);
+    gc_remove_roots(gc_test_mark, &roots);
+    printf("Passed incremental cycle test.\n");
+#else
+    printf("Skipped, built without LOX_GC.\n");
+#endif
+
+    printf("=== Test 16: parallel marking, background sweep ===\n");
+#ifdef LOX_GC
+    gc_add_roots(gc_test_mark, &roots);
+    // chains of ropes over distinct pieces, and as many unrooted ones
+    char piece[41];
+    size_t live_objects = 0;
+    for (int round = 0; round < 2; round++) {
+        gc_set_threads(round == 0 ? 3 : 0);
+        size_t const parallel_marks = gc_stats().parallel_marks;
+        size_t const background_sweeps = gc_stats().background_sweeps;
+        for (int i = 0; i < 2 * GC_TEST_ROOTS; i++) {
+            object_t * chain = nullptr;
+            for (int j = 0; j < 64; j++) {
+                snprintf(piece, sizeof(piece), "%-40d", i * 64 + j);
+                object_t * leaf = (object_t*)obj_string_new(piece);
+                chain = chain ? obj_concat(chain, leaf) : leaf;
+            }
+            if (i < GC_TEST_ROOTS) roots.values[i] = value_object(chain);
+        }
+        gc_collect();
+        // the same survivors either way
+        if (round == 0) live_objects = gc_stats().objects;
+        assert(gc_stats().objects == live_objects && live_objects == (size_t)GC_TEST_ROOTS * 127);
+        for (int i = 0; i < GC_TEST_ROOTS; i++) {
+            obj_string_t const * p_flat = obj_as_string(value_as_object(roots.values[i]));
+            snprintf(piece, sizeof(piece), "%-40d", i * 64);
+            assert(p_flat->length == 64 * 40 && memcmp(p_flat->chars, piece, 40) == 0);
+            roots.values[i] = value_nil();
+        }
+        assert((gc_stats().parallel_marks > parallel_marks) == (round == 0));
+        assert((gc_stats().background_sweeps > background_sweeps) == (round == 0));
+    }
+    gc_collect();
+    assert(gc_stats().objects == 0 && obj_string_interned() == 0 && !gc_stats().sweeping);
+    gc_set_threads(GC_THREADS);
+    gc_remove_roots(gc_test_mark, &roots);
+    printf("Passed parallel collector test.\n");
+#else
+    printf("Skipped, built without LOX_GC.\n");
+#endif
+
+    printf("=== Test 17: compaction ===\n");
+#ifdef LOX_GC
+    gc_add_roots(gc_test_mark, &roots);
+    // strings of mixed sizes, one in 256 kept: a heap far bigger than what lives in it
+    char text[300];
+    int const kept = GC_TEST_ROOTS - 1;
+    for (int i = 0; i < 256 * kept; i++) {
+        snprintf(text, sizeof(text), "%0*d", 20 + i % 7 * 40, i);
+        obj_string_t * p_str = obj_string_new(text);
+        if (i % 256 == 0) roots.values[i / 256] = value_object((object_t*)p_str);
+    }
+    roots.values[kept] = value_object(obj_concat(value_as_object(roots.values[0]),
+        value_as_object(roots.values[1])));
+    gc_collect();
+    gc_stats_t const fragmented = gc_stats();
+    assert(fragmented.fragmentation > 0.9 && fragmented.pages == 0);
+    object_t * p_first = value_as_object(roots.values[0]);
+    gc_compact();
+    gc_stats_t const compacted = gc_stats();
+    assert(compacted.compactions == fragmented.compactions + 1 && compacted.pages == 1);
+    assert(compacted.heap_footprint < fragmented.heap_footprint / 4);
+    assert(compacted.objects == fragmented.objects && compacted.bytes_allocated == fragmented.bytes_allocated);
+    assert(value_as_object(roots.values[0]) != p_first);
+    // roots, the intern table and rope fields all follow the moved objects
+    for (int i = 0; i < kept; i++) {
+        snprintf(text, sizeof(text), "%0*d", 20 + i * 256 % 7 * 40, i * 256);
+        obj_string_t * p_str = (obj_string_t*)value_as_object(roots.values[i]);
+        assert(strcmp(p_str->chars, text) == 0 && obj_string_new(text) == p_str);
+    }
+    obj_rope_t const * p_kept_rope = (obj_rope_t*)value_as_object(roots.values[kept]);
+    assert(p_kept_rope->left == value_as_object(roots.values[0]));
+    assert(p_kept_rope->right == value_as_object(roots.values[1]));
+
+    // over the threshold, a safe point after the cycle compacts
+    gc_set_compaction(0.5);
+    for (int i = 0; i < 256 * kept; i++) {
+        snprintf(text, sizeof(text), "garbage %0*d", 20 + i % 7 * 40, i);
+        obj_string_new(text);
+    }
+    size_t const compactions = gc_stats().compactions;
+    gc_start();
+    for (int i = 0; i < 1000000 && gc_stats().compactions == compactions; i++) gc_safepoint();
+    assert(gc_stats().compactions == compactions + 1 && gc_stats().fragmentation < compacted.fragmentation + 0.01);
+    assert(gc_stats().objects == compacted.objects && gc_stats().pages == 1);
+    // a page that is all free goes
+    gc_set_compaction(0);
+    for (int i = 0; i < GC_TEST_ROOTS; i++) roots.values[i] = value_nil();
+    gc_collect();
+    assert(gc_stats().objects == 0 && gc_stats().pages == 0);
+    gc_remove_roots(gc_test_mark, &roots);
+    printf("Passed compaction test.\n");
+#else
+    printf("Skipped, built without LOX_GC.\n");
+#endif
+
     map_destroy(m3);
     map_destroy(m2);
     map_destroy(m1);
 
+    printf("=== Test 18: slab allocator ===\n");
+    slab_stats_t const slab_before = slab_stats();
+    void * blocks[SLAB_CLASSES];
+    size_t class_bytes = 0;
+    for (size_t i = 0; i < SLAB_CLASSES; i++) {
+        size_t const size = (i + 1) * SLAB_GRANULE;
+        blocks[i] = slab_alloc(size);
+        assert(((uintptr_t)blocks[i] & (SLAB_GRANULE - 1)) == 0);
+        memset(blocks[i], 0xab, size);
+        class_bytes += size;
+    }
+    slab_stats_t const slab_full = slab_stats();
+    assert(slab_full.allocations == slab_before.allocations + SLAB_CLASSES);
+    assert(slab_full.bytes_in_use == slab_before.bytes_in_use + class_bytes);
+    for (size_t i = 0; i < SLAB_CLASSES; i++) assert(slab_full.in_use[i] == slab_before.in_use[i] + 1);
+    // a freed block is the next one out of its class, whatever size in the class asks
+    slab_free(blocks[2], 3 * SLAB_GRANULE);
+    assert(slab_alloc(2 * SLAB_GRANULE + 1) == blocks[2]);
+    // larger requests are malloc's
+    void * p_large = slab_alloc(SLAB_MAX_SIZE + 1);
+    assert(slab_stats().large == slab_before.large + 1 && slab_stats().bytes_in_use == slab_full.bytes_in_use);
+    slab_free(p_large, SLAB_MAX_SIZE + 1);
+    for (size_t i = 0; i < SLAB_CLASSES; i++) slab_free(blocks[i], (i + 1) * SLAB_GRANULE);
+    assert(slab_stats().bytes_in_use == slab_before.bytes_in_use);
+    assert(slab_stats().frees == slab_before.frees + SLAB_CLASSES + 2);
+    // teardown: every chunk at once, whatever is still allocated from them
+    assert(slab_stats().chunks > 0);
+    slab_release_all();
+    assert(slab_stats().chunks == 0 && slab_stats().bytes_in_use == 0 && slab_stats().bytes_reserved == 0);
+    printf("Passed slab allocator test.\n");
+
+    printf("=== Test 19: in-place append to unique strings ===\n");
+    value_t v_unique = value_object((object_t*)obj_string_new("unique"));
+    value_t v_tail = value_object((object_t*)obj_string_new("!"));
+    object_t * p_unique = value_as_object(v_unique);
+    object_t * p_appended = obj_concat_unique(p_unique, value_as_object(v_tail));
+#ifdef LOX_GC
+    assert(!p_appended);
+    value_free(&v_unique);
+#else
+    // the only reference, the block just grows: same object, re-interned under its new contents
+    assert(p_appended == p_unique);
+    value_t v_appended = value_object(p_appended);
+    assert(p_unique->refcount == 1);
+    assert(strcmp(obj_as_string(p_appended)->chars, "unique!") == 0);
+    assert((object_t*)obj_string_new("unique!") == p_appended);
+    assert(obj_string_hash("unique!", 7) == ((obj_string_t*)p_appended)->hash);
+    // shared, or appending to itself: left alone
+    value_t v_shared = value_dup(&v_appended);
+    assert(!obj_concat_unique(p_appended, value_as_object(v_tail)));
+    value_free(&v_shared);
+    assert(!obj_concat_unique(p_appended, p_appended));
+    // a result that already exists is handed out instead, the unique block goes
+    value_t v_existing = value_object((object_t*)obj_string_new("unique!!"));
+    size_t const unique_interned = obj_string_interned();
+    assert(obj_concat_unique(p_appended, value_as_object(v_tail)) == value_as_object(v_existing));
+    assert(obj_string_interned() == unique_interned - 1);
+    // no room left in the block: the caller concatenates as usual
+    value_t v_long = value_object((object_t*)obj_string_new("0123456789abcdef"));
+    object_t * p_wide = (object_t*)obj_string_new("0123456789abcdef0123456789abcdef");
+    assert(!obj_concat_unique(value_as_object(v_long), p_wide));
+    value_free(&v_long);
+    value_free(&v_existing);
+#endif
+    value_free(&v_tail);
+    printf("Passed in-place append test.\n");
+
+    printf("=== Test 20: biased reference counts across threads ===\n");
+#ifdef LOX_BIASED_RC
+    size_t const rc_interned = obj_string_interned();
+    value_t rc_shared[RC_TEST_SHARED];
+    char rc_text[41];
+    for (int i = 0; i < RC_TEST_SHARED; i++) {
+        snprintf(rc_text, sizeof(rc_text), "%-40d", i);
+        rc_shared[i] = value_object((object_t*)obj_string_new(rc_text));
+    }
+    object_t * p_first = value_as_object(rc_shared[0]);
+    // the owner counts without atomics, environment drops wait for a flush
+    value_t v_more = value_dup(&rc_shared[0]);
+    value_t v_most = value_dup(&rc_shared[0]);
+    assert(p_first->refcount == 3 && atomic_load(&p_first->shared) == 0);
+    obj_dec_ref_deferred(value_as_object(v_more));
+    obj_dec_ref_deferred(value_as_object(v_most));
+    assert(p_first->refcount == 3);
+    obj_rc_flush();
+    assert(p_first->refcount == 1);
+    // a rope is flattened before it crosses threads
+    value_t v_rc_rope = value_object(obj_concat(p_first, value_as_object(rc_shared[1])));
+    assert(value_as_object(v_rc_rope)->type == OBJ_ROPE);
+    obj_share(value_as_object(v_rc_rope));
+    assert(((obj_rope_t*)value_as_object(v_rc_rope))->flat);
+    value_free(&v_rc_rope);
+
+    rc_worker_t rc_workers[RC_TEST_THREADS];
+    thrd_t rc_threads[RC_TEST_THREADS];
+    for (int i = 0; i < RC_TEST_THREADS; i++) {
+        snprintf(rc_text, sizeof(rc_text), "handed over %d", i);
+        rc_workers[i] = (rc_worker_t){
+            .shared = rc_shared,
+            .handed = value_dup(&rc_shared[i]),
+            .last = value_object((object_t*)obj_string_new(rc_text)),
+        };
+    }
+    for (int i = 0; i < RC_TEST_THREADS; i++)
+        assert(thrd_create(&rc_threads[i], rc_worker, &rc_workers[i]) == thrd_success);
+    for (int i = 0; i < RC_TEST_THREADS; i++) thrd_join(rc_threads[i], nullptr);
+    for (int i = 0; i < RC_TEST_THREADS; i++) assert(rc_workers[i].equal == RC_TEST_ROUNDS);
+    // what the workers dropped of main's counts came back through its queue:
+    // the handed over strings are gone, the rest are back to one reference
+    obj_rc_flush();
+    assert(obj_string_interned() == rc_interned + RC_TEST_SHARED);
+    for (int i = 0; i < RC_TEST_SHARED; i++) {
+        object_t * o = value_as_object(rc_shared[i]);
+        assert(o->refcount == 1 && atomic_load(&o->shared) == 0);
+        value_free(&rc_shared[i]);
+    }
+    assert(obj_string_interned() == rc_interned);
+    printf("Passed biased reference count test.\n");
+#else
+    printf("Skipped, built without LOX_BIASED_RC.\n");
+#endif
+
 
 
 
@@ -2,14 +2,255 @@
 // Created by adrian on 2025-10-12.
 //
 
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+// <signal.h> has a stack_t of its own, the resolver's is extra/Stack.h
+#define stack_t signal_stack_t
+#include <sys/wait.h>
+#undef stack_t
+#include <unistd.h>
+#endif
 #include "resolver.h"
+#include "scanner.h"
+#include "parser.h"
+#include "stmt.h"
+#include "object.h"
 
-int run_resolver_tests(resolver_t * p_resolver) {
-    char * test_strings[] = {
-        "var a = \"outer\"; { print a; var a = \"inner\"; print a; } print a;",
-        "var a = a; // should report \"can't read local variable in its own initializer\"",
-        "class A { init() { return 1; } } // init returning a value should be error",
-        "class B < A { method() { super.method(); } } // test super resolution",
+void run_resolver_tests(void);
+
+// not parsed yet:
+//  "var a = a; // should report \"can't read local variable in its own initializer\"",
+//  "class A { init() { return 1; } } // init returning a value should be error",
+//  "class B < A { method() { super.method(); } } // test super resolution",
+
+typedef struct {
+    list_t tokens;     // List<token_t*>
+    list_t statements; // List<stmt_t*>
+    resolver_t resolver;
+    interpreter_t interpreter;
+} script_t;
+
+static list_t parse_source(char const * source, list_t * p_tokens) {
+    scanner_t scanner = { .start = source };
+    *p_tokens = scan_tokens(&scanner);
+    parser_t parser = { .tokens = *p_tokens };
+    return parse(&parser);
+}
+static void script_resolve(script_t * p_script, char const * source) {
+    *p_script = (script_t){0};
+    p_script->statements = parse_source(source, &p_script->tokens);
+    p_script->resolver.interpreter = &p_script->interpreter;
+    resolve(&p_script->resolver, &p_script->statements);
+}
+static void script_free(script_t * p_script) {
+    free_interpreter(&p_script->interpreter);
+    free_resolver(&p_script->resolver);
+    list_free(&p_script->tokens);
+    list_free(&p_script->statements);
+}
+static stmt_t * statement_at(script_t const * p_script, size_t const i) {
+    return p_script->statements.data[i];
+}
+static stmt_block_t * block_at(script_t const * p_script, size_t const i) {
+    stmt_t * p_stmt = statement_at(p_script, i);
+    assert(p_stmt->type == STMT_BLOCK);
+    return &p_stmt->as.block_stmt;
+}
+
+static void run_source(void const * source) {
+    script_t script;
+    script_resolve(&script, source);
+    interpret(&script.interpreter, &script.statements);
+    script_free(&script);
+}
+
+/*
+ * Runs fn in a child process, since the interpreter prints its results and
+ * exits on runtime errors. Returns the child's exit status, stdout and
+ * stderr go to output.
+ */
+static int run_in_child(void (*fn)(void const *), void const * arg,
+    char * output, size_t const output_size) {
+#ifdef WIN32
+    (void)fn; (void)arg; (void)output; (void)output_size;
+    return -1;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) exit(EXIT_FAILURE);
+    // whatever is still buffered would be written by the child as well
+    fflush(stdout);
+    fflush(stderr);
+    pid_t const pid = fork();
+    if (pid < 0) exit(EXIT_FAILURE);
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[1]);
+        fn(arg);
+        exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    size_t length = 0;
+    ssize_t n;
+    while ((n = read(fds[0], output + length, output_size - 1 - length)) > 0)
+        length += (size_t)n;
+    output[length] = '\0';
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+static void check_output(char const * source, char const * expected) {
+    char output[1024];
+    int const status = run_in_child(run_source, source, output, sizeof(output));
+    if (status != EXIT_SUCCESS || strcmp(output, expected) != 0) {
+        fprintf(stderr, "Script: %s\nExpected:\n%sGot (exit %d):\n%s", source, expected, status, output);
+        assert(false);
+    }
+}
+static void check_error(char const * source, char const * expected) {
+    char output[1024];
+    int const status = run_in_child(run_source, source, output, sizeof(output));
+    if (status != EXIT_FAILURE || !strstr(output, expected)) {
+        fprintf(stderr, "Script: %s\nExpected error: %sGot (exit %d):\n%s", source, expected, status, output);
+        assert(false);
+    }
+}
+
+/*
+ * A block declaring a function captures its locals, so they live in an
+ * environment. Functions are not parsed yet: the body of a second block is
+ * spliced in as the function `f` referencing `a`.
+ */
+static void run_with_closure(void const * arg) {
+    (void)arg;
+    script_t script;
+    script = (script_t){0};
+    script.statements = parse_source(
+        "{ var a = \"env\"; print a; a = a + \"!\"; print a; }", &script.tokens);
+    list_t body_tokens;
+    list_t body = parse_source("{ print a; }", &body_tokens);
+    stmt_block_t const * p_body = &((stmt_t*)body.data[0])->as.block_stmt;
+    stmt_t function = {
+        .type = STMT_FUNCTION,
+        .as.function_stmt = {
+            .name = &(token_t){ .type = IDENTIFIER, .lexeme = "f", .line = 1, .hash = hash_string("f") },
+            .body = p_body->statements,
+            .count = p_body->count,
+        },
     };
-    return 0;
+    stmt_block_t * p_block = block_at(&script, 0);
+    p_block->statements = realloc(p_block->statements, (p_block->count + 1) * sizeof(stmt_t*));
+    if (!p_block->statements) exit(EXIT_FAILURE);
+    p_block->statements[p_block->count++] = &function;
+
+    script.resolver.interpreter = &script.interpreter;
+    resolve(&script.resolver, &script.statements);
+    stmt_var_t const * p_var = &p_block->statements[0]->as.var_stmt;
+    assert(p_block->needs_environment);
+    assert(p_var->captured && p_var->slot == -1);
+    interpret(&script.interpreter, &script.statements);
+
+    p_block->count--;
+    script_free(&script);
+    list_free(&body_tokens);
+    list_free(&body);
+}
+
+// What a block's locals held is dropped when the block ends, not when the slot is reused
+static void run_block_release(void const * arg) {
+    (void)arg;
+    script_t script;
+    script_resolve(&script, "var s = \"kept\"; { var t = s + \" for now\"; print t; }");
+    assert(block_at(&script, 1)->slot_count == 1);
+    interpret(&script.interpreter, &script.statements);
+    assert(script.interpreter.stack_top == 0);
+#ifndef LOX_GC
+    // only the global's "kept" is left, the concatenation went with the block
+    assert(obj_string_interned() == 1);
+#endif
+    script_free(&script);
+}
+
+void run_resolver_tests(void) {
+#ifdef WIN32
+    printf("Skipped resolver tests, they run scripts in child processes.\n");
+    return;
+#endif
+    script_t script;
+
+    printf("=== Resolver test 1: frame slots ===\n");
+    script_resolve(&script, "{ var a = \"x\"; var b = a + \"y\"; print b; }");
+    stmt_block_t const * p_block = block_at(&script, 0);
+    assert(!p_block->needs_environment);
+    assert(p_block->first_slot == 0 && p_block->slot_count == 2);
+    assert(p_block->statements[0]->as.var_stmt.slot == 0);
+    assert(p_block->statements[1]->as.var_stmt.slot == 1);
+    script_free(&script);
+    check_output("{ var a = \"x\"; var b = a + \"y\"; print b; a = \"z\"; print a + b; }",
+        "xy\nzxy\n");
+    check_output("var a = \"outer\"; { print a; var a = \"inner\"; print a; } print a;",
+        "outer\ninner\nouter\n");
+    printf("Passed frame slot tests.\n");
+
+    printf("=== Resolver test 2: sibling scopes reuse slots ===\n");
+    script_resolve(&script, "{ { var a = 1; } { var b = 2; var c = 3; } }");
+    stmt_block_t const * p_outer = block_at(&script, 0);
+    stmt_block_t const * p_first = &p_outer->statements[0]->as.block_stmt;
+    stmt_block_t const * p_second = &p_outer->statements[1]->as.block_stmt;
+    assert(p_outer->slot_count == 0);
+    assert(p_first->first_slot == 0 && p_first->slot_count == 1);
+    assert(p_second->first_slot == 0 && p_second->slot_count == 2);
+    script_free(&script);
+    check_output("{ { var a = \"first\"; print a; } { var b; print b; var c = \"second\"; print c; } }",
+        "first\nnil\nsecond\n");
+    printf("Passed sibling scope tests.\n");
+
+    printf("=== Resolver test 3: blocks without declarations ===\n");
+    script_resolve(&script, "var g = 1; { { print g; } }");
+    p_block = block_at(&script, 1);
+    assert(!p_block->needs_environment && p_block->slot_count == 0);
+    assert(!p_block->statements[0]->as.block_stmt.needs_environment);
+    script_free(&script);
+    check_output("var g = \"g\"; { print g; { g = g + \"!\"; print g; } } print g;",
+        "g\ng!\ng!\n");
+    printf("Passed declaration-free block tests.\n");
+
+    printf("=== Resolver test 4: captured locals ===\n");
+    char output[1024];
+    int const status = run_in_child(run_with_closure, NULL, output, sizeof(output));
+    if (status != EXIT_SUCCESS || strcmp(output, "env\nenv!\n") != 0) {
+        fprintf(stderr, "Got (exit %d):\n%s", status, output);
+        assert(false);
+    }
+    printf("Passed captured local tests.\n");
+
+    printf("=== Resolver test 5: global slots ===\n");
+    script_resolve(&script, "var a = 1; var b = 2; var a = 3;");
+    assert(statement_at(&script, 0)->as.var_stmt.global == 0);
+    assert(statement_at(&script, 1)->as.var_stmt.global == 1);
+    // redefining a global keeps its index
+    assert(statement_at(&script, 2)->as.var_stmt.global == 0);
+    assert(script.interpreter.globals_count == 2);
+    script_free(&script);
+    check_output("var a = 1; var b = 2; var a = 3; print a + b; b = a; print b;",
+        "5.000000\n3.000000\n");
+    printf("Passed global slot tests.\n");
+
+    printf("=== Resolver test 6: undefined variables ===\n");
+    check_error("print missing;", "Undefined variable 'missing' at line 1.");
+    check_error("var a = 1;\nmissing = a;", "Undefined variable 'missing' at line 2.");
+    // a local is gone once its block ends
+    check_error("{ var a = \"x\"; } print a;", "Undefined variable 'a' at line 1.");
+    printf("Passed undefined variable tests.\n");
+
+    printf("=== Resolver test 7: slots released at block end ===\n");
+    assert(run_in_child(run_block_release, NULL, output, sizeof(output)) == EXIT_SUCCESS);
+    assert(strcmp(output, "kept for now\n") == 0);
+    printf("Passed slot release tests.\n");
 }
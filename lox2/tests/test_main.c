@@ -15,6 +15,7 @@
 extern void run_scanner_tests(scanner_t * p_scanner);
 extern void run_parser_tests(parser_t * p_parser);
 extern void run_map_tests(void);
+extern void run_resolver_tests(void);
 
 int main() {
 #ifdef WIN32
@@ -27,6 +28,8 @@ int main() {
     // parser_t parser = { 0 };
     // run_parser_tests(&parser);
 
+    // forks for every script, so before the map tests start any threads
+    run_resolver_tests();
     run_map_tests();
 
 
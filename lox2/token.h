@@ -7,6 +7,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include "utils/hash.h"
 
 typedef enum
 {
@@ -101,19 +102,26 @@ typedef struct {
     token_type_t    type;
     char *          lexeme;
     size_t          line;
+    size_t          hash; // hash_string(lexeme) for identifiers, 0 otherwise
 } token_t;
 
-static inline token_t * new_token(token_type_t const type, char const * lexeme, size_t const line) {
+static inline token_t * new_token_hashed(token_type_t const type, char const * lexeme,
+    size_t const line, size_t const hash) {
     token_t * token = malloc(sizeof(token_t));
     token->type = type;
     size_t const  lexeme_len = strlen(lexeme);
     token->lexeme = malloc(lexeme_len + 1);
     strncpy(token->lexeme, lexeme, lexeme_len + 1);
     token->line = line;
+    token->hash = hash;
     return token;
 }
+static inline token_t * new_token(token_type_t const type, char const * lexeme, size_t const line) {
+    // identifiers are hashed once here and reused for every name lookup
+    return new_token_hashed(type, lexeme, line, type == IDENTIFIER ? hash_string(lexeme) : 0);
+}
 static inline token_t * copy_token(token_t const * token) {
-    return new_token(token->type, token->lexeme, token->line);
+    return new_token_hashed(token->type, token->lexeme, token->line, token->hash);
 }
 // TODO put stuff into .c file
 static inline void token_free(void ** pp_token) {
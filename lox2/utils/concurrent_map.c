@@ -0,0 +1,366 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#include "concurrent_map.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+/*
+ * Each shard is an open addressing table with linear probing whose slots
+ * point at immutable nodes (hash and key never change, the value is an
+ * atomic word). A slot is empty (NULL, ends a probe), a tombstone, or a
+ * node. Writers fill a node completely before publishing it with a release
+ * store, so a reader that loads the slot with acquire sees it whole. Growing
+ * builds a new table pointing at the same nodes and publishes it the same
+ * way; a reader still walking the old one finds the same nodes.
+ *
+ * Removed nodes and replaced tables are retired instead of freed. Every
+ * reader announces the global epoch while it runs; the epoch only advances
+ * once all active readers have seen the current one, and a retired block is
+ * freed two advances after it was retired, when no reader that could have
+ * loaded it is left.
+ */
+
+#define CMAP_MIN_CAPACITY 16
+
+typedef struct {
+    size_t hash;  // mixed
+    void * key;
+    _Atomic(void *) value;
+} cmap_node_t;
+
+static cmap_node_t g_tombstone;
+#define TOMBSTONE (&g_tombstone)
+
+typedef struct {
+    size_t capacity;  // power of two
+    _Atomic(cmap_node_t *) slots[];
+} cmap_table_t;
+
+typedef struct {
+    void * block;
+    bool is_table;
+    size_t epoch;
+} retired_t;
+
+typedef struct {
+    mtx_t lock;                       // held by writers only
+    _Atomic(cmap_table_t *) table;
+    _Atomic size_t count;             // written under lock
+    size_t tombstones;
+    retired_t * retired;
+    size_t retired_count;
+    size_t retired_capacity;
+    char padding[64];                 // keeps neighbouring shards' locks apart
+} cmap_shard_t;
+
+struct cmap {
+    cmap_config_t config;
+    cmap_shard_t shards[CMAP_SHARDS];
+};
+
+// Epochs, shared by every map. Advancing by 2 leaves bit 0 to mark a reader
+// slot as active: it holds the epoch it entered in | 1, or 0.
+typedef struct {
+    _Atomic size_t epoch;
+    atomic_bool in_use;
+    char padding[48];
+} reader_slot_t;
+
+static _Atomic size_t g_epoch = 2;
+static reader_slot_t g_readers[CMAP_MAX_THREADS];
+static once_flag g_readers_once = ONCE_FLAG_INIT;
+static tss_t g_reader_key;
+static thread_local reader_slot_t * t_reader = NULL;
+
+static void release_reader(void * p_slot) {
+    reader_slot_t * slot = p_slot;
+    atomic_store(&slot->epoch, 0);
+    atomic_store(&slot->in_use, false);
+}
+static void init_readers(void) {
+    if (tss_create(&g_reader_key, release_reader) != thrd_success) {
+        fprintf(stderr, "cmap: failed to create thread storage\n");
+        exit(EXIT_FAILURE);
+    }
+}
+static reader_slot_t * current_reader(void) {
+    if (t_reader) return t_reader;
+    call_once(&g_readers_once, init_readers);
+    for (size_t i = 0; i < CMAP_MAX_THREADS; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&g_readers[i].in_use, &expected, true)) {
+            t_reader = &g_readers[i];
+            tss_set(g_reader_key, t_reader);
+            return t_reader;
+        }
+    }
+    fprintf(stderr, "cmap: more than %d threads\n", CMAP_MAX_THREADS);
+    exit(EXIT_FAILURE);
+}
+static void epoch_enter(reader_slot_t * reader) {
+    atomic_store(&reader->epoch, atomic_load(&g_epoch) | 1);
+    // the announcement must be visible before any table or node is loaded
+    atomic_thread_fence(memory_order_seq_cst);
+}
+static void epoch_exit(reader_slot_t * reader) {
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+// Advances the epoch if every active reader is in the current one
+static size_t epoch_try_advance(void) {
+    size_t epoch = atomic_load(&g_epoch);
+    atomic_thread_fence(memory_order_seq_cst);
+    for (size_t i = 0; i < CMAP_MAX_THREADS; i++) {
+        size_t const seen = atomic_load(&g_readers[i].epoch);
+        if (seen != 0 && seen != (epoch | 1)) return epoch;
+    }
+    if (atomic_compare_exchange_strong(&g_epoch, &epoch, epoch + 2)) return epoch + 2;
+    return epoch;
+}
+
+static inline size_t mix_hash(size_t const hash) {
+    uint64_t h = (uint64_t)hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+static inline cmap_shard_t * shard_for(cmap_t * map, size_t const hash) {
+    // the low bits pick the slot, take the shard from the upper half
+    return &map->shards[(hash >> (sizeof(size_t) * 4)) & (CMAP_SHARDS - 1)];
+}
+
+static cmap_table_t * new_table(size_t const capacity) {
+    cmap_table_t * table = malloc(sizeof(cmap_table_t) + capacity * sizeof(table->slots[0]));
+    if (!table) exit(EXIT_FAILURE);
+    table->capacity = capacity;
+    for (size_t i = 0; i < capacity; i++) atomic_init(&table->slots[i], NULL);
+    return table;
+}
+static void free_node(cmap_t const * map, cmap_node_t * node) {
+    if (map->config.key_free) map->config.key_free(node->key);
+    free(node);
+}
+static void free_retired(cmap_t const * map, retired_t const * r) {
+    if (r->is_table) free(r->block);
+    else free_node(map, r->block);
+}
+// Called with the shard locked
+static void retire(cmap_t const * map, cmap_shard_t * shard, void * block, bool const is_table) {
+    if (shard->retired_count == shard->retired_capacity) {
+        shard->retired_capacity = shard->retired_capacity ? shard->retired_capacity * 2 : 16;
+        shard->retired = realloc(shard->retired, shard->retired_capacity * sizeof(retired_t));
+        if (!shard->retired) exit(EXIT_FAILURE);
+    }
+    shard->retired[shard->retired_count++] = (retired_t){ block, is_table, atomic_load(&g_epoch) };
+
+    size_t const epoch = epoch_try_advance();
+    size_t kept = 0;
+    for (size_t i = 0; i < shard->retired_count; i++) {
+        if (shard->retired[i].epoch + 4 <= epoch) free_retired(map, &shard->retired[i]);
+        else shard->retired[kept++] = shard->retired[i];
+    }
+    shard->retired_count = kept;
+}
+
+/*
+ * The key's node, or NULL, and its slot in *p_index if given. Safe for
+ * readers inside an epoch: the slot may be reused by the time they look
+ * again, so they read the node returned here, which stays valid until the
+ * epoch ends.
+ */
+static cmap_node_t * find_node(cmap_t const * map, cmap_table_t const * table,
+    void const * key, size_t const hash, size_t * p_index) {
+    size_t const mask = table->capacity - 1;
+    size_t index = hash & mask;
+    for (size_t n = 0; n < table->capacity; n++) {
+        cmap_node_t * node = atomic_load_explicit(&table->slots[index], memory_order_acquire);
+        if (!node) return NULL;
+        if (node != TOMBSTONE && node->hash == hash && map->config.key_equals(node->key, key)) {
+            if (p_index) *p_index = index;
+            return node;
+        }
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+// With the shard locked: the table after making room for one more key
+static cmap_table_t * reserve(cmap_t const * map, cmap_shard_t * shard) {
+    cmap_table_t * table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    size_t const count = atomic_load_explicit(&shard->count, memory_order_relaxed);
+    if ((count + shard->tombstones + 1) * 4 <= table->capacity * 3) return table;
+
+    size_t capacity = table->capacity;
+    while ((count + 1) * 2 > capacity) capacity *= 2;
+    cmap_table_t * grown = new_table(capacity);
+    for (size_t i = 0; i < table->capacity; i++) {
+        cmap_node_t * node = atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+        if (!node || node == TOMBSTONE) continue;
+        size_t j = node->hash & (capacity - 1);
+        while (atomic_load_explicit(&grown->slots[j], memory_order_relaxed))
+            j = (j + 1) & (capacity - 1);
+        atomic_store_explicit(&grown->slots[j], node, memory_order_relaxed);
+    }
+    atomic_store_explicit(&shard->table, grown, memory_order_release);
+    shard->tombstones = 0;
+    retire(map, shard, table, true);
+    return grown;
+}
+// With the shard locked and key known to be missing
+static void insert_node(cmap_t const * map, cmap_shard_t * shard, void const * key,
+    size_t const hash, void * value) {
+    cmap_table_t * table = reserve(map, shard);
+    size_t const mask = table->capacity - 1;
+    size_t index = hash & mask;
+    cmap_node_t * slot;
+    while ((slot = atomic_load_explicit(&table->slots[index], memory_order_relaxed)) && slot != TOMBSTONE)
+        index = (index + 1) & mask;
+    if (slot == TOMBSTONE) shard->tombstones--;
+
+    cmap_node_t * node = malloc(sizeof(cmap_node_t));
+    if (!node) exit(EXIT_FAILURE);
+    node->hash = hash;
+    node->key = map->config.key_copy ? map->config.key_copy(key) : (void *)key;
+    atomic_init(&node->value, value);
+    atomic_store_explicit(&table->slots[index], node, memory_order_release);
+    atomic_store_explicit(&shard->count,
+        atomic_load_explicit(&shard->count, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// API
+cmap_t * cmap_create(size_t const expected, cmap_config_t const * config) {
+    if (!config || !config->key_hash || !config->key_equals) return NULL;
+    cmap_t * map = malloc(sizeof(cmap_t));
+    if (!map) exit(EXIT_FAILURE);
+    map->config = *config;
+    size_t capacity = CMAP_MIN_CAPACITY;
+    while (capacity * CMAP_SHARDS < expected * 2) capacity *= 2;
+    for (size_t i = 0; i < CMAP_SHARDS; i++) {
+        cmap_shard_t * shard = &map->shards[i];
+        if (mtx_init(&shard->lock, mtx_plain) != thrd_success) {
+            fprintf(stderr, "cmap: failed to create a shard lock\n");
+            exit(EXIT_FAILURE);
+        }
+        atomic_init(&shard->table, new_table(capacity));
+        atomic_init(&shard->count, 0);
+        shard->tombstones = 0;
+        shard->retired = NULL;
+        shard->retired_count = 0;
+        shard->retired_capacity = 0;
+    }
+    return map;
+}
+
+void cmap_destroy(cmap_t * map) {
+    if (!map) return;
+    for (size_t i = 0; i < CMAP_SHARDS; i++) {
+        cmap_shard_t * shard = &map->shards[i];
+        cmap_table_t * table = atomic_load(&shard->table);
+        for (size_t j = 0; j < table->capacity; j++) {
+            cmap_node_t * node = atomic_load_explicit(&table->slots[j], memory_order_relaxed);
+            if (node && node != TOMBSTONE) free_node(map, node);
+        }
+        free(table);
+        for (size_t j = 0; j < shard->retired_count; j++) free_retired(map, &shard->retired[j]);
+        free(shard->retired);
+        mtx_destroy(&shard->lock);
+    }
+    free(map);
+}
+
+void * cmap_get(cmap_t * map, void const * key) {
+    if (!map || !key) return NULL;
+    return cmap_get_hashed(map, key, map->config.key_hash(key));
+}
+void * cmap_get_hashed(cmap_t * map, void const * key, size_t const key_hash) {
+    if (!map || !key) return NULL;
+    size_t const hash = mix_hash(key_hash);
+    cmap_shard_t * shard = shard_for(map, hash);
+    reader_slot_t * reader = current_reader();
+    epoch_enter(reader);
+    cmap_table_t const * table = atomic_load_explicit(&shard->table, memory_order_acquire);
+    cmap_node_t * node = find_node(map, table, key, hash, NULL);
+    void * value = node ? atomic_load_explicit(&node->value, memory_order_acquire) : NULL;
+    epoch_exit(reader);
+    return value;
+}
+bool cmap_contains(cmap_t * map, void const * key) {
+    if (!map || !key) return false;
+    size_t const hash = mix_hash(map->config.key_hash(key));
+    cmap_shard_t * shard = shard_for(map, hash);
+    reader_slot_t * reader = current_reader();
+    epoch_enter(reader);
+    cmap_table_t const * table = atomic_load_explicit(&shard->table, memory_order_acquire);
+    bool const found = find_node(map, table, key, hash, NULL) != NULL;
+    epoch_exit(reader);
+    return found;
+}
+
+bool cmap_put(cmap_t * map, void const * key, void * value) {
+    if (!map || !key) return false;
+    size_t const hash = mix_hash(map->config.key_hash(key));
+    cmap_shard_t * shard = shard_for(map, hash);
+    mtx_lock(&shard->lock);
+    cmap_table_t * table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    cmap_node_t * node = find_node(map, table, key, hash, NULL);
+    if (node) {
+        atomic_store_explicit(&node->value, value, memory_order_release);
+    } else {
+        insert_node(map, shard, key, hash, value);
+    }
+    mtx_unlock(&shard->lock);
+    return !node;
+}
+void * cmap_put_if_absent(cmap_t * map, void const * key, void * value) {
+    if (!map || !key) return NULL;
+    return cmap_put_if_absent_hashed(map, key, map->config.key_hash(key), value);
+}
+void * cmap_put_if_absent_hashed(cmap_t * map, void const * key, size_t const key_hash, void * value) {
+    if (!map || !key) return NULL;
+    // most calls find the key, try without the lock first
+    void * existing = cmap_get_hashed(map, key, key_hash);
+    if (existing) return existing;
+
+    size_t const hash = mix_hash(key_hash);
+    cmap_shard_t * shard = shard_for(map, hash);
+    mtx_lock(&shard->lock);
+    cmap_table_t * table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    cmap_node_t * node = find_node(map, table, key, hash, NULL);
+    if (node) {
+        value = atomic_load_explicit(&node->value, memory_order_relaxed);
+    } else {
+        insert_node(map, shard, key, hash, value);
+    }
+    mtx_unlock(&shard->lock);
+    return value;
+}
+bool cmap_remove(cmap_t * map, void const * key) {
+    if (!map || !key) return false;
+    size_t const hash = mix_hash(map->config.key_hash(key));
+    cmap_shard_t * shard = shard_for(map, hash);
+    mtx_lock(&shard->lock);
+    cmap_table_t * table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    size_t index;
+    cmap_node_t * node = find_node(map, table, key, hash, &index);
+    if (node) {
+        atomic_store_explicit(&table->slots[index], TOMBSTONE, memory_order_release);
+        atomic_store_explicit(&shard->count,
+            atomic_load_explicit(&shard->count, memory_order_relaxed) - 1, memory_order_relaxed);
+        shard->tombstones++;
+        retire(map, shard, node, false);
+    }
+    mtx_unlock(&shard->lock);
+    return node != NULL;
+}
+
+size_t cmap_size(cmap_t * map) {
+    if (!map) return 0;
+    size_t size = 0;
+    for (size_t i = 0; i < CMAP_SHARDS; i++)
+        size += atomic_load_explicit(&map->shards[i].count, memory_order_relaxed);
+    return size;
+}
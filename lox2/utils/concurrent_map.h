@@ -0,0 +1,62 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#ifndef LOX_CONCURRENT_MAP_H
+#define LOX_CONCURRENT_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Map shared between threads, for interned strings, global tables and
+ * compiled code caches.
+ *
+ * Keys are split over CMAP_SHARDS shards by hash. Writers (put, remove)
+ * take their shard's mutex, readers (get, contains) take no lock at all:
+ * each shard's table and entries are published with release stores and
+ * freed only after every reader that could still see them is done
+ * (epoch based reclamation, see concurrent_map.c).
+ *
+ * Keys are copied with key_copy and released with key_free, values are
+ * opaque words (usually pointers to shared objects) that the map never
+ * frees. A value read by get may be replaced right after; keeping the
+ * object it points to alive is up to the caller.
+ *
+ * Every thread touching a map takes one of CMAP_MAX_THREADS reader slots,
+ * released automatically when the thread exits.
+ */
+
+#define CMAP_SHARDS 16
+#define CMAP_MAX_THREADS 128
+
+typedef struct cmap cmap_t;
+
+typedef struct {
+    size_t (*key_hash)(void const * key);
+    bool (*key_equals)(void const * a, void const * b);
+    void * (*key_copy)(void const * key);  // NULL stores the key as given
+    void (*key_free)(void * key);          // NULL leaves it alone
+} cmap_config_t;
+
+cmap_t * cmap_create(size_t expected, cmap_config_t const * config);
+// Not thread safe, no other thread may be using the map
+void cmap_destroy(cmap_t * map);
+
+// Lock free, the value or NULL when missing
+void * cmap_get(cmap_t * map, void const * key);
+void * cmap_get_hashed(cmap_t * map, void const * key, size_t hash);
+bool cmap_contains(cmap_t * map, void const * key);
+
+// Insert or overwrite, true when the key was new
+bool cmap_put(cmap_t * map, void const * key, void * value);
+// Get-or-insert in one step: the value already stored for key, or value
+// after inserting it. What interning needs.
+void * cmap_put_if_absent(cmap_t * map, void const * key, void * value);
+void * cmap_put_if_absent_hashed(cmap_t * map, void const * key, size_t hash, void * value);
+bool cmap_remove(cmap_t * map, void const * key);
+
+// Approximate while writers are running
+size_t cmap_size(cmap_t * map);
+
+#endif //LOX_CONCURRENT_MAP_H
@@ -0,0 +1,112 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#ifndef LOX_HASH_H
+#define LOX_HASH_H
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ * The one string hash, shared by every map config, string objects and the
+ * symbol tables so a hash computed once (e.g. for an identifier at scan
+ * time) matches what any map's key_hash would produce.
+ *
+ * hash_bytes is in the wyhash family: with the length known up front it
+ * reads 8 bytes per load (16 per round, 48 per round past 48 bytes) and
+ * mixes with 64x64->128 bit multiplies, where djb2 and FNV-1a take one
+ * byte per multiply. See bench_hash for speed and distribution numbers.
+ */
+
+#define HASH_SEED 0x2d358dccaa6c78a5ULL
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+
+// 128 bit product of *a and *b: low half into *a, high half into *b
+static inline void hash_mum(uint64_t * a, uint64_t * b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t const r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t const a_lo = (uint32_t)*a, a_hi = *a >> 32, b_lo = (uint32_t)*b, b_hi = *b >> 32;
+    uint64_t const lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t const cross = (lo_lo >> 32) + (uint32_t)hi_lo + (uint32_t)lo_hi;
+    *b = hi_hi + (hi_lo >> 32) + (lo_hi >> 32) + (cross >> 32);
+    *a = cross << 32 | (uint32_t)lo_lo;
+#endif
+}
+// The product folded to 64 bits
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    hash_mum(&a, &b);
+    return a ^ b;
+}
+// Unaligned little endian loads through memcpy, a single mov on x86/arm64
+static inline uint64_t hash_read64(unsigned char const * p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+static inline uint64_t hash_read32(unsigned char const * p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline size_t hash_bytes(void const * data, size_t const len) {
+    unsigned char const * p = data;
+    uint64_t seed = HASH_SEED ^ hash_mix(HASH_SEED ^ HASH_P0, HASH_P1);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            // two overlapping 4 byte reads from each end cover 4..16 bytes
+            size_t const mid = (len >> 3) << 2;
+            a = hash_read32(p) << 32 | hash_read32(p + mid);
+            b = hash_read32(p + len - 4) << 32 | hash_read32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8 | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                seed = hash_mix(hash_read64(p) ^ HASH_P0, hash_read64(p + 8) ^ seed);
+                s1 = hash_mix(hash_read64(p + 16) ^ HASH_P1, hash_read64(p + 24) ^ s1);
+                s2 = hash_mix(hash_read64(p + 32) ^ HASH_P2, hash_read64(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            seed = hash_mix(hash_read64(p) ^ HASH_P0, hash_read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // the last 16 bytes, overlapping what was already mixed if need be
+        a = hash_read64(p + i - 16);
+        b = hash_read64(p + i - 8);
+    }
+    a ^= HASH_P1;
+    b ^= seed;
+    hash_mum(&a, &b);
+    return (size_t)hash_mix(a ^ HASH_P0 ^ len, b ^ HASH_P1);
+}
+
+static inline size_t hash_string(char const * s) {
+    if (!s) return 0;
+    return hash_bytes(s, strlen(s));
+}
+
+#endif //LOX_HASH_H
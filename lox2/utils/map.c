@@ -3,6 +3,7 @@
 //
 
 #include "map.h"
+#include "hash.h"
 #include <string.h>
 #include <stdlib.h>
 
@@ -32,13 +33,8 @@ struct map_enumerator {
 static void free_map_entry(map_entry_t * p_entry, free_fn_t kfree, free_fn_t vfree);
 
 static void free_wrapper(void const ** ptr);
-static size_t hash_string(const void * key) {
-    const unsigned char * str = key;
-    size_t hash = 5381;
-    int c;
-    while ((c = *str++))
-        hash = (hash << 5) + hash + c; // hash * 33 + c
-    return hash;
+static size_t hash_key_string(const void * key) {
+    return hash_string(key);
 }
 static bool cmp_string(const void * key1, const void * key2) {
     return strcmp(key1, key2) == 0;
@@ -53,7 +49,7 @@ static void * copy_string(const void * key) {
 }
 
 map_config_t map_default_config(void) {
-    return (map_config_t){ .hash = hash_string, .cmp = cmp_string,
+    return (map_config_t){ .hash = hash_key_string, .cmp = cmp_string,
                             .kcopy = copy_string, .vcopy = copy_string,
                             .kfree = free_wrapper, .vfree = free_wrapper
     };
@@ -80,7 +76,7 @@ map_t *map_create(const size_t num_buckets, const map_config_t config) {
     }
     map->num_buckets = num_buckets;
     map->size = 0;
-    map->hash = config.hash ? config.hash : hash_string;
+    map->hash = config.hash ? config.hash : hash_key_string;
     map->cmp = config.cmp ? config.cmp : cmp_string;
     map->kfree = config.kfree ? config.kfree : free_wrapper;
     map->vfree = config.vfree ? config.vfree : free_wrapper;
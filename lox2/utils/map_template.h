@@ -0,0 +1,215 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#ifndef LOX_MAP_TEMPLATE_H
+#define LOX_MAP_TEMPLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LOX_MAP_USE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ * Type specialized maps.
+ *
+ * DEFINE_MAP(NAME, KEY_T, VAL_T, HASH, EQUALS) expands to NAME_t plus a set
+ * of static inline NAME_* functions, the same Swiss table layout as map2 but
+ * with keys and values stored unboxed in the entries and HASH/EQUALS called
+ * directly, so both can be inlined. HASH(key) must return a size_t and
+ * EQUALS(a, b) a bool, either can be a function or a function-like macro.
+ *
+ * Keys are stored as given, a map owning its keys (strings) copies them
+ * before inserting and frees them when iterating before NAME_destroy.
+ *
+ *   DEFINE_MAP(symbol_value, uint32_t, value_t, hash_u32, u32_equals)
+ *   symbol_value_t m = {0};
+ *   symbol_value_put(&m, 7, value_nil());
+ *   value_t * v = symbol_value_find(&m, 7);
+ *
+ * Pointers returned by find/emplace stay valid until a new key is inserted.
+ */
+
+#define LOX_MAP_GROUP_WIDTH 16
+#define LOX_MAP_EMPTY ((int8_t)-128)
+#define LOX_MAP_DELETED ((int8_t)-2)
+#define LOX_MAP_MIN_CAPACITY 16
+
+static inline int lox_map_lowest(uint32_t const mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#ifdef LOX_MAP_USE_SSE2
+static inline uint32_t lox_map_match(int8_t const * ctrl, int8_t const h2) {
+    __m128i const group = _mm_loadu_si128((__m128i const *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+// empty or deleted, both have the sign bit set
+static inline uint32_t lox_map_match_free(int8_t const * ctrl) {
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((__m128i const *)ctrl));
+}
+#else
+static inline uint32_t lox_map_match(int8_t const * ctrl, int8_t const h2) {
+    uint32_t mask = 0;
+    for (int i = 0; i < LOX_MAP_GROUP_WIDTH; i++)
+        if (ctrl[i] == h2) mask |= (uint32_t)1 << i;
+    return mask;
+}
+static inline uint32_t lox_map_match_free(int8_t const * ctrl) {
+    uint32_t mask = 0;
+    for (int i = 0; i < LOX_MAP_GROUP_WIDTH; i++)
+        if (ctrl[i] < 0) mask |= (uint32_t)1 << i;
+    return mask;
+}
+#endif
+static inline size_t lox_map_mix(size_t const hash) {
+    uint64_t h = (uint64_t)hash;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+#define DEFINE_MAP(NAME, KEY_T, VAL_T, HASH, EQUALS)                                    \
+typedef struct {                                                                        \
+    size_t hash;                                                                        \
+    KEY_T key;                                                                          \
+    VAL_T value;                                                                        \
+} NAME##_entry_t;                                                                       \
+                                                                                        \
+typedef struct {                                                                        \
+    int8_t * ctrl;              /* capacity + LOX_MAP_GROUP_WIDTH, NULL until used */   \
+    NAME##_entry_t * entries;                                                           \
+    size_t capacity;                                                                    \
+    size_t size;                                                                        \
+    size_t tombstones;                                                                  \
+} NAME##_t;                                                                             \
+                                                                                        \
+static inline void NAME##_destroy(NAME##_t * m) {                                       \
+    free(m->ctrl);                                                                      \
+    free(m->entries);                                                                   \
+    memset(m, 0, sizeof(*m));                                                           \
+}                                                                                       \
+static inline void NAME##_set_ctrl_(NAME##_t const * m, size_t const i, int8_t const c) {\
+    m->ctrl[i] = c;                                                                     \
+    if (i < LOX_MAP_GROUP_WIDTH) m->ctrl[m->capacity + i] = c;                          \
+}                                                                                       \
+static inline size_t NAME##_probe_free_(NAME##_t const * m, size_t const hash) {        \
+    size_t const mask = m->capacity - 1;                                                \
+    size_t pos = (hash >> 7) & mask;                                                    \
+    for (size_t stride = LOX_MAP_GROUP_WIDTH; ; stride += LOX_MAP_GROUP_WIDTH) {        \
+        uint32_t const free_mask = lox_map_match_free(m->ctrl + pos);                   \
+        if (free_mask) return (pos + lox_map_lowest(free_mask)) & mask;                 \
+        pos = (pos + stride) & mask;                                                    \
+    }                                                                                   \
+}                                                                                       \
+/* hash is the mixed hash */                                                            \
+static inline NAME##_entry_t * NAME##_find_entry_(NAME##_t const * m, KEY_T const key,  \
+    size_t const hash) {                                                                \
+    if (!m->ctrl) return NULL;                                                          \
+    size_t const mask = m->capacity - 1;                                                \
+    int8_t const h2 = (int8_t)(hash & 0x7F);                                            \
+    size_t pos = (hash >> 7) & mask;                                                    \
+    for (size_t stride = LOX_MAP_GROUP_WIDTH; stride <= m->capacity + LOX_MAP_GROUP_WIDTH;\
+            stride += LOX_MAP_GROUP_WIDTH) {                                            \
+        uint32_t match = lox_map_match(m->ctrl + pos, h2);                              \
+        while (match) {                                                                 \
+            NAME##_entry_t * e = &m->entries[(pos + lox_map_lowest(match)) & mask];     \
+            if (e->hash == hash && EQUALS(e->key, key)) return e;                       \
+            match &= match - 1;                                                         \
+        }                                                                               \
+        if (lox_map_match(m->ctrl + pos, LOX_MAP_EMPTY)) return NULL;                   \
+        pos = (pos + stride) & mask;                                                    \
+    }                                                                                   \
+    return NULL;                                                                        \
+}                                                                                       \
+static inline void NAME##_rehash_(NAME##_t * m, size_t const capacity) {                \
+    NAME##_t old = *m;                                                                  \
+    m->ctrl = malloc(capacity + LOX_MAP_GROUP_WIDTH);                                   \
+    m->entries = malloc(capacity * sizeof(NAME##_entry_t));                             \
+    if (!m->ctrl || !m->entries) exit(EXIT_FAILURE);                                    \
+    memset(m->ctrl, (unsigned char)LOX_MAP_EMPTY, capacity + LOX_MAP_GROUP_WIDTH);      \
+    m->capacity = capacity;                                                             \
+    m->tombstones = 0;                                                                  \
+    for (size_t i = 0; i < old.capacity; i++) {                                         \
+        if (old.ctrl[i] < 0) continue;                                                  \
+        size_t const j = NAME##_probe_free_(m, old.entries[i].hash);                    \
+        m->entries[j] = old.entries[i];                                                 \
+        NAME##_set_ctrl_(m, j, old.ctrl[i]);                                            \
+    }                                                                                   \
+    free(old.ctrl);                                                                     \
+    free(old.entries);                                                                  \
+}                                                                                       \
+                                                                                        \
+/* The _hashed variants take HASH(key) precomputed by the caller */                     \
+static inline VAL_T * NAME##_find_hashed(NAME##_t const * m, KEY_T const key,           \
+    size_t const hash) {                                                                \
+    NAME##_entry_t * e = NAME##_find_entry_(m, key, lox_map_mix(hash));                 \
+    return e ? &e->value : NULL;                                                        \
+}                                                                                       \
+static inline VAL_T * NAME##_find(NAME##_t const * m, KEY_T const key) {                \
+    return NAME##_find_hashed(m, key, HASH(key));                                       \
+}                                                                                       \
+/* Get-or-insert, a new value is zeroed */                                              \
+static inline VAL_T * NAME##_emplace_hashed(NAME##_t * m, KEY_T const key,              \
+    size_t const key_hash, bool * p_inserted) {                                         \
+    size_t const hash = lox_map_mix(key_hash);                                          \
+    NAME##_entry_t * e = NAME##_find_entry_(m, key, hash);                              \
+    if (p_inserted) *p_inserted = e == NULL;                                            \
+    if (e) return &e->value;                                                            \
+    if (!m->ctrl) {                                                                     \
+        NAME##_rehash_(m, LOX_MAP_MIN_CAPACITY);                                        \
+    } else if ((m->size + m->tombstones + 1) * 8 > m->capacity * 7) {                   \
+        NAME##_rehash_(m, (m->size + 1) * 8 > m->capacity * 7 / 2                       \
+            ? m->capacity * 2 : m->capacity);                                           \
+    }                                                                                   \
+    size_t const i = NAME##_probe_free_(m, hash);                                       \
+    if (m->ctrl[i] == LOX_MAP_DELETED) m->tombstones--;                                 \
+    e = &m->entries[i];                                                                 \
+    memset(e, 0, sizeof(*e));                                                           \
+    e->hash = hash;                                                                     \
+    e->key = key;                                                                       \
+    NAME##_set_ctrl_(m, i, (int8_t)(hash & 0x7F));                                      \
+    m->size++;                                                                          \
+    return &e->value;                                                                   \
+}                                                                                       \
+static inline VAL_T * NAME##_emplace(NAME##_t * m, KEY_T const key, bool * p_inserted) {\
+    return NAME##_emplace_hashed(m, key, HASH(key), p_inserted);                        \
+}                                                                                       \
+static inline void NAME##_put(NAME##_t * m, KEY_T const key, VAL_T const value) {       \
+    *NAME##_emplace(m, key, NULL) = value;                                              \
+}                                                                                       \
+static inline bool NAME##_remove_hashed(NAME##_t * m, KEY_T const key, size_t const hash) {\
+    NAME##_entry_t * e = NAME##_find_entry_(m, key, lox_map_mix(hash));                 \
+    if (!e) return false;                                                               \
+    NAME##_set_ctrl_(m, (size_t)(e - m->entries), LOX_MAP_DELETED);                     \
+    m->size--;                                                                          \
+    m->tombstones++;                                                                    \
+    return true;                                                                        \
+}                                                                                       \
+static inline bool NAME##_remove(NAME##_t * m, KEY_T const key) {                       \
+    return NAME##_remove_hashed(m, key, HASH(key));                                     \
+}                                                                                       \
+/* Iteration: for (size_t i = 0; (e = NAME_next(&m, &i));) */                           \
+static inline NAME##_entry_t * NAME##_next(NAME##_t const * m, size_t * p_index) {      \
+    for (; *p_index < m->capacity; (*p_index)++) {                                      \
+        if (m->ctrl[*p_index] >= 0) return &m->entries[(*p_index)++];                   \
+    }                                                                                   \
+    return NULL;                                                                        \
+}
+
+#endif //LOX_MAP_TEMPLATE_H
@@ -0,0 +1,107 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#include "slab.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+// Chunks start with this header, blocks follow it
+typedef struct slab_chunk {
+    struct slab_chunk * next;
+    char padding[SLAB_GRANULE - sizeof(struct slab_chunk *)];
+} slab_chunk_t;
+
+typedef struct {
+    void * free;   // freed blocks, each holding the next
+    char * bump;   // never used blocks of the newest chunk
+    char * end;
+} slab_class_t;
+
+// One per thread, so no locking
+static thread_local struct {
+    slab_class_t classes[SLAB_CLASSES];
+    slab_chunk_t * chunks;
+    slab_stats_t stats;
+} g_slab = {0};
+
+static size_t class_of(size_t const size) {
+    return size ? (size - 1) / SLAB_GRANULE : 0;
+}
+
+static void add_chunk(slab_class_t * c) {
+    slab_chunk_t * chunk = malloc(SLAB_CHUNK_SIZE);
+    if (!chunk) {
+        fprintf(stderr, "Out of memory allocating a slab chunk\n");
+        exit(EXIT_FAILURE);
+    }
+    chunk->next = g_slab.chunks;
+    g_slab.chunks = chunk;
+    c->bump = (char*)(chunk + 1);
+    c->end = (char*)chunk + SLAB_CHUNK_SIZE;
+    g_slab.stats.chunks++;
+    g_slab.stats.bytes_reserved += SLAB_CHUNK_SIZE;
+}
+
+void * slab_alloc(size_t const size) {
+    g_slab.stats.allocations++;
+    if (size > SLAB_MAX_SIZE) {
+        g_slab.stats.large++;
+        void * p = malloc(size);
+        if (!p) {
+            fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
+            exit(EXIT_FAILURE);
+        }
+        return p;
+    }
+    size_t const index = class_of(size);
+    size_t const block = (index + 1) * SLAB_GRANULE;
+    slab_class_t * c = &g_slab.classes[index];
+    void * p = c->free;
+    if (p) {
+        c->free = *(void**)p;
+    } else {
+        if ((size_t)(c->end - c->bump) < block) add_chunk(c);
+        p = c->bump;
+        c->bump += block;
+    }
+    g_slab.stats.in_use[index]++;
+    g_slab.stats.bytes_in_use += block;
+    return p;
+}
+
+void slab_free(void * p, size_t const size) {
+    if (!p) return;
+    g_slab.stats.frees++;
+    if (size > SLAB_MAX_SIZE) {
+        free(p);
+        return;
+    }
+    size_t const index = class_of(size);
+    slab_class_t * c = &g_slab.classes[index];
+    *(void**)p = c->free;
+    c->free = p;
+    g_slab.stats.in_use[index]--;
+    g_slab.stats.bytes_in_use -= (index + 1) * SLAB_GRANULE;
+}
+
+void slab_release_all(void) {
+    while (g_slab.chunks) {
+        slab_chunk_t * next = g_slab.chunks->next;
+        free(g_slab.chunks);
+        g_slab.chunks = next;
+    }
+    for (size_t i = 0; i < SLAB_CLASSES; i++) {
+        g_slab.classes[i] = (slab_class_t){0};
+        g_slab.stats.in_use[i] = 0;
+    }
+    g_slab.stats.bytes_in_use = 0;
+    g_slab.stats.bytes_reserved = 0;
+    g_slab.stats.chunks = 0;
+}
+
+slab_stats_t slab_stats(void) {
+    return g_slab.stats;
+}
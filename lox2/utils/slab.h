@@ -0,0 +1,61 @@
+//
+// Created by adrian on 2025-10-19.
+//
+
+#ifndef LOX_SLAB_H
+#define LOX_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Size class allocator for the runtime's small blocks: objects, environments
+ * and their maps, name copies.
+ *
+ * Requests are rounded up to a multiple of SLAB_GRANULE (16, 32, 48, ...,
+ * SLAB_MAX_SIZE bytes), and each class hands out blocks carved from
+ * SLAB_CHUNK_SIZE chunks. A freed block goes on its class's free list and
+ * is the next one given out, so a steady mix of sizes runs on a few pushes
+ * and pops with no per-block header and no search. Larger requests go
+ * straight to malloc.
+ *
+ * Frees are sized: the caller passes the size it allocated with, which
+ * every user here knows anyway (object_size, the map's capacity, a key's
+ * length). slab_release_all drops every chunk at once, for teardown when
+ * nothing allocated here is used again.
+ *
+ * Every thread allocates from its own classes and chunks, without locks,
+ * and a block goes back to the thread that allocated it. slab_stats and
+ * slab_release_all are per thread too.
+ */
+
+#define SLAB_GRANULE 16
+#define SLAB_MAX_SIZE 512
+#define SLAB_CLASSES (SLAB_MAX_SIZE / SLAB_GRANULE)
+#define SLAB_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+    size_t allocations;              // every slab_alloc, large ones too
+    size_t frees;
+    size_t large;                    // passed on to malloc
+    size_t bytes_in_use;             // in blocks handed out, rounded to their class
+    size_t bytes_reserved;           // in chunks
+    size_t chunks;
+    size_t in_use[SLAB_CLASSES];     // blocks handed out per class
+} slab_stats_t;
+
+// The bytes slab_alloc(size) really hands out, size itself for large requests
+static inline size_t slab_block_size(size_t const size) {
+    if (size > SLAB_MAX_SIZE) return size;
+    return (size ? (size - 1) / SLAB_GRANULE + 1 : 1) * SLAB_GRANULE;
+}
+
+// A block of at least size bytes, 16 byte aligned
+void * slab_alloc(size_t size);
+// Gives back a slab_alloc block, size as it was allocated with. NULL is ignored.
+void slab_free(void * p, size_t size);
+// Frees every chunk, invalidating every block not freed yet. Large blocks are not tracked.
+void slab_release_all(void);
+slab_stats_t slab_stats(void);
+
+#endif //LOX_SLAB_H
@@ -24,8 +24,6 @@ stack_t *stack_create(size_t initial_capacity) {
 
 void stack_destroy(stack_t *stack) {
     if (stack) {
-        fprintf(stderr, "Stack should not exist here");
-        exit(EXIT_FAILURE);
         free(stack->data);
         free(stack);
     }
@@ -4,8 +4,10 @@
 
 #ifndef LOX_VALUE_H
 #define LOX_VALUE_H
+#include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "object.h"
@@ -19,6 +21,110 @@ typedef enum {
     VAL_OBJ
 } value_type_t;
 
+/*
+ * Two representations behind one API, picked at compile time:
+ *
+ *   default          16 byte tagged union
+ *   LOX_NAN_BOXING   8 bytes, everything packed into one uint64_t
+ *
+ * Code outside this header only goes through value_type()/value_as_*()
+ * and the constructors, never the fields, so both build the same way.
+ *
+ * The boxed encoding offsets every double by 2^49 (JavaScriptCore style),
+ * which keeps the all zero pattern free for nil: a zero-initialized slot
+ * is nil in both modes, so memset/calloc'd stacks and tables still work.
+ *
+ *   0x0000 0000 0000 0000              nil
+ *   0x0000 0000 0000 0002 / ...0003    false / true
+ *   0x0000 pppp pppp ppp0              object pointer (8 byte aligned, < 2^48)
+ *   >= 0x0002 0000 0000 0000           double bits + 2^49
+ *
+ * Adding 2^49 cannot wrap because NaNs are canonicalized first, the largest
+ * remaining pattern being -inf (0xfff0...).
+ */
+
+#ifdef LOX_NAN_BOXING
+
+// must be zero-initialized when allocated
+typedef struct value {
+    uint64_t bits;
+} value_t;
+
+#define NANBOX_NIL ((uint64_t)0)
+#define NANBOX_FALSE ((uint64_t)2)
+#define NANBOX_TRUE ((uint64_t)3)
+#define NANBOX_DOUBLE_OFFSET ((uint64_t)1 << 49)
+#define NANBOX_CANONICAL_NAN ((uint64_t)0x7ff8000000000000ULL)
+
+static_assert(sizeof(value_t) == 8, "NaN-boxed value_t must be 8 bytes");
+
+static inline value_type_t value_type(value_t const v) {
+    if (v.bits >= NANBOX_DOUBLE_OFFSET) return VAL_NUMBER;
+    if (v.bits == NANBOX_NIL) return VAL_NIL;
+    if (v.bits <= NANBOX_TRUE) return VAL_BOOL;
+    return VAL_OBJ;
+}
+static inline bool value_as_bool(value_t const v) {
+    return v.bits == NANBOX_TRUE;
+}
+static inline double value_as_number(value_t const v) {
+    uint64_t const bits = v.bits - NANBOX_DOUBLE_OFFSET;
+    double n;
+    memcpy(&n, &bits, sizeof(n));
+    return n;
+}
+static inline object_t * value_as_object(value_t const v) {
+    return (object_t *)(uintptr_t)v.bits;
+}
+
+static inline value_t value_nil(void) {
+    return (value_t){ NANBOX_NIL };
+}
+static inline value_t value_bool(bool const b) {
+    return (value_t){ b ? NANBOX_TRUE : NANBOX_FALSE };
+}
+static inline value_t value_number(double const n) {
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    if (n != n) bits = NANBOX_CANONICAL_NAN;
+    return (value_t){ bits + NANBOX_DOUBLE_OFFSET };
+}
+// A null object boxes to nil, the pattern it would otherwise collide with
+static inline value_t value_object(object_t * o) {
+    if (o) obj_inc_ref(o);
+    return (value_t){ (uint64_t)(uintptr_t)o };
+}
+static inline void value_free(value_t * v) {
+    if (!v) return;
+    if (value_type(*v) == VAL_OBJ) obj_dec_ref(value_as_object(*v));
+    v->bits = NANBOX_NIL;
+}
+static inline bool value_is_truthy(value_t const * v) {
+    // nil and false are the two lowest patterns, numbers are falsy at zero
+    if (v->bits <= NANBOX_FALSE) return false;
+    if (v->bits >= NANBOX_DOUBLE_OFFSET) return value_as_number(*v) != 0.0;
+    return true;
+}
+static inline bool value_equals(value_t const * a, value_t const * b) {
+    // numbers compare as doubles so 0.0 == -0.0 and NaN != NaN
+    if (a->bits >= NANBOX_DOUBLE_OFFSET && b->bits >= NANBOX_DOUBLE_OFFSET)
+        return value_as_number(*a) == value_as_number(*b);
+    if (a->bits == b->bits) return true;
+    // a rope equals the interned string it flattens to
+    object_t * o_a = value_type(*a) == VAL_OBJ ? value_as_object(*a) : NULL;
+    object_t * o_b = value_type(*b) == VAL_OBJ ? value_as_object(*b) : NULL;
+    if ((o_a && o_a->type == OBJ_ROPE && obj_is_string(o_b)) ||
+        (o_b && o_b->type == OBJ_ROPE && obj_is_string(o_a)))
+        return obj_string_same(obj_as_string(o_a), obj_as_string(o_b));
+#ifdef LOX_BIASED_RC
+    // strings interned by different threads
+    if (o_a && o_b && o_a->type == OBJ_STRING && o_b->type == OBJ_STRING)
+        return obj_string_same((obj_string_t*)o_a, (obj_string_t*)o_b);
+#endif
+    return false;
+}
+
+#else
 
 // must be zero-initialized when allocated
 typedef struct value {
@@ -30,13 +136,26 @@ typedef struct value {
     } as;
 } value_t;
 
+static inline value_type_t value_type(value_t const v) {
+    return v.type;
+}
+static inline bool value_as_bool(value_t const v) {
+    return v.as.boolean;
+}
+static inline double value_as_number(value_t const v) {
+    return v.as.number;
+}
+static inline object_t * value_as_object(value_t const v) {
+    return v.as.object;
+}
+
 static inline value_t value_nil(void) {
     value_t v; v.type = VAL_NIL; v.as.number = 0.0; return v;
 }
-inline value_t value_bool(bool const b) {
+static inline value_t value_bool(bool const b) {
     value_t v; v.type = VAL_BOOL; v.as.boolean = b; return v;
 }
-inline value_t value_number(double const n) {
+static inline value_t value_number(double const n) {
     value_t v; v.type = VAL_NUMBER; v.as.number = n; return v;
 }
 static inline value_t value_object(object_t * o) {
@@ -66,20 +185,41 @@ static inline bool value_equals(value_t const * a, value_t const * b) {
         case VAL_NIL:       return true;
         case VAL_BOOL:      return a->as.boolean == b->as.boolean;
         case VAL_NUMBER:    return a->as.number == b->as.number;
-        case VAL_OBJ:       return a->as.object == b->as.object;
+        case VAL_OBJ:
+            if (a->as.object == b->as.object) return true;
+            // a rope equals the interned string it flattens to
+            if ((a->as.object && a->as.object->type == OBJ_ROPE && obj_is_string(b->as.object)) ||
+                (b->as.object && b->as.object->type == OBJ_ROPE && obj_is_string(a->as.object)))
+                return obj_string_same(obj_as_string(a->as.object), obj_as_string(b->as.object));
+#ifdef LOX_BIASED_RC
+            // strings interned by different threads
+            if (a->as.object && b->as.object &&
+                a->as.object->type == OBJ_STRING && b->as.object->type == OBJ_STRING)
+                return obj_string_same((obj_string_t*)a->as.object, (obj_string_t*)b->as.object);
+#endif
+            return false;
     }
     return false;
 }
+
+#endif // LOX_NAN_BOXING
+
+// Another reference to v's object, for a copy that is dropped with value_free
+static inline value_t value_dup(value_t const * v) {
+    if (value_type(*v) == VAL_OBJ) obj_inc_ref(value_as_object(*v));
+    return *v;
+}
+
 static inline void value_print(value_t const * v) {
-    switch (v->type) {
+    switch (value_type(*v)) {
         case VAL_NIL:       printf("nil"); break;
-        case VAL_BOOL:      printf(v->as.boolean ? "true" : "false"); break;
-        case VAL_NUMBER:    printf("%g", v->as.number); break;
+        case VAL_BOOL:      printf(value_as_bool(*v) ? "true" : "false"); break;
+        case VAL_NUMBER:    printf("%g", value_as_number(*v)); break;
         case VAL_OBJ:
-            if (!v->as.object) { printf("nil"); break;}
-            printf("<object:%d>", (int)v->as.object->type);
+            if (!value_as_object(*v)) { printf("nil"); break;}
+            printf("<object:%d>", (int)value_as_object(*v)->type);
         default:
             break;
     }
 }
-#endif //LOX_VALUE_H
\ No newline at end of file
+#endif //LOX_VALUE_H
@@ -25,7 +25,7 @@ static const char* ast_expr_grammar[] = {
 
 static const char* ast_stmt_grammar[] = {
       "block    : stmt_t ** statements, size_t * count",
-      "function   : token_t* name, token_t ** params, size_t * params_count, stmt_t ** body, size_t * count",
+      "function   : token_t* name, token_t ** params, size_t * params_count, stmt_t ** body, size_t * count, upvalue_desc_t * upvalues, size_t upvalues_count",
       "class     : token_t * name, expr_t ** superclass, stmt_t ** methods, size_t methods_count",
       "expression : expr_t * expression",
       "if         : expr_t * condition, stmt_t * then_branch, stmt_t * else_branch",
@@ -54,6 +54,7 @@ void GenerateAst(const char* output_dir, const char* string_base_name, const cha
     append_string(&sb, "//#include \"Stmt.h\"\n");
     append_string(&sb, "#include \"Token.h\"\n\n");
     append_string(&sb, "#include \"Object.h\"\n");
+    append_string(&sb, "#include \"Upvalue.h\"\n");
     append_string(&sb, "\n");
 
     append_string(&sb_to_c, "#include \"Expr.h\"\n");
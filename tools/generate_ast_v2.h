@@ -8,7 +8,7 @@
 #include <stddef.h>
 
 static char const * g_ast_expr_grammar[] = {
-    "assign   : expr_t * target, expr_t * value",
+    "assign   : expr_t * target, expr_t * value, bool borrowed",
     "binary   : expr_t * left, token_t * operator, expr_t * right",
     "call     : expr_t * callee, token_t * paren, expr_t ** arguments, size_t count",
     "get      : expr_t * object, token_t * name",
@@ -19,19 +19,19 @@ static char const * g_ast_expr_grammar[] = {
     "super    : token_t * keyword, token_t * method",
     "this     : token_t * keyword",
     "unary    : token_t * operator, expr_t * right",
-    "variable : token_t * name, int depth",
+    "variable : token_t * name, int depth, int slot, int global, bool borrowed, bool moved",
     NULL
 };
 
 static char const * g_ast_stmt_grammar[] = {
-    "block      : stmt_t ** statements, size_t count",
-    "function   : token_t * name, token_t ** params, size_t params_count, stmt_t ** body, size_t count",
+    "block      : stmt_t ** statements, size_t count, bool needs_environment, int first_slot, int slot_count",
+    "function   : token_t * name, token_t ** params, size_t params_count, bool * params_captured, stmt_t ** body, size_t count",
     "class      : token_t * name, expr_t ** superclass, size_t superclass_count, stmt_t ** methods, size_t methods_count",
     "expression : expr_t * expression",
     "if         : expr_t * condition, stmt_t * then_branch, stmt_t * else_branch",
     "print      : expr_t * expression",
     "return     : token_t * keyword, expr_t * value",
-    "var        : token_t * name, expr_t * initializer",
+    "var        : token_t * name, expr_t * initializer, int slot, bool captured, int global",
     "while      : expr_t * condition, stmt_t * body",
     NULL
 };